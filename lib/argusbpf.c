@@ -0,0 +1,625 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/btf.h>
+#include <bpf/libbpf.h>
+
+#include "argus.skel.h"
+#include "argusbpf.h"
+#include "arguscache.h"
+#include "argusnotify.h"
+#include "argusutil.h"
+
+static struct argus_bpf *skel_;
+static struct ring_buffer *rb_;
+static struct argusbpf_subject **subjects_;
+static struct argusbpf_prefix *prefixes_;
+static unsigned int subjectc_, subjectmax_, prefixc_;
+static pthread_mutex_t bpf_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Load and attach the BPF programs and start the thread that reads their
+ * ring buffer. Once started, `start_bpf_watcher` can be used in place of
+ * `start_inotify_watcher`. Needs a kernel with BTF and BPF LSM enabled
+ * (`lsm=...,bpf`), and `CAP_BPF`, `CAP_PERFMON` and `CAP_MAC_ADMIN` (or
+ * `CAP_SYS_ADMIN`).
+ *
+ * @return 0 on success, -1 on error.
+ */
+int start_bpf_backend(void) {
+    pthread_t thread;
+
+    if ((skel_ = argus_bpf__open()) == NULL) {
+#if DEBUG
+        perror("argus_bpf__open");
+#endif
+        return -1;
+    }
+    // Only one of the `inode_setattr` programs matches this kernel's hook.
+    bpf_program__set_autoload(setattr_takes_idmap() ?
+        skel_->progs.argus_inode_setattr : skel_->progs.argus_inode_setattr_idmap, false);
+    if (argus_bpf__load(skel_) != 0) {
+#if DEBUG
+        perror("argus_bpf__load");
+#endif
+        goto err;
+    }
+    if (argus_bpf__attach(skel_) != 0) {
+#if DEBUG
+        perror("argus_bpf__attach");
+#endif
+        goto err;
+    }
+    if ((rb_ = ring_buffer__new(bpf_map__fd(skel_->maps.events), handle_bpf_event, NULL, NULL)) == NULL) {
+#if DEBUG
+        perror("ring_buffer__new");
+#endif
+        goto err;
+    }
+    if (pthread_create(&thread, NULL, consume_bpf_events, NULL) != 0) {
+#if DEBUG
+        perror("pthread_create");
+#endif
+        goto err;
+    }
+    pthread_setname_np(thread, "argus-bpf");
+    pthread_detach(thread);
+    return 0;
+
+err:
+    ring_buffer__free(rb_);
+    rb_ = NULL;
+    argus_bpf__destroy(skel_);
+    skel_ = NULL;
+    return -1;
+}
+
+/**
+ * Whether the kernel's `inode_setattr` LSM hook takes a `struct mnt_idmap`
+ * first (6.8 and later), read from the prototype of `bpf_lsm_inode_setattr`
+ * in the kernel's BTF.
+ *
+ * @return
+ */
+static bool setattr_takes_idmap(void) {
+    struct btf *btf;
+    const struct btf_type *func, *proto;
+    int id;
+    bool idmap = false;
+
+    if ((btf = btf__load_vmlinux_btf()) == NULL) {
+#if DEBUG
+        perror("btf__load_vmlinux_btf");
+#endif
+        return false;
+    }
+    if ((id = btf__find_by_name_kind(btf, "bpf_lsm_inode_setattr", BTF_KIND_FUNC)) > 0 &&
+        (func = btf__type_by_id(btf, id)) != NULL &&
+        (proto = btf__type_by_id(btf, func->type)) != NULL) {
+        idmap = btf_vlen(proto) == 3;
+    }
+    btf__free(btf);
+    return idmap;
+}
+
+bool bpf_backend_enabled(void) {
+    return rb_ != NULL;
+}
+
+/**
+ * Events the BPF programs matched but could not write to a full ring buffer.
+ *
+ * @return
+ */
+uint64_t bpf_dropped_events(void) {
+    int ncpus = libbpf_num_possible_cpus(), i;
+    uint32_t zero = 0;
+    uint64_t *values, total = 0;
+
+    if (!bpf_backend_enabled() ||
+        ncpus < 1 ||
+        (values = calloc(ncpus, sizeof(uint64_t))) == NULL) {
+        return 0;
+    }
+    if (bpf_map_lookup_elem(bpf_map__fd(skel_->maps.dropped), &zero, values) == 0) {
+        for (i = 0; i < ncpus; ++i) {
+            total += values[i];
+        }
+    }
+    free(values);
+    return total;
+}
+
+/**
+ * Watch the paths of a subject through the BPF programs instead of
+ * `inotify`; takes the same parameters as `start_inotify_watcher` and, like
+ * it, returns once the watcher receives its kill signal. Events are matched
+ * in the kernel by the cgroup of the process making the change and by path
+ * prefix, so no tree is walked and no watch descriptors are used; `onlydir`,
+ * `maxdepth` and `ignore` are applied as events arrive. `.argusignore` files
+ * are not read.
+ *
+ * @param name
+ * @param nodename
+ * @param podname
+ * @param pid
+ * @param sid
+ * @param pathc
+ * @param paths
+ * @param ignorec
+ * @param ignores
+ * @param mask
+ * @param flags
+ * @param maxdepth
+ * @param tags
+ * @param logformat
+ * @param logfn
+ * @return
+ */
+int start_bpf_watcher(const char *name, const char *nodename, const char *podname, const int pid, const int sid,
+    const unsigned int pathc, const char *paths[], const unsigned int ignorec, const char *ignores[], const uint32_t mask,
+    const uint32_t flags, const int maxdepth, const char *tags, const char *logformat, arguswatch_logfn logfn) {
+
+    struct arguswatch watch = {
+        .name = name,
+        .node_name = nodename,
+        .pod_name = podname,
+        .tags = tags,
+        .log_format = logformat,
+        .rootpaths = (char **)paths,
+        .rootpathc = pathc,
+        .ignores = (char **)ignores,
+        .ignorec = ignorec,
+        .event_mask = mask,
+        .flags = flags,
+        .max_depth = maxdepth,
+        .pid = pid,
+        .sid = sid,
+        .slot = -1,
+        .fd = EOF,
+        .processevtfd = EOF,
+        .efd = EOF
+    }, *watchp = &watch;
+    struct argusbpf_subject subject = {
+        .watch = &watch,
+        .logfn = logfn
+    }, **subjects;
+    char procroot[PATH_MAX], fspath[PATH_MAX];
+    const char *path;
+    size_t rootlen;
+    uint64_t value;
+    unsigned int i;
+    int id, rc = EXIT_FAILURE;
+
+    if (!bpf_backend_enabled() ||
+        (subject.cgroup = find_cgroup_id(pid)) == 0) {
+        return EXIT_FAILURE;
+    }
+    if ((watch.processevtfd = eventfd(0, EFD_CLOEXEC)) == EOF) {
+#if DEBUG
+        perror("eventfd");
+#endif
+        return EXIT_FAILURE;
+    }
+    if ((subject.paths = calloc(pathc, sizeof(struct argusbpf_path))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        close(watch.processevtfd);
+        return EXIT_FAILURE;
+    }
+    // Cache the watch so kill signals reach it, including ones sent while the
+    // paths are being registered.
+    add_watch_to_cache(&watchp);
+    snprintf(procroot, sizeof(procroot), "/proc/%d/root", pid);
+    rootlen = strlen(procroot);
+
+    pthread_mutex_lock(&bpf_mutex_);
+    for (i = 0; i < pathc; ++i) {
+        subject.paths[i].id = -1;
+        subject.paths[i].rootpath = paths[i];
+        // The kernel sees paths inside the container's mounts, not ours.
+        path = strncmp(paths[i], procroot, rootlen) == 0 ? paths[i] + rootlen : paths[i];
+        if (find_fs_path(pid, *path ? path : "/", fspath, sizeof(fspath)) == -1 ||
+            (id = register_bpf_path(subject.cgroup, fspath)) == -1) {
+#if DEBUG
+            fprintf(stderr, "not watching '%s' with BPF\n", paths[i]);
+#endif
+            continue;
+        }
+        subject.paths[i].id = id;
+        subject.paths[i].fslen = strlen(fspath);
+    }
+    subject.pathc = pathc;
+    if (subjectc_ == subjectmax_) {
+        if ((subjects = realloc(subjects_, (subjectmax_ + BPF_SUBJECTS_INC) * sizeof(struct argusbpf_subject *))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            goto unregister;
+        }
+        subjects_ = subjects;
+        subjectmax_ += BPF_SUBJECTS_INC;
+    }
+    subjects_[subjectc_++] = &subject;
+    sync_bpf_maps();
+    pthread_mutex_unlock(&bpf_mutex_);
+
+    struct arguswatch_event readyevt = {
+        .watch = &watch,
+        .event_mask = AW_READY,
+        .path_name = pathc > 0 ? paths[0] : "",
+        .file_name = "",
+        .is_dir = true
+    };
+    (*logfn)(&readyevt);
+
+    for (;;) {
+        if (read(watch.processevtfd, &value, sizeof(value)) == EOF) {
+            if (errno == EINTR) {
+                continue;
+            }
+#if DEBUG
+            perror("read");
+#endif
+            break;
+        }
+        if (ARGUSNOTIFY_KILLED(value)) {
+            break;
+        }
+    }
+    rc = EXIT_SUCCESS;
+
+    pthread_mutex_lock(&bpf_mutex_);
+    for (i = 0; i < subjectc_; ++i) {
+        if (subjects_[i] == &subject) {
+            subjects_[i] = subjects_[--subjectc_];
+            break;
+        }
+    }
+unregister:
+    for (i = 0; i < pathc; ++i) {
+        if (subject.paths[i].id > -1) {
+            --prefixes_[subject.paths[i].id].refs;
+        }
+    }
+    sync_bpf_maps();
+    pthread_mutex_unlock(&bpf_mutex_);
+
+    if (watch.slot > -1) {
+        mark_cache_slot_empty(watch.slot);
+    }
+    close(watch.processevtfd);
+    free(subject.paths);
+    return rc;
+}
+
+/**
+ * Read the ring buffer until the process exits, passing each event to
+ * `handle_bpf_event`.
+ *
+ * @param arg
+ * @return
+ */
+static void *consume_bpf_events(void *arg) {
+    int err;
+    for (;;) {
+        if ((err = ring_buffer__poll(rb_, -1)) < 0 &&
+            err != -EINTR) {
+#if DEBUG
+            fprintf(stderr, "ring_buffer__poll: %d\n", err);
+#endif
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Report an event from the ring buffer to every subject with a path
+ * registered as its prefix.
+ *
+ * @param ctx
+ * @param data
+ * @param len
+ * @return
+ */
+static int handle_bpf_event(void *ctx, void *data, size_t len) {
+    const struct argusbpf_event *event = data;
+    unsigned int i, j;
+
+    if (len < sizeof(struct argusbpf_event) ||
+        event->pathlen >= ARGUSBPF_PATH_MAX) {
+        return 0;
+    }
+    pthread_mutex_lock(&bpf_mutex_);
+    for (i = 0; i < subjectc_; ++i) {
+        for (j = 0; j < subjects_[i]->pathc; ++j) {
+            if (subjects_[i]->paths[j].id == (int)event->id &&
+                subjects_[i]->paths[j].fslen <= event->pathlen) {
+                report_bpf_event(subjects_[i], &subjects_[i]->paths[j], event);
+            }
+        }
+    }
+    pthread_mutex_unlock(&bpf_mutex_);
+    return 0;
+}
+
+/**
+ * Apply the subject's event mask, `onlydir`, depth and ignore list to an
+ * event under one of its paths, and pass it to the log function named as
+ * `inotify` would have: the directory under `/proc/[pid]/root` and the name
+ * of the file in it.
+ *
+ * @param subject
+ * @param path
+ * @param event
+ */
+static void report_bpf_event(const struct argusbpf_subject *const subject, const struct argusbpf_path *const path,
+    const struct argusbpf_event *const event) {
+
+    const struct arguswatch *watch = subject->watch;
+    char rel[ARGUSBPF_PATH_MAX + 1], dir[PATH_MAX], *name, *base;
+    bool isdir = event->mask & IN_ISDIR;
+    unsigned int i, depth = 0;
+
+    if (!(event->mask & watch->event_mask) ||
+        ((watch->flags & AW_ONLYDIR) && !isdir)) {
+        return;
+    }
+    // Path below the subject's path: "" for the path itself, else "/a/b".
+    memcpy(rel, event->path + path->fslen, event->pathlen - path->fslen);
+    rel[event->pathlen - path->fslen] = '\0';
+
+    for (name = rel; name != NULL && *name; name = strchr(name + 1, '/')) {
+        ++depth;
+        for (i = 0; i < watch->ignorec; ++i) {
+            size_t len = strlen(watch->ignores[i]);
+            if (strncmp(name + 1, watch->ignores[i], len) == 0 &&
+                (name[len + 1] == '/' || name[len + 1] == '\0')) {
+                return;
+            }
+        }
+    }
+    if ((!(watch->flags & AW_RECURSIVE) && depth > 1) ||
+        (watch->max_depth && (int)depth > watch->max_depth + 1)) {
+        return;
+    }
+
+    base = strrchr(rel, '/');
+    snprintf(dir, sizeof(dir), "%s%.*s", path->rootpath, base != NULL ? (int)(base - rel) : 0, rel);
+    struct arguswatch_event awevent = {
+        .watch = subject->watch,
+        .event_mask = event->mask,
+        .path_name = dir,
+        .file_name = base != NULL ? base + 1 : "",
+        .is_dir = isdir
+    };
+    (*subject->logfn)(&awevent);
+}
+
+/**
+ * Find the ID of the cgroup v2 a process runs in, which is the inode number
+ * of its directory under `/sys/fs/cgroup`.
+ *
+ * @param pid
+ * @return 0 if not found.
+ */
+static uint64_t find_cgroup_id(const int pid) {
+    char path[PATH_MAX], *line = NULL;
+    size_t len = 0;
+    ssize_t n;
+    struct stat sb;
+    uint64_t id = 0;
+    FILE *fp;
+
+    snprintf(path, sizeof(path), "/proc/%d/cgroup", pid);
+    if ((fp = fopen(path, "re")) == NULL) {
+#if DEBUG
+        perror("fopen");
+#endif
+        return 0;
+    }
+    while ((n = getline(&line, &len, fp)) != EOF) {
+        if (strncmp(line, "0::", 3) != 0) {
+            continue;
+        }
+        if (n > 0 && line[n - 1] == '\n') {
+            line[n - 1] = '\0';
+        }
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s", line + 3);
+        if (stat(path, &sb) == 0) {
+            id = sb.st_ino;
+        }
+        break;
+    }
+    free(line);
+    fclose(fp);
+    return id;
+}
+
+/**
+ * Translate a path inside a process's mount namespace into the path the BPF
+ * programs build for it: relative to the root of the filesystem it is on, by
+ * way of the mount that holds it in `/proc/[pid]/mountinfo`. A trailing `/`
+ * is dropped, so the root of a filesystem is "".
+ *
+ * @param pid
+ * @param path
+ * @param fspath
+ * @param len
+ * @return 0 on success, -1 if no mount holds `path` or the result is too long.
+ */
+static int find_fs_path(const int pid, const char *path, char *fspath, const size_t len) {
+    char mountinfo[PATH_MAX], root[PATH_MAX], mountpoint[PATH_MAX], *line = NULL;
+    size_t linelen = 0, mplen, best = 0;
+    bool found = false;
+    FILE *fp;
+
+    snprintf(mountinfo, sizeof(mountinfo), "/proc/%d/mountinfo", pid);
+    if ((fp = fopen(mountinfo, "re")) == NULL) {
+#if DEBUG
+        perror("fopen");
+#endif
+        return -1;
+    }
+    while (getline(&line, &linelen, fp) != EOF) {
+        // ID, parent ID, major:minor, root, mount point, ...
+        if (sscanf(line, "%*d %*d %*s %4095s %4095s", root, mountpoint) != 2) {
+            continue;
+        }
+        mplen = strcmp(mountpoint, "/") == 0 ? 0 : strlen(mountpoint);
+        // Mounts are listed in order, so the last of the longest wins.
+        if (strncmp(path, mountpoint, mplen) != 0 ||
+            (path[mplen] != '/' && path[mplen] != '\0') ||
+            (found && mplen < best)) {
+            continue;
+        }
+        snprintf(fspath, len, "%s%s", strcmp(root, "/") == 0 ? "" : root, path + mplen);
+        best = mplen;
+        found = true;
+    }
+    free(line);
+    fclose(fp);
+
+    if (!found) {
+        return -1;
+    }
+    mplen = strlen(fspath);
+    while (mplen > 0 && fspath[mplen - 1] == '/') {
+        fspath[--mplen] = '\0';
+    }
+    return mplen < ARGUSBPF_PATH_MAX ? 0 : -1;
+}
+
+/**
+ * Take a reference on the prefix for `fspath` in `cgroup`, adding it to the
+ * loader's table if it is new; `sync_bpf_maps` writes it to the kernel.
+ *
+ * @param cgroup
+ * @param fspath
+ * @return Index of the prefix, or -1 on error.
+ */
+static int register_bpf_path(const uint64_t cgroup, const char *fspath) {
+    struct argusbpf_key key = {0};
+    struct argusbpf_prefix *prefixes;
+    size_t len = strlen(fspath);
+    unsigned int i;
+    int slot = -1;
+
+    key.prefixlen = (sizeof(key.cgroup) + len) * 8;
+    memcpy(key.cgroup, &cgroup, sizeof(key.cgroup));
+    memcpy(key.path, fspath, len);
+
+    for (i = 0; i < prefixc_; ++i) {
+        if (memcmp(&prefixes_[i].key, &key, sizeof(key)) == 0) {
+            ++prefixes_[i].refs;
+            return i;
+        }
+        if (slot == -1 &&
+            prefixes_[i].refs == 0 &&
+            !prefixes_[i].inserted) {
+            slot = i;
+        }
+    }
+    if (slot == -1) {
+        if (prefixc_ >= ARGUSBPF_MAX_TARGETS ||
+            (prefixes = realloc(prefixes_, (prefixc_ + BPF_PREFIXES_INC) * sizeof(struct argusbpf_prefix))) == NULL) {
+            return -1;
+        }
+        memset(prefixes + prefixc_, 0, BPF_PREFIXES_INC * sizeof(struct argusbpf_prefix));
+        prefixes_ = prefixes;
+        slot = prefixc_;
+        prefixc_ += BPF_PREFIXES_INC;
+    }
+    prefixes_[slot].key = key;
+    prefixes_[slot].refs = 1;
+    return slot;
+}
+
+/**
+ * Write the loader's table to the `targets` and `cgroups` maps: each prefix
+ * with the union of the event masks of the subjects watching it, each cgroup
+ * with the union of its subjects' masks, and delete prefixes and cgroups no
+ * subject watches any more. Called with `bpf_mutex_` held.
+ */
+static void sync_bpf_maps(void) {
+    int targetsfd = bpf_map__fd(skel_->maps.targets), cgroupsfd = bpf_map__fd(skel_->maps.cgroups);
+    struct argusbpf_match match;
+    uint64_t cgroup;
+    uint32_t cgroupmask;
+    unsigned int i, j, k;
+
+    for (i = 0; i < prefixc_; ++i) {
+        memcpy(&cgroup, prefixes_[i].key.cgroup, sizeof(cgroup));
+        match = (struct argusbpf_match){
+            .id = i,
+            .pathlen = prefixes_[i].key.prefixlen / 8 - sizeof(prefixes_[i].key.cgroup)
+        };
+        cgroupmask = 0;
+        for (j = 0; j < subjectc_; ++j) {
+            if (subjects_[j]->cgroup != cgroup) {
+                continue;
+            }
+            cgroupmask |= subjects_[j]->watch->event_mask;
+            for (k = 0; k < subjects_[j]->pathc; ++k) {
+                if (subjects_[j]->paths[k].id == (int)i) {
+                    match.mask |= subjects_[j]->watch->event_mask;
+                }
+            }
+        }
+
+        if (prefixes_[i].refs == 0) {
+            if (prefixes_[i].inserted) {
+                bpf_map_delete_elem(targetsfd, &prefixes_[i].key);
+                if (cgroupmask == 0) {
+                    bpf_map_delete_elem(cgroupsfd, &cgroup);
+                }
+                prefixes_[i].inserted = false;
+            }
+            continue;
+        }
+        if (bpf_map_update_elem(targetsfd, &prefixes_[i].key, &match, BPF_ANY) != 0 ||
+            bpf_map_update_elem(cgroupsfd, &cgroup, &cgroupmask, BPF_ANY) != 0) {
+#if DEBUG
+            perror("bpf_map_update_elem");
+#endif
+            continue;
+        }
+        prefixes_[i].inserted = true;
+    }
+}
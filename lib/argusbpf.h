@@ -0,0 +1,77 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUS_BPF_LOADER__
+#define __ARGUS_BPF_LOADER__
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "bpf/argus.bpf.h"
+#include "argusutil.h"
+
+#define BPF_SUBJECTS_INC 16
+#define BPF_PREFIXES_INC 16
+
+// One path of a subject, as registered with the kernel.
+struct argusbpf_path {
+    int id;                           // Index of its prefix in the loader's table; -1 if not registered.
+    size_t fslen;                     // Length of the path relative to the root of its filesystem.
+    const char *rootpath;             // The subject's path, under `/proc/[pid]/root`.
+};
+
+struct argusbpf_subject {
+    struct arguswatch *watch;
+    arguswatch_logfn logfn;
+    uint64_t cgroup;
+    struct argusbpf_path *paths;
+    unsigned int pathc;
+};
+
+// An entry of the `targets` map and the number of subject paths sharing it.
+struct argusbpf_prefix {
+    struct argusbpf_key key;
+    unsigned int refs;
+    bool inserted;
+};
+
+int start_bpf_backend(void);
+bool bpf_backend_enabled(void);
+uint64_t bpf_dropped_events(void);
+int start_bpf_watcher(const char *name, const char *nodename, const char *podname, int pid, int sid,
+    unsigned int pathc, const char *paths[], unsigned int ignorec, const char *ignores[], uint32_t mask, uint32_t flags,
+    int maxdepth, const char *tags, const char *logformat, arguswatch_logfn logfn);
+static bool setattr_takes_idmap(void);
+static void *consume_bpf_events(void *arg);
+static int handle_bpf_event(void *ctx, void *data, size_t len);
+static void report_bpf_event(const struct argusbpf_subject *subject, const struct argusbpf_path *path,
+    const struct argusbpf_event *event);
+static uint64_t find_cgroup_id(int pid);
+static int find_fs_path(int pid, const char *path, char *fspath, size_t len);
+static int register_bpf_path(uint64_t cgroup, const char *fspath);
+static void sync_bpf_maps(void);
+
+#endif
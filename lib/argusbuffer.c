@@ -0,0 +1,186 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argusbuffer.h"
+#include "argusutil.h"
+
+static struct arguswatch_buffer *pool_ = NULL;
+static int poolc_ = 0;
+static pthread_mutex_t poolmux_ = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Take a read buffer from the pool, or allocate a new one if the pool is
+ * empty. The caller owns the single reference on the returned buffer.
+ *
+ * @return
+ */
+struct arguswatch_buffer *acquire_buffer() {
+    struct arguswatch_buffer *buf;
+
+    pthread_mutex_lock(&poolmux_);
+    if ((buf = pool_) != NULL) {
+        pool_ = buf->next;
+        --poolc_;
+    }
+    pthread_mutex_unlock(&poolmux_);
+
+    if (buf == NULL) {
+        if ((buf = malloc(sizeof(struct arguswatch_buffer))) == NULL) {
+#if DEBUG
+            perror("malloc");
+#endif
+            return NULL;
+        }
+        if ((buf->arena = alloc_arena(IN_ARENA_SIZE)) == NULL) {
+            free(buf);
+            return NULL;
+        }
+    }
+
+    buf->next = NULL;
+    buf->arena->len = 0;
+    buf->lastpath = NULL;
+    buf->refcnt = 1;
+    buf->len = 0;
+    return buf;
+}
+
+/**
+ * Take an additional reference on `buf`. Consumers that keep an event (and
+ * the names it points at) past the log function call must hold a reference
+ * until they are done with it.
+ *
+ * @param buf
+ */
+void ref_buffer(struct arguswatch_buffer *const buf) {
+    __atomic_add_fetch(&buf->refcnt, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Drop a reference on `buf`, returning it to the pool once the last
+ * reference is gone.
+ *
+ * @param buf
+ */
+void unref_buffer(struct arguswatch_buffer *const buf) {
+    if (buf == NULL ||
+        __atomic_sub_fetch(&buf->refcnt, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    release_buffer(buf);
+}
+
+/**
+ * Copy `path` into the arena of `buf` so it stays valid for as long as the
+ * buffer, even if the cache entry it came from is rewritten or freed.
+ * Consecutive events on the same directory share one copy.
+ *
+ * @param buf
+ * @param path
+ * @return
+ */
+const char *copy_path_to_buffer(struct arguswatch_buffer *const buf, const char *const path) {
+    struct arguswatch_arena *arena = buf->arena;
+    size_t len;
+    char *p;
+
+    if (buf->lastpath != NULL &&
+        strcmp(buf->lastpath, path) == 0) {
+        return buf->lastpath;
+    }
+
+    len = strlen(path) + 1;
+    if (arena->len + len > arena->size) {
+        // Out of arena space; chain an overflow arena in front that is freed
+        // when the buffer goes back to the pool.
+        if ((arena = alloc_arena(len > IN_ARENA_SIZE ? len : IN_ARENA_SIZE)) == NULL) {
+            return path;
+        }
+        arena->next = buf->arena;
+        buf->arena = arena;
+    }
+
+    p = &arena->data[arena->len];
+    memcpy(p, path, len);
+    arena->len += len;
+    buf->lastpath = p;
+    return p;
+}
+
+/**
+ * Allocate an arena with room for `size` bytes of path names.
+ *
+ * @param size
+ * @return
+ */
+static struct arguswatch_arena *alloc_arena(const size_t size) {
+    struct arguswatch_arena *arena;
+    if ((arena = malloc(sizeof(struct arguswatch_arena) + size)) == NULL) {
+#if DEBUG
+        perror("malloc");
+#endif
+        return NULL;
+    }
+    arena->next = NULL;
+    arena->len = 0;
+    arena->size = size;
+    return arena;
+}
+
+/**
+ * Free any overflow arenas of `buf` and put it back on the pool, or free it
+ * outright if the pool is already full.
+ *
+ * @param buf
+ */
+static void release_buffer(struct arguswatch_buffer *const buf) {
+    struct arguswatch_arena *arena;
+
+    // Keep only the original arena, which is last in the chain.
+    while (buf->arena->next != NULL) {
+        arena = buf->arena;
+        buf->arena = arena->next;
+        free(arena);
+    }
+
+    pthread_mutex_lock(&poolmux_);
+    if (poolc_ < BUFFER_POOL_MAX) {
+        buf->next = pool_;
+        pool_ = buf;
+        ++poolc_;
+        pthread_mutex_unlock(&poolmux_);
+        return;
+    }
+    pthread_mutex_unlock(&poolmux_);
+
+    free(buf->arena);
+    free(buf);
+}
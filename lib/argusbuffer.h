@@ -0,0 +1,69 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_BUFFER__
+#define __ARGUS_BUFFER__
+
+#include <limits.h>
+#include <stddef.h>
+#include <sys/inotify.h>
+
+#include "argusutil.h"
+
+#ifndef IN_READ_BUFFER_SIZE
+#define IN_READ_BUFFER_SIZE (64 * IN_BUFFER_SIZE)
+#endif
+#ifndef IN_ARENA_SIZE
+#define IN_ARENA_SIZE (4 * PATH_MAX)
+#endif
+#ifndef BUFFER_POOL_MAX
+#define BUFFER_POOL_MAX 32
+#endif
+
+struct arguswatch_arena {
+    struct arguswatch_arena *next;    // Overflow arenas, freed with the buffer.
+    size_t len, size;                 // Bytes used, bytes available in `data`.
+    char data[];
+};
+
+struct arguswatch_buffer {
+    struct arguswatch_buffer *next;   // Free list link while pooled.
+    struct arguswatch_arena *arena;   // Arena chain for path names copied out of the cache.
+    const char *lastpath;             // Last path name copied into the arena, for reuse.
+    int refcnt;                       // Outstanding references; returned to the pool at zero.
+    unsigned int gen;                 // Generation of the watch's `inotify` fd the events were read from.
+    ssize_t len;                      // Bytes of `inotify` events held in `data`.
+    // The buffer used for reading from the `inotify` file descriptor should
+    // have the same alignment as struct inotify_event.
+    char data[IN_READ_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+};
+
+struct arguswatch_buffer *acquire_buffer();
+void ref_buffer(struct arguswatch_buffer *buf);
+void unref_buffer(struct arguswatch_buffer *buf);
+const char *copy_path_to_buffer(struct arguswatch_buffer *buf, const char *path);
+static struct arguswatch_arena *alloc_arena(size_t size);
+static void release_buffer(struct arguswatch_buffer *buf);
+
+#endif
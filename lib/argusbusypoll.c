@@ -0,0 +1,335 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "argusbusypoll.h"
+#include "arguschurn.h"
+#include "argusnotify.h"
+#include "argusutil.h"
+
+static struct argusbusypoll_entry **entries_;
+static int entryc_, entrymax_;
+static int efd_ = EOF, wakefd_ = EOF; // The poller's `epoll` set, and an `eventfd` to wake it for new entries.
+static long maxspin_;
+static pthread_mutex_t busypoll_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t busypoll_cond_ = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Start the busy-poll thread. Once started, watchers hand their `inotify` fd
+ * to this one thread instead of waiting on it in `epoll_pwait`: it spins on
+ * non-blocking reads of every watcher's fd for as long as events keep coming,
+ * and only parks in `epoll_wait` after `maxspinusec` without any. How long
+ * it spins before parking adapts between `BUSYPOLL_MIN_SPIN_NSEC` and that
+ * bound: it doubles whenever an event arrives soon after parking, and halves
+ * when the poller stays parked longer than the bound. Call before starting
+ * watchers.
+ *
+ * @param cpu CPU to pin the thread to; -1 to leave it unpinned.
+ * @param maxspinusec
+ * @return 0 on success, -1 on error.
+ */
+int start_busy_poller(const int cpu, const long maxspinusec) {
+    pthread_t thread;
+    cpu_set_t cpus;
+    struct epoll_event evt = { .events = EPOLLIN };
+
+    if ((efd_ = epoll_create1(EPOLL_CLOEXEC)) == EOF) {
+#if DEBUG
+        perror("epoll_create1");
+#endif
+        return -1;
+    }
+    if ((wakefd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == EOF) {
+#if DEBUG
+        perror("eventfd");
+#endif
+        goto err;
+    }
+    evt.data.ptr = NULL;
+    if (epoll_ctl(efd_, EPOLL_CTL_ADD, wakefd_, &evt) == EOF) {
+#if DEBUG
+        perror("epoll_ctl");
+#endif
+        goto err;
+    }
+    maxspin_ = maxspinusec * 1000 > BUSYPOLL_MIN_SPIN_NSEC ? maxspinusec * 1000 : BUSYPOLL_MIN_SPIN_NSEC;
+
+    if (pthread_create(&thread, NULL, busy_poll_loop, NULL) != 0) {
+#if DEBUG
+        perror("pthread_create");
+#endif
+        goto err;
+    }
+    pthread_setname_np(thread, "argus-busypoll");
+    if (cpu > -1) {
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        if (pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpus) != 0) {
+#if DEBUG
+            perror("pthread_setaffinity_np");
+#endif
+        }
+    }
+    pthread_detach(thread);
+    return 0;
+
+err:
+    if (wakefd_ != EOF) {
+        close(wakefd_);
+        wakefd_ = EOF;
+    }
+    close(efd_);
+    efd_ = EOF;
+    return -1;
+}
+
+bool busy_poll_enabled(void) {
+    return efd_ != EOF;
+}
+
+/**
+ * Run the event loop of `watch` on the busy-poll thread, returning once the
+ * watcher receives its kill signal. The watcher's own `epoll` set is not
+ * waited on meanwhile.
+ *
+ * @param watch
+ * @param logfn
+ * @return false if the watch could not be added; the caller then runs its own
+ *         event loop.
+ */
+bool busy_poll_watch(struct arguswatch **watch, arguswatch_logfn logfn) {
+    struct argusbusypoll_entry entry = {
+        .watch = *watch,
+        .logfn = logfn,
+        .fd = EOF,
+        .processevtfd = EOF,
+        .churn_timeout = -1,
+        .done = false
+    };
+    uint64_t value = 1;
+
+    pthread_mutex_lock(&busypoll_mutex_);
+    if (entryc_ == entrymax_) {
+        struct argusbusypoll_entry **grown;
+        if ((grown = realloc(entries_, (entrymax_ + BUSYPOLL_ENTRIES_INC) * sizeof(*entries_))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            pthread_mutex_unlock(&busypoll_mutex_);
+            return false;
+        }
+        entries_ = grown;
+        entrymax_ += BUSYPOLL_ENTRIES_INC;
+    }
+    register_entry_fds(&entry);
+    entries_[entryc_++] = &entry;
+    // Wake the poller if it is parked, so it checks the new entry at once.
+    if (write(wakefd_, &value, sizeof(value)) == EOF) {
+#if DEBUG
+        perror("write");
+#endif
+    }
+    while (!entry.done) {
+        pthread_cond_wait(&busypoll_cond_, &busypoll_mutex_);
+    }
+    pthread_mutex_unlock(&busypoll_mutex_);
+    return true;
+}
+
+static void *busy_poll_loop(void *arg) {
+    struct epoll_event evts[BUSYPOLL_MAX_EVENTS];
+    long now, lastevent, lasttick = 0, parked, spin = BUSYPOLL_MIN_SPIN_NSEC;
+    int i, nfds, timeout;
+    bool busy, tick, woken = false, ready;
+    uint64_t value;
+    sigset_t sigmask;
+
+    // Like the watcher threads, leave SIGCHLD to the rest of the process.
+    sigemptyset(&sigmask);
+    sigaddset(&sigmask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &sigmask, NULL);
+
+    lastevent = now_nsec();
+    for (;;) {
+        now = now_nsec();
+        tick = woken || now - lasttick >= BUSYPOLL_TICK_NSEC;
+        busy = false;
+
+        pthread_mutex_lock(&busypoll_mutex_);
+        for (i = 0; i < entryc_; ) {
+            struct argusbusypoll_entry *entry = entries_[i];
+            if (tick &&
+                entry_killed(entry)) {
+                // Hand the watch back to its thread for teardown.
+                entries_[i] = entries_[--entryc_];
+                entry->done = true;
+                pthread_cond_broadcast(&busypoll_cond_);
+                continue;
+            }
+            busy |= poll_entry(entry);
+            if (tick &&
+                (entry->watch->flags & AW_RECURSIVE)) {
+                entry->churn_timeout = check_churn(&entry->watch, entry->logfn);
+            }
+            ++i;
+        }
+        timeout = -1;
+        for (i = 0; i < entryc_; ++i) {
+            if (entries_[i]->churn_timeout > -1 &&
+                (timeout == -1 || entries_[i]->churn_timeout < timeout)) {
+                timeout = entries_[i]->churn_timeout;
+            }
+        }
+        pthread_mutex_unlock(&busypoll_mutex_);
+
+        if (tick) {
+            lasttick = now;
+            woken = false;
+        }
+        if (busy) {
+            lastevent = now;
+            continue;
+        }
+        if (now - lastevent < spin) {
+            continue;
+        }
+
+        // Nothing for a whole spin; park until an fd is readable.
+        parked = now_nsec();
+        if ((nfds = epoll_wait(efd_, evts, BUSYPOLL_MAX_EVENTS, timeout)) == EOF) {
+            if (errno != EINTR) {
+#if DEBUG
+                perror("epoll_wait");
+#endif
+            }
+            nfds = 0;
+        }
+        ready = false;
+        for (i = 0; i < nfds; ++i) {
+            if (evts[i].data.ptr == NULL) {
+                if (read(wakefd_, &value, sizeof(value)) == EOF) {
+#if DEBUG
+                    perror("read");
+#endif
+                }
+            } else {
+                ready = true;
+            }
+        }
+        now = now_nsec();
+        if (ready) {
+            // Spinning longer would have caught an event that came this soon.
+            if (now - parked < maxspin_) {
+                spin = spin * 2 < maxspin_ ? spin * 2 : maxspin_;
+            } else {
+                spin = spin / 2 > BUSYPOLL_MIN_SPIN_NSEC ? spin / 2 : BUSYPOLL_MIN_SPIN_NSEC;
+            }
+        }
+        lastevent = now;
+        woken = true;
+    }
+    return NULL;
+}
+
+/**
+ * Process any events waiting on the `inotify` fd of `entry`.
+ *
+ * @param entry
+ * @return true if there were events.
+ */
+static bool poll_entry(struct argusbusypoll_entry *entry) {
+    int avail = 0;
+
+    // Checking for bytes first is far cheaper than taking a buffer and
+    // reading on every spin.
+    if (entry->watch->fd == EOF ||
+        ioctl(entry->watch->fd, FIONREAD, &avail) == EOF ||
+        avail == 0) {
+        return false;
+    }
+    process_inotify_events(&entry->watch, entry->logfn);
+    // A queue overflow rebuilds the watch with a new `inotify` fd and
+    // `eventfd`.
+    register_entry_fds(entry);
+    return true;
+}
+
+/**
+ * Returns true if the watcher of `entry` was sent its kill signal.
+ *
+ * @param entry
+ * @return
+ */
+static bool entry_killed(struct argusbusypoll_entry *entry) {
+    uint64_t value;
+    return read(entry->watch->processevtfd, &value, sizeof(value)) != EOF &&
+        ARGUSNOTIFY_KILLED(value);
+}
+
+/**
+ * Add the current fds of `entry` to the poller's `epoll` set. Edge-triggered:
+ * the poller only needs waking, and reads everything once awake. Replaced
+ * fds are not removed; the kernel drops them from the set when they close.
+ *
+ * @param entry
+ */
+static void register_entry_fds(struct argusbusypoll_entry *entry) {
+    struct epoll_event evt = { .events = EPOLLIN | EPOLLET, .data.ptr = entry };
+
+    if (entry->fd != entry->watch->fd) {
+        entry->fd = entry->watch->fd;
+        if (epoll_ctl(efd_, EPOLL_CTL_ADD, entry->fd, &evt) == EOF) {
+#if DEBUG
+            perror("epoll_ctl");
+#endif
+        }
+    }
+    if (entry->processevtfd != entry->watch->processevtfd) {
+        entry->processevtfd = entry->watch->processevtfd;
+        if (epoll_ctl(efd_, EPOLL_CTL_ADD, entry->processevtfd, &evt) == EOF) {
+#if DEBUG
+            perror("epoll_ctl");
+#endif
+        }
+    }
+}
+
+static long now_nsec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
@@ -0,0 +1,55 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUS_BUSYPOLL__
+#define __ARGUS_BUSYPOLL__
+
+#include <stdbool.h>
+
+#include "argusutil.h"
+
+#define BUSYPOLL_MIN_SPIN_NSEC 20000L   // Shortest the poller spins before parking.
+#define BUSYPOLL_TICK_NSEC     1000000L // Kill and churn checks while spinning.
+#define BUSYPOLL_MAX_EVENTS    64
+#define BUSYPOLL_ENTRIES_INC   16
+
+struct argusbusypoll_entry {
+    struct arguswatch *watch;
+    arguswatch_logfn logfn;
+    int fd, processevtfd;             // As last added to the poller's `epoll` set.
+    int churn_timeout;                // From the last `check_churn`; -1 for none.
+    bool done;
+};
+
+int start_busy_poller(int cpu, long maxspinusec);
+bool busy_poll_enabled(void);
+bool busy_poll_watch(struct arguswatch **watch, arguswatch_logfn logfn);
+static void *busy_poll_loop(void *arg);
+static bool poll_entry(struct argusbusypoll_entry *entry);
+static bool entry_killed(struct argusbusypoll_entry *entry);
+static void register_entry_fds(struct argusbusypoll_entry *entry);
+static long now_nsec(void);
+
+#endif
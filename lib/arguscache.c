@@ -25,18 +25,33 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
 #include <sys/stat.h>
+#include <unistd.h>
 
 #include "arguscache.h"
+#include "arguschurn.h"
+#include "argusignore.h"
+#include "argusnotify.h"
+#include "argussched.h"
+#include "argustree.h"
 #include "argusutil.h"
 
 struct arguswatch **wlcache = NULL;
 int wlcachec = 0;
 
+// Kill signals sent to subjects whose watcher was not cached yet, delivered
+// by `add_watch_to_cache`; the oldest are forgotten once full.
+static struct {
+    int pid, sid;
+} deferredkills_[DEFERRED_KILL_MAX];
+static int deferredkillc_ = 0;
+static pthread_mutex_t deferredkill_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
 /**
  * Deallocate the watch cache.
  *
@@ -54,6 +69,17 @@ void clear_watch(struct arguswatch **watch) {
         }
     }
     (*watch)->pathc = 0;
+    free((*watch)->ino);
+    (*watch)->ino = NULL;
+    rebuild_path_index(watch);
+    // Rules are reloaded by the next tree walk.
+    clear_ignore_files(watch);
+    // Watch descriptors are renumbered when the cache is rebuilt.
+    clear_churn(watch);
+    free((*watch)->retiredwd);
+    (*watch)->retiredwd = NULL;
+    (*watch)->retiredc = 0;
+    (*watch)->retirednext = 0;
     (*watch)->fd = EOF;
     (*watch)->processevtfd = EOF;
 }
@@ -82,13 +108,164 @@ int find_cached_slot(const int pid, const int sid) {
 }
 
 /**
- * Check that all path names in the cache are valid and refer to directories.
+ * Find the position in the `wlcache` given a `pid` and `sid`, like
+ * `find_cached_slot`. A watcher is only cached once it has its `eventfd`, so
+ * if the subject is not found (its watcher is still starting), a kill signal
+ * is remembered for it instead, and sent as soon as it is cached.
+ *
+ * @param pid
+ * @param sid
+ * @return
+ */
+int find_cached_slot_or_defer_kill(const int pid, const int sid) {
+    int slot;
+    pthread_mutex_lock(&deferredkill_mutex_);
+    if ((slot = find_cached_slot(pid, sid)) == -1) {
+        if (deferredkillc_ == DEFERRED_KILL_MAX) {
+            memmove(&deferredkills_[0], &deferredkills_[1], (DEFERRED_KILL_MAX - 1) * sizeof(deferredkills_[0]));
+            --deferredkillc_;
+        }
+        deferredkills_[deferredkillc_].pid = pid;
+        deferredkills_[deferredkillc_].sid = sid;
+        ++deferredkillc_;
+    }
+    pthread_mutex_unlock(&deferredkill_mutex_);
+    return slot;
+}
+
+/**
+ * Check the cache against the watches the kernel holds for the `inotify` fd,
+ * which `/proc/self/fdinfo` lists as (wd, ino) pairs: one file read instead
+ * of an `lstat` per cached path. An entry whose watch descriptor is still
+ * listed with the inode it was first seen with is consistent. Only the other
+ * entries are checked with `lstat`, and dropped if their path is gone (or is
+ * not a directory with `AW_ONLYDIR`); a path that is still there is watched
+ * again. Listed watches no entry refers to are removed. Falls back to
+ * `lstat`ing every path if fdinfo can't be read.
  *
  * @param watch
  */
 void check_cache_consistency(struct arguswatch **watch) {
+    struct arguswatch_mark *marks, key, *mark;
+    unsigned int markc, j;
+    struct stat sb;
+    int i, wd;
+    bool removed = false;
+
+    begin_background_work();
+    if (read_watch_marks(*watch, &marks, &markc) == -1) {
+        check_cache_paths(watch);
+        end_background_work();
+        return;
+    }
+
+    for (i = 0; i < (*watch)->pathc;) {
+        key.wd = (*watch)->wd[i];
+        mark = markc > 0 ? bsearch(&key, marks, markc, sizeof(struct arguswatch_mark), compare_watch_marks) : NULL;
+        if (mark != NULL) {
+            mark->seen = true;
+        }
+        if (*(*watch)->paths[i] == '\0') {
+            ++i;
+            continue;
+        }
+        if (mark != NULL &&
+            ((*watch)->ino[i] == 0 || (*watch)->ino[i] == mark->ino)) {
+            (*watch)->ino[i] = mark->ino;
+            ++i;
+            continue;
+        }
+
+        // The watch is gone, or its descriptor now names another inode.
+        if (lstat((*watch)->paths[i], &sb) == EOF ||
+            (((*watch)->flags & AW_ONLYDIR) &&
+            !S_ISDIR(sb.st_mode))) {
+#if DEBUG
+            printf("%s: [slot = %d; wd = %d] %s is stale\n", __func__,
+                i, (*watch)->wd[i], (*watch)->paths[i]);
+            fflush(stdout);
+#endif
+            if (mark != NULL) {
+                mark->seen = false;
+            }
+            remove_item_from_cache(watch, i);
+            removed = true;
+            continue;
+        }
+        if (mark != NULL &&
+            mark->ino == sb.st_ino) {
+            (*watch)->ino[i] = mark->ino;
+            ++i;
+            continue;
+        }
+
+        // The path is still there but nothing watches it: its watch was
+        // dropped, or follows a directory moved away. Watch it again.
+        if (mark != NULL) {
+            mark->seen = false;
+        }
+        wd = inotify_add_watch((*watch)->fd, (*watch)->paths[i], get_watch_mask(*watch, (*watch)->paths[i]));
+        if (wd == EOF) {
+#if DEBUG
+            fprintf(stderr, "inotify_add_watch: %s: %s\n", (*watch)->paths[i], strerror(errno));
+#endif
+            remove_item_from_cache(watch, i);
+            removed = true;
+            continue;
+        }
+#if DEBUG
+        printf("%s: [slot = %d] rewatched %s (wd %d -> %d)\n", __func__,
+            i, (*watch)->paths[i], (*watch)->wd[i], wd);
+        fflush(stdout);
+#endif
+        (*watch)->wd[i] = wd;
+        // Take the inode from fdinfo, not `st_ino`: on overlayfs they differ,
+        // and the next check compares against fdinfo. A new watch isn't
+        // listed yet, so its inode is adopted by the next check.
+        (*watch)->ino[i] = 0;
+        key.wd = wd;
+        if (markc > 0 &&
+            (mark = bsearch(&key, marks, markc, sizeof(struct arguswatch_mark), compare_watch_marks)) != NULL) {
+            mark->seen = true;
+            (*watch)->ino[i] = mark->ino;
+        }
+        ++i;
+    }
+
+    // Watches the cache lost track of would only deliver events for unknown
+    // watch descriptors.
+    for (j = 0; j < markc; ++j) {
+        if (marks[j].seen) {
+            continue;
+        }
+#if DEBUG
+        printf("%s: removing untracked wd = %d\n", __func__, marks[j].wd);
+        fflush(stdout);
+#endif
+        if (inotify_rm_watch((*watch)->fd, marks[j].wd) == 0 &&
+            !is_retired_wd(*watch, marks[j].wd)) {
+            retire_wd(watch, marks[j].wd);
+        }
+    }
+    free(marks);
+
+    // Removing items shifts every following cache slot down, so the path
+    // index is rebuilt once rather than patched per item.
+    if (removed) {
+        rebuild_path_index(watch);
+    }
+    end_background_work();
+}
+
+/**
+ * Check that all path names in the cache are valid and refer to directories.
+ *
+ * @param watch
+ */
+static void check_cache_paths(struct arguswatch **watch) {
     struct stat sb;
     int i;
+    bool removed = false;
 
     for (i = 0; i < (*watch)->pathc;) {
         if (*(*watch)->paths[i] == '\0') {
@@ -101,6 +278,7 @@ void check_cache_consistency(struct arguswatch **watch) {
             fflush(stdout);
 #endif
             remove_item_from_cache(watch, i);
+            removed = true;
             continue;
         }
 
@@ -111,12 +289,87 @@ void check_cache_consistency(struct arguswatch **watch) {
                 (*watch)->paths[i]);
 #endif
             remove_item_from_cache(watch, i);
+            removed = true;
             continue;
         }
 
 out_increaseloop:
         ++i;
     }
+
+    if (removed) {
+        rebuild_path_index(watch);
+    }
+}
+
+/**
+ * Read the watches of the watcher's `inotify` fd from
+ * `/proc/self/fdinfo/[fd]`, sorted by watch descriptor. Each is listed on a
+ * line like `inotify wd:3 ino:1a2b sdev:800001 mask:...`, in hex.
+ *
+ * @param watch
+ * @param marks
+ * @param markc
+ * @return 0 on success, -1 if fdinfo could not be read.
+ */
+static int read_watch_marks(const struct arguswatch *const watch, struct arguswatch_mark **marks,
+    unsigned int *const markc) {
+
+    char path[PATH_MAX], *line = NULL;
+    struct arguswatch_mark *list = NULL, *grown;
+    unsigned int count = 0, max = 0, wd;
+    unsigned long ino;
+    size_t len = 0;
+    FILE *fp;
+
+    if (watch->fd == EOF) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", watch->fd);
+    if ((fp = fopen(path, "re")) == NULL) {
+#if DEBUG
+        perror("fopen");
+#endif
+        return -1;
+    }
+    while (getline(&line, &len, fp) != EOF) {
+        if (sscanf(line, "inotify wd:%x ino:%lx", &wd, &ino) != 2) {
+            continue;
+        }
+        if (count == max) {
+            max = max ? max * 2 : ALLOC_INC;
+            if ((grown = realloc(list, max * sizeof(struct arguswatch_mark))) == NULL) {
+#if DEBUG
+                perror("realloc");
+#endif
+                free(list);
+                free(line);
+                fclose(fp);
+                return -1;
+            }
+            list = grown;
+        }
+        list[count++] = (struct arguswatch_mark){
+            .wd = (int)wd,
+            .ino = (ino_t)ino
+        };
+    }
+    free(line);
+    fclose(fp);
+
+    *marks = list;
+    *markc = count;
+    if (count == 0) {
+        // `list` is NULL; nothing to sort.
+        return 0;
+    }
+    qsort(list, count, sizeof(struct arguswatch_mark), compare_watch_marks);
+    return 0;
+}
+
+static int compare_watch_marks(const void *a, const void *b) {
+    int wda = ((const struct arguswatch_mark *)a)->wd, wdb = ((const struct arguswatch_mark *)b)->wd;
+    return (wda > wdb) - (wda < wdb);
 }
 
 /**
@@ -130,8 +383,10 @@ out_increaseloop:
  */
 static void remove_item_from_cache(struct arguswatch **watch, const int index) {
     int i;
+    retire_wd(watch, (*watch)->wd[index]);
     for (i = index; i < (*watch)->pathc - 1; ++i) {
         (*watch)->wd[i] = (*watch)->wd[i + 1];
+        (*watch)->ino[i] = (*watch)->ino[i + 1];
         free((*watch)->paths[i]);
         (*watch)->paths[i] = strdup((*watch)->paths[i + 1]);
     }
@@ -237,28 +492,182 @@ static int find_empty_cache_slot() {
  * @param watch
  */
 void add_watch_to_cache(struct arguswatch **watch) {
-    int slot = find_empty_cache_slot();
+    uint64_t value = ARGUSNOTIFY_KILL;
+    bool killed = false;
+    int i, slot;
+
+    pthread_mutex_lock(&deferredkill_mutex_);
+    slot = find_empty_cache_slot();
     (*watch)->slot = slot;
     // Point this `wlcache` slot to `watch`.
     wlcache[slot] = *watch;
+    // Pick up a kill signal sent while the watcher was starting.
+    for (i = 0; i < deferredkillc_; ++i) {
+        if (deferredkills_[i].pid == (*watch)->pid &&
+            deferredkills_[i].sid == (*watch)->sid) {
+            deferredkills_[i] = deferredkills_[--deferredkillc_];
+            killed = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&deferredkill_mutex_);
+
+    if (killed &&
+        write((*watch)->processevtfd, &value, sizeof(value)) == EOF) {
+#if DEBUG
+        perror("write");
+#endif
+    }
+}
+
+/**
+ * Hash a path name for the `pathidx` index (32-bit FNV-1a).
+ *
+ * @param path
+ * @return
+ */
+static uint32_t hash_path_name(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (; *path; ++path) {
+        hash ^= (unsigned char)*path;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * Double the bucket count of the path index (or allocate the initial one) and
+ * re-insert every cached path. Returns -1 if the index could not be resized.
+ *
+ * @param watch
+ * @return
+ */
+static int grow_path_index(struct arguswatch **watch) {
+    unsigned int len = (*watch)->pathidxc ? (*watch)->pathidxc * 2 : PATH_INDEX_INC;
+    int *pathidx;
+
+    if ((pathidx = realloc((*watch)->pathidx, len * sizeof(int))) == NULL) {
+#if DEBUG
+        perror("realloc");
+#endif
+        return -1;
+    }
+    (*watch)->pathidx = pathidx;
+    (*watch)->pathidxc = len;
+    rebuild_path_index(watch);
+    return 0;
+}
+
+/**
+ * Add the path stored in cache slot `index` to the path index. The index is
+ * kept at most half full so probe sequences stay short. Returns -1 if the
+ * index could not be resized.
+ *
+ * @param watch
+ * @param index
+ * @return
+ */
+int add_path_to_index(struct arguswatch **watch, const int index) {
+    uint32_t mask, i;
+
+    if ((*watch)->pathc * 2 > (*watch)->pathidxc) {
+        // Growing re-inserts every slot below `pathc`, including `index`.
+        return grow_path_index(watch);
+    }
+
+    mask = (*watch)->pathidxc - 1;
+    for (i = hash_path_name((*watch)->paths[index]) & mask;
+        (*watch)->pathidx[i] != -1;
+        i = (i + 1) & mask);
+    (*watch)->pathidx[i] = index;
+    return 0;
+}
+
+/**
+ * Remove cache slot `index` from the path index. Must be called while
+ * `paths[index]` still holds the name it was indexed under, i.e. before it is
+ * freed or rewritten. Following buckets in the probe run are shifted back so
+ * lookups never stop early on a hole.
+ *
+ * @param watch
+ * @param index
+ */
+void remove_path_from_index(struct arguswatch **watch, const int index) {
+    uint32_t mask, i, j, home;
+
+    if ((*watch)->pathidxc == 0) {
+        return;
+    }
+    mask = (*watch)->pathidxc - 1;
+    for (i = hash_path_name((*watch)->paths[index]) & mask;
+        (*watch)->pathidx[i] != index;
+        i = (i + 1) & mask) {
+        if ((*watch)->pathidx[i] == -1) {
+            // Not indexed.
+            return;
+        }
+    }
+
+    for (j = (i + 1) & mask; (*watch)->pathidx[j] != -1; j = (j + 1) & mask) {
+        home = hash_path_name((*watch)->paths[(*watch)->pathidx[j]]) & mask;
+        // Leave the entry where it is if its home bucket lies cyclically in
+        // (i, j]; otherwise it can fill the hole at `i`.
+        if ((i <= j) ? (i < home && home <= j) : (i < home || home <= j)) {
+            continue;
+        }
+        (*watch)->pathidx[i] = (*watch)->pathidx[j];
+        i = j;
+    }
+    (*watch)->pathidx[i] = -1;
+}
+
+/**
+ * Clear the path index and re-insert every cached path. Used after operations
+ * that move cache slots around, such as `remove_item_from_cache`.
+ *
+ * @param watch
+ */
+void rebuild_path_index(struct arguswatch **watch) {
+    uint32_t mask, i;
+    int j;
+
+    if ((*watch)->pathidxc == 0) {
+        return;
+    }
+    for (i = 0; i < (*watch)->pathidxc; ++i) {
+        (*watch)->pathidx[i] = -1;
+    }
+    mask = (*watch)->pathidxc - 1;
+    for (j = 0; j < (*watch)->pathc; ++j) {
+        for (i = hash_path_name((*watch)->paths[j]) & mask;
+            (*watch)->pathidx[i] != -1;
+            i = (i + 1) & mask);
+        (*watch)->pathidx[i] = j;
+    }
 }
 
 /**
  * Return the cache slot that corresponds to a particular path name or -1 if
- * the path is not in the cache.
+ * the path is not in the cache. Looked up through the `pathidx` hash index, so
+ * the cost is proportional to the length of `path` rather than the number of
+ * cached paths.
  *
  * @param watch
  * @param path
  * @return
  */
 int path_name_to_cache_slot(const struct arguswatch *const watch, const char *const path) {
-    int i;
-    if (watch->slot == -1) {
+    uint32_t mask, i;
+    if (watch->slot == -1 ||
+        watch->pathidxc == 0) {
         return -1;
     }
-    for (i = 0; i < watch->pathc; ++i) {
-        if (strcmp(watch->paths[i], path) == 0) {
-            return i;
+    mask = watch->pathidxc - 1;
+    for (i = hash_path_name(path) & mask;
+        watch->pathidx[i] != -1;
+        i = (i + 1) & mask) {
+        if (strcmp(watch->paths[watch->pathidx[i]], path) == 0) {
+            return watch->pathidx[i];
         }
     }
     return -1;
@@ -281,3 +690,67 @@ const char *wd_to_path_name(const struct arguswatch *const watch, const int wd)
     }
     return "";
 }
+
+/**
+ * Remember that watch descriptor `wd` was removed from the cache while the
+ * kernel may still have events queued for it, up to its IN_IGNORED. Those
+ * events are then skipped instead of being taken as a sign the cache is
+ * inconsistent. Only the most recent `RETIRED_WD_MAX` are remembered; the
+ * kernel hands out watch descriptors cyclically, so a retired number is not
+ * reused while its events can still be queued.
+ *
+ * @param watch
+ * @param wd
+ */
+void retire_wd(struct arguswatch **watch, const int wd) {
+    if ((*watch)->retiredwd == NULL &&
+        ((*watch)->retiredwd = calloc(RETIRED_WD_MAX, sizeof(int))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        return;
+    }
+    if ((*watch)->retiredc < RETIRED_WD_MAX) {
+        (*watch)->retiredwd[(*watch)->retiredc++] = wd;
+        return;
+    }
+    (*watch)->retiredwd[(*watch)->retirednext] = wd;
+    (*watch)->retirednext = ((*watch)->retirednext + 1) % RETIRED_WD_MAX;
+}
+
+/**
+ * Returns true if `wd` was removed from the cache by `retire_wd` and its
+ * IN_IGNORED has not been seen yet.
+ *
+ * @param watch
+ * @param wd
+ * @return
+ */
+bool is_retired_wd(const struct arguswatch *const watch, const int wd) {
+    unsigned int i;
+    for (i = 0; i < watch->retiredc; ++i) {
+        if (watch->retiredwd[i] == wd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Stop remembering `wd`, once its IN_IGNORED shows no more events will come.
+ *
+ * @param watch
+ * @param wd
+ */
+void forget_retired_wd(struct arguswatch **watch, const int wd) {
+    unsigned int i;
+    for (i = 0; i < (*watch)->retiredc; ++i) {
+        if ((*watch)->retiredwd[i] == wd) {
+            (*watch)->retiredwd[i] = (*watch)->retiredwd[--(*watch)->retiredc];
+            if ((*watch)->retirednext > (*watch)->retiredc) {
+                (*watch)->retirednext = 0;
+            }
+            return;
+        }
+    }
+}
@@ -32,17 +32,45 @@
 #ifndef ALLOC_INC
 #define ALLOC_INC 32
 #endif
+#ifndef PATH_INDEX_INC
+#define PATH_INDEX_INC 64
+#endif
+#ifndef RETIRED_WD_MAX
+#define RETIRED_WD_MAX 256
+#endif
+#ifndef DEFERRED_KILL_MAX
+#define DEFERRED_KILL_MAX 64
+#endif
+
+// A watch as listed in `/proc/self/fdinfo` of an `inotify` fd.
+struct arguswatch_mark {
+    int wd;
+    ino_t ino;
+    bool seen;                        // Matched by a cache entry.
+};
 
 void clear_watch(struct arguswatch **watch);
 int find_cached_slot(int pid, int sid);
+int find_cached_slot_or_defer_kill(int pid, int sid);
 void check_cache_consistency(struct arguswatch **watch);
+static void check_cache_paths(struct arguswatch **watch);
+static int read_watch_marks(const struct arguswatch *watch, struct arguswatch_mark **marks, unsigned int *markc);
+static int compare_watch_marks(const void *a, const void *b);
 static void remove_item_from_cache(struct arguswatch **watch, int index);
 int find_watch(const struct arguswatch *watch, int wd);
 int find_watch_checked(const struct arguswatch *watch, int wd);
 void mark_cache_slot_empty(int slot);
 static int find_empty_cache_slot();
 void add_watch_to_cache(struct arguswatch **watch);
+static uint32_t hash_path_name(const char *path);
+static int grow_path_index(struct arguswatch **watch);
+int add_path_to_index(struct arguswatch **watch, int index);
+void remove_path_from_index(struct arguswatch **watch, int index);
+void rebuild_path_index(struct arguswatch **watch);
 int path_name_to_cache_slot(const struct arguswatch *watch, const char *path);
 const char *wd_to_path_name(const struct arguswatch *watch, int wd);
+void retire_wd(struct arguswatch **watch, int wd);
+bool is_retired_wd(const struct arguswatch *watch, int wd);
+void forget_retired_wd(struct arguswatch **watch, int wd);
 
 #endif
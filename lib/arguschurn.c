@@ -0,0 +1,322 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#include "arguschurn.h"
+#include "arguscache.h"
+#include "argustree.h"
+#include "argusutil.h"
+
+/**
+ * Count a create/delete inside the directory watched by `event->wd` and, if
+ * the directory exceeds `CHURN_THRESHOLD` events in a `CHURN_WINDOW`, demote
+ * it: watches below it are removed and events inside it are only counted.
+ * Returns true if the event belongs to a demoted directory, in which case the
+ * caller should neither log it nor walk any new subdirectory.
+ *
+ * @param watch
+ * @param event
+ * @param path
+ * @param logfn
+ * @return
+ */
+bool track_churn(struct arguswatch **watch, const struct inotify_event *const event, const char *const path,
+    arguswatch_logfn logfn) {
+
+    struct arguschurn *churn, *churns;
+    time_t now;
+
+    // Events about the directory itself (no name) are always processed.
+    if (!event->len) {
+        return false;
+    }
+
+    churn = find_churn(*watch, event->wd);
+    if (churn != NULL &&
+        churn->demoted) {
+        ++churn->suppressed;
+        if (event->mask & (IN_CREATE | IN_DELETE)) {
+            roll_churn_window(churn, churn_clock());
+            ++churn->count;
+        }
+        return true;
+    }
+    if (!(event->mask & (IN_CREATE | IN_DELETE))) {
+        return false;
+    }
+
+    now = churn_clock();
+    if (churn == NULL) {
+        if ((churns = realloc((*watch)->churn, ((*watch)->churnc + 1) * sizeof(struct arguschurn))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            return false;
+        }
+        (*watch)->churn = churns;
+        churn = &(*watch)->churn[(*watch)->churnc++];
+        *churn = (struct arguschurn){
+            .wd = event->wd,
+            .window = now
+        };
+    }
+
+    roll_churn_window(churn, now);
+    if (++churn->count >= CHURN_THRESHOLD) {
+        demote_path(watch, churn, path, logfn);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Close out elapsed churn windows: forget directories that stayed under the
+ * threshold and re-promote demoted directories that have been quiet for
+ * `CHURN_QUIET_WINDOWS`, re-walking the tree to restore their watches.
+ * Returns the `epoll` timeout (ms) the caller should use so this keeps being
+ * called while any directory is demoted, or -1.
+ *
+ * @param watch
+ * @param logfn
+ * @return
+ */
+int check_churn(struct arguswatch **watch, arguswatch_logfn logfn) {
+    struct arguschurn *churn;
+    const char *path;
+    time_t now = churn_clock();
+    bool promoted = false;
+    int i;
+
+    for (i = 0; i < (*watch)->churnc;) {
+        churn = &(*watch)->churn[i];
+        if (churn->demoted) {
+            // Follow renames of the demoted directory.
+            path = wd_to_path_name(*watch, churn->wd);
+            if (*path &&
+                strcmp(path, churn->path) != 0) {
+                free(churn->path);
+                churn->path = strdup(path);
+            }
+        }
+        if (!roll_churn_window(churn, now)) {
+            ++i;
+            continue;
+        }
+        if (!churn->demoted) {
+            remove_churn(watch, i);
+            continue;
+        }
+        if (churn->quiet < CHURN_QUIET_WINDOWS) {
+            ++i;
+            continue;
+        }
+
+#if DEBUG
+        printf("%s: promoting %s (%u events suppressed)\n", __func__, churn->path, churn->suppressed);
+        fflush(stdout);
+#endif
+        struct arguswatch_event awevent = {
+            .watch = *watch,
+            .event_mask = AW_PROMOTE | IN_ISDIR,
+            .path_name = churn->path,
+            .file_name = "",
+            .count = churn->suppressed,
+            .is_dir = true
+        };
+        (*logfn)(&awevent);
+
+        remove_churn(watch, i);
+        promoted = true;
+    }
+
+    if (promoted) {
+        // Directories are no longer demoted, so walking the tree adds their
+        // subdirectories back.
+        rewatch_tree(watch);
+    }
+    return (*watch)->demotedc ? CHURN_WINDOW * 1000 : -1;
+}
+
+/**
+ * Whether `path` lies below a demoted directory. Used by the tree walk to
+ * skip subtrees whose watches were removed.
+ *
+ * @param watch
+ * @param path
+ * @return
+ */
+bool is_demoted_path(const struct arguswatch *const watch, const char *const path) {
+    size_t len;
+    int i;
+    for (i = 0; i < watch->churnc; ++i) {
+        if (!watch->churn[i].demoted) {
+            continue;
+        }
+        len = strlen(watch->churn[i].path);
+        if (strncmp(path, watch->churn[i].path, len) == 0 &&
+            path[len] == '/') {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Drop churn tracking for a watch descriptor that no longer exists.
+ *
+ * @param watch
+ * @param wd
+ */
+void forget_churn(struct arguswatch **watch, const int wd) {
+    int i;
+    for (i = 0; i < (*watch)->churnc; ++i) {
+        if ((*watch)->churn[i].wd == wd) {
+            remove_churn(watch, i);
+            return;
+        }
+    }
+}
+
+/**
+ * Drop all churn tracking, e.g. when the cache is rebuilt and watch
+ * descriptors are renumbered.
+ *
+ * @param watch
+ */
+void clear_churn(struct arguswatch **watch) {
+    int i;
+    for (i = 0; i < (*watch)->churnc; ++i) {
+        free((*watch)->churn[i].path);
+    }
+    free((*watch)->churn);
+    (*watch)->churn = NULL;
+    (*watch)->churnc = 0;
+    (*watch)->demotedc = 0;
+}
+
+/**
+ * Find churn tracking for watch descriptor `wd`, or NULL.
+ *
+ * @param watch
+ * @param wd
+ * @return
+ */
+static struct arguschurn *find_churn(const struct arguswatch *const watch, const int wd) {
+    int i;
+    for (i = 0; i < watch->churnc; ++i) {
+        if (watch->churn[i].wd == wd) {
+            return &watch->churn[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start a new window if the current one has elapsed. For demoted
+ * directories, every elapsed window under `CHURN_QUIET_THRESHOLD` counts
+ * towards re-promotion. Returns whether a window was closed.
+ *
+ * @param churn
+ * @param now
+ * @return
+ */
+static bool roll_churn_window(struct arguschurn *const churn, const time_t now) {
+    time_t windows = (now - churn->window) / CHURN_WINDOW;
+    if (windows == 0) {
+        return false;
+    }
+    if (churn->demoted) {
+        // Windows after the first passed without any events at all.
+        churn->quiet = (churn->count < CHURN_QUIET_THRESHOLD) ? churn->quiet + windows : windows - 1;
+    }
+    churn->count = 0;
+    churn->window = now;
+    return true;
+}
+
+/**
+ * Demote directory `path`: remove the watches below it, keeping the watch on
+ * the directory itself, and report the demotion through `logfn`.
+ *
+ * @param watch
+ * @param churn
+ * @param path
+ * @param logfn
+ */
+static void demote_path(struct arguswatch **watch, struct arguschurn *const churn, const char *const path,
+    arguswatch_logfn logfn) {
+
+    churn->demoted = true;
+    churn->quiet = 0;
+    churn->suppressed = 0;
+    churn->path = strdup(path);
+    ++(*watch)->demotedc;
+
+#if DEBUG
+    printf("%s: %s (%u events in %ds)\n", __func__, churn->path, churn->count, CHURN_WINDOW);
+    fflush(stdout);
+#endif
+    remove_child_watches(watch, churn->path);
+
+    struct arguswatch_event awevent = {
+        .watch = *watch,
+        .event_mask = AW_DEMOTE | IN_ISDIR,
+        .path_name = churn->path,
+        .file_name = "",
+        .count = churn->count,
+        .is_dir = true
+    };
+    (*logfn)(&awevent);
+}
+
+/**
+ * Remove churn tracking at `index`; the last entry takes its place.
+ *
+ * @param watch
+ * @param index
+ */
+static void remove_churn(struct arguswatch **watch, const int index) {
+    if ((*watch)->churn[index].demoted) {
+        --(*watch)->demotedc;
+    }
+    free((*watch)->churn[index].path);
+    (*watch)->churn[index] = (*watch)->churn[--(*watch)->churnc];
+}
+
+/**
+ * Monotonic clock in seconds for churn windows.
+ *
+ * @return
+ */
+static time_t churn_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
@@ -0,0 +1,70 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_CHURN__
+#define __ARGUS_CHURN__
+
+#include <stdbool.h>
+#include <sys/inotify.h>
+#include <time.h>
+
+#include "argusutil.h"
+
+#ifndef CHURN_WINDOW
+#define CHURN_WINDOW 10
+#endif
+#ifndef CHURN_THRESHOLD
+#define CHURN_THRESHOLD 2000
+#endif
+#ifndef CHURN_QUIET_THRESHOLD
+#define CHURN_QUIET_THRESHOLD (CHURN_THRESHOLD / 20)
+#endif
+#ifndef CHURN_QUIET_WINDOWS
+#define CHURN_QUIET_WINDOWS 6
+#endif
+
+struct arguschurn {
+    char *path;                       // Directory path while demoted (refreshed from the cache).
+    time_t window;                    // Start of the current measurement window.
+    unsigned int count;               // Create/delete events in the current window.
+    unsigned int quiet;               // Consecutive quiet windows while demoted.
+    unsigned int suppressed;          // Events counted but not logged while demoted.
+    int wd;                           // Watch descriptor of the directory.
+    bool demoted;
+};
+
+bool track_churn(struct arguswatch **watch, const struct inotify_event *event, const char *path,
+    arguswatch_logfn logfn);
+int check_churn(struct arguswatch **watch, arguswatch_logfn logfn);
+bool is_demoted_path(const struct arguswatch *watch, const char *path);
+void forget_churn(struct arguswatch **watch, int wd);
+void clear_churn(struct arguswatch **watch);
+static struct arguschurn *find_churn(const struct arguswatch *watch, int wd);
+static bool roll_churn_window(struct arguschurn *churn, time_t now);
+static void demote_path(struct arguswatch **watch, struct arguschurn *churn, const char *path,
+    arguswatch_logfn logfn);
+static void remove_churn(struct arguswatch **watch, int index);
+static time_t churn_clock();
+
+#endif
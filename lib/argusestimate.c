@@ -0,0 +1,344 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "argusestimate.h"
+#include "argusignore.h"
+#include "argussched.h"
+
+/**
+ * Estimate what watching `paths` with these subject options would cost,
+ * without watching them. Directories are walked breadth-first, with the same
+ * ignore, depth, `onlydir` and `.argusignore` rules as `traverse_tree`, until
+ * `budget` directories have been read. If the tree is larger, its size is
+ * projected from random root-to-leaf probes (Knuth's estimator). The first
+ * directories are also watched on a scratch `inotify` instance to time
+ * `inotify_add_watch` and to count events for `samplemsec`.
+ *
+ * @param pathc
+ * @param paths
+ * @param ignorec
+ * @param ignores
+ * @param mask
+ * @param flags
+ * @param maxdepth
+ * @param budget     Directories to read before sampling instead.
+ * @param samplemsec Event sample window; 0 to skip.
+ * @param estimate
+ * @return 0 on success, -1 on error.
+ */
+int estimate_watch(const unsigned int pathc, const char *paths[], const unsigned int ignorec, const char *ignores[],
+    const uint32_t mask, const uint32_t flags, const int maxdepth, const unsigned int budget,
+    const unsigned int samplemsec, struct argusestimate *estimate) {
+
+    struct arguswatch scratch = {
+        .rootpaths = (char **)paths,
+        .ignores = (char **)ignores,
+        .rootpathc = pathc,
+        .ignorec = ignorec,
+        .event_mask = mask,
+        .flags = flags,
+        .max_depth = maxdepth,
+        .fd = EOF
+    };
+    struct arguswatch *watch = &scratch;
+    struct argusestimate_dir *queue = NULL;
+    char **children;
+    unsigned int head = 0, queuec = 0, queuecap = 0, rootc = 0, i;
+    unsigned int seed = (unsigned int)time(NULL);
+    unsigned long walknsec = 0, addnsec = 0, rootfiles = 0;
+    struct timespec start;
+    int childc, c, rc = 0;
+
+    memset(estimate, 0, sizeof(struct argusestimate));
+    estimate->exact = true;
+    if ((watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == EOF) {
+#if DEBUG
+        perror("inotify_init1");
+#endif
+        return -1;
+    }
+    begin_background_work();
+
+    for (i = 0; i < pathc; ++i) {
+        struct stat sb;
+        if (lstat(paths[i], &sb) == EOF ||
+            (!S_ISDIR(sb.st_mode) && (flags & AW_ONLYDIR))) {
+            continue;
+        }
+        ++estimate->watches;
+        if (!S_ISDIR(sb.st_mode) ||
+            !(flags & AW_RECURSIVE)) {
+            ++rootfiles;
+            continue;
+        }
+        if (queuec == queuecap) {
+            queuecap += ESTIMATE_DIRS_INC;
+            if ((queue = realloc(queue, queuecap * sizeof(struct argusestimate_dir))) == NULL) {
+#if DEBUG
+                perror("realloc");
+#endif
+                rc = -1;
+                goto out;
+            }
+        }
+        queue[queuec].path = strdup(paths[i]);
+        queue[queuec++].level = 0;
+        ++rootc;
+    }
+
+    // Walk breadth-first so a walk cut short has seen the top of every tree.
+    for (; head < queuec; ++head) {
+        if (estimate->visited == budget) {
+            estimate->exact = false;
+            break;
+        }
+        if (estimate->sampled_watches < ESTIMATE_TIMED_WATCHES) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            if (inotify_add_watch(watch->fd, queue[head].path, mask | IN_ONLYDIR) != EOF) {
+                ++estimate->sampled_watches;
+                addnsec += elapsed_nsec(&start);
+            }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        childc = list_child_dirs(&watch, queue[head].path, queue[head].level, &children);
+        walknsec += elapsed_nsec(&start);
+        ++estimate->visited;
+        if (childc <= 0) {
+            continue;
+        }
+        estimate->watches += childc;
+        if (queuec + childc > queuecap) {
+            queuecap = queuec + childc + ESTIMATE_DIRS_INC;
+            if ((queue = realloc(queue, queuecap * sizeof(struct argusestimate_dir))) == NULL) {
+#if DEBUG
+                perror("realloc");
+#endif
+                free_dirs(children, childc);
+                queuec = 0;
+                rc = -1;
+                goto out;
+            }
+        }
+        for (c = 0; c < childc; ++c) {
+            queue[queuec].path = children[c];
+            queue[queuec++].level = queue[head].level + 1;
+        }
+        free(children);
+    }
+
+    if (!estimate->exact) {
+        // Average the probes of each root's tree; the walk so far is a lower
+        // bound.
+        double projected = rootfiles;
+        for (i = 0; i < rootc; ++i) {
+            double sum = 0;
+            for (c = 0; c < ESTIMATE_PROBES; ++c) {
+                sum += probe_tree(&watch, queue[i].path, queue[i].level, &seed);
+            }
+            projected += sum / ESTIMATE_PROBES;
+        }
+        if (projected > estimate->watches) {
+            estimate->watches = (unsigned long)projected;
+        }
+    }
+
+    estimate->kernel_bytes = estimate->watches * ESTIMATE_WATCH_BYTES;
+    if (estimate->visited > 0) {
+        estimate->traversal_usec = estimate->watches * (walknsec / estimate->visited +
+            (estimate->sampled_watches > 0 ? addnsec / estimate->sampled_watches : 0)) / 1000;
+    }
+    end_background_work();
+
+    // Count events on the directories watched above.
+    if (samplemsec > 0 &&
+        estimate->sampled_watches > 0) {
+        struct pollfd pfd = { .fd = watch->fd, .events = POLLIN };
+        char buf[IN_BUFFER_SIZE * 16] __attribute__((aligned(__alignof__(struct inotify_event))));
+        struct inotify_event *event;
+        ssize_t len;
+        long remaining = samplemsec;
+
+        estimate->sample_msec = samplemsec;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (remaining > 0) {
+            if (poll(&pfd, 1, remaining) > 0) {
+                while ((len = read(watch->fd, buf, sizeof(buf))) > 0) {
+                    for (event = (struct inotify_event *)buf; IN_EVENT_OK(event, buf, len);
+                        event = IN_EVENT_NEXT(event, len, IN_EVENT_LEN + event->len)) {
+                        ++estimate->sampled_events;
+                    }
+                }
+            }
+            remaining = (long)samplemsec - (long)(elapsed_nsec(&start) / 1000000);
+        }
+    }
+    goto cleanup;
+
+out:
+    end_background_work();
+cleanup:
+    for (i = 0; i < queuec; ++i) {
+        free(queue[i].path);
+    }
+    free(queue);
+    clear_ignore_files(&watch);
+    if (close(watch->fd) == EOF) {
+#if DEBUG
+        perror("close");
+#endif
+    }
+    return rc;
+}
+
+/**
+ * List the subdirectories of `path` (at depth `level` below its root) that
+ * would be watched, applying the rules `traverse_tree` does.
+ *
+ * @param watch
+ * @param path
+ * @param level
+ * @param children Set to an allocated array of allocated paths.
+ * @return Number of `children`, or -1 if `path` can't be read.
+ */
+static int list_child_dirs(struct arguswatch **watch, const char *const path, const int level, char ***children) {
+    char fullpath[PATH_MAX];
+    struct dirent *ent;
+    struct stat sb;
+    DIR *dir;
+    int childc = 0, cap = 0, i;
+    bool isdir;
+
+    *children = NULL;
+    // Children would be past the max depth.
+    if ((*watch)->max_depth &&
+        level + 1 >= (*watch)->max_depth) {
+        return 0;
+    }
+    if ((*watch)->flags & AW_IGNOREFILE) {
+        load_ignore_file(watch, path);
+    }
+    if ((dir = opendir(path)) == NULL) {
+        return -1;
+    }
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 ||
+            strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        FORMAT_PATH(fullpath, path, ent->d_name);
+        // Like `nftw` with `FTW_PHYS`, links to directories are not followed.
+        isdir = ent->d_type == DT_DIR ||
+            (ent->d_type == DT_UNKNOWN && lstat(fullpath, &sb) == 0 && S_ISDIR(sb.st_mode));
+        if (!isdir) {
+            continue;
+        }
+        for (i = 0; i < (*watch)->ignorec; ++i) {
+            if (strcmp(ent->d_name, (*watch)->ignores[i]) == 0) {
+                break;
+            }
+        }
+        if (i < (*watch)->ignorec ||
+            (((*watch)->flags & AW_IGNOREFILE) && match_ignore_files(*watch, fullpath, true))) {
+            continue;
+        }
+
+        if (childc == cap) {
+            cap += ESTIMATE_DIRS_INC;
+            char **grown;
+            if ((grown = realloc(*children, cap * sizeof(char *))) == NULL) {
+#if DEBUG
+                perror("realloc");
+#endif
+                break;
+            }
+            *children = grown;
+        }
+        (*children)[childc++] = strdup(fullpath);
+    }
+    closedir(dir);
+    return childc;
+}
+
+/**
+ * Follow one random path down from `root`, multiplying the number of
+ * subdirectories at each step. The sum of these products is an unbiased
+ * estimate of the number of directories in the tree.
+ *
+ * @param watch
+ * @param root
+ * @param level
+ * @param seed
+ * @return
+ */
+static double probe_tree(struct arguswatch **watch, const char *const root, int level, unsigned int *seed) {
+    char path[PATH_MAX], **children;
+    double estimate = 1, width = 1;
+    int childc, depth;
+
+    snprintf(path, sizeof(path), "%s", root);
+    for (depth = 0; depth < ESTIMATE_MAX_PROBE_DEPTH; ++depth, ++level) {
+        if ((childc = list_child_dirs(watch, path, level, &children)) <= 0) {
+            break;
+        }
+        width *= childc;
+        estimate += width;
+        snprintf(path, sizeof(path), "%s", children[rand_r(seed) % childc]);
+        free_dirs(children, childc);
+    }
+    return estimate;
+}
+
+/**
+ * @param dirs
+ * @param dirc
+ */
+static void free_dirs(char **dirs, const int dirc) {
+    int i;
+    for (i = 0; i < dirc; ++i) {
+        free(dirs[i]);
+    }
+    free(dirs);
+}
+
+/**
+ * @param start
+ * @return Nanoseconds since `start`.
+ */
+static unsigned long elapsed_nsec(const struct timespec *const start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000UL + now.tv_nsec - start->tv_nsec;
+}
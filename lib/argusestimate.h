@@ -0,0 +1,63 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUS_ESTIMATE__
+#define __ARGUS_ESTIMATE__
+
+#include <stdbool.h>
+#include <time.h>
+
+#include "argusutil.h"
+
+#define ESTIMATE_WATCH_BYTES   1080 // Kernel memory per `inotify` watch on 64-bit.
+#define ESTIMATE_PROBES        256  // Random root-to-leaf probes when the walk is cut short.
+#define ESTIMATE_MAX_PROBE_DEPTH 64
+#define ESTIMATE_TIMED_WATCHES 256  // Watches added to time `inotify_add_watch` and sample events.
+#define ESTIMATE_DIRS_INC      64
+
+struct argusestimate {
+    unsigned long watches;            // Projected watch count.
+    unsigned long visited;            // Directories read.
+    unsigned long kernel_bytes;       // Projected kernel memory of the watches.
+    unsigned long traversal_usec;     // Projected time to walk the tree and add the watches.
+    unsigned long sampled_watches;    // Watches the event sample was taken on.
+    unsigned long sampled_events;     // Events seen on them during `sample_msec`.
+    unsigned int sample_msec;
+    bool exact;                       // The whole tree was walked; `watches` is a count.
+};
+
+struct argusestimate_dir {
+    char *path;
+    int level;
+};
+
+int estimate_watch(unsigned int pathc, const char *paths[], unsigned int ignorec, const char *ignores[], uint32_t mask,
+    uint32_t flags, int maxdepth, unsigned int budget, unsigned int samplemsec, struct argusestimate *estimate);
+static int list_child_dirs(struct arguswatch **watch, const char *path, int level, char ***children);
+static double probe_tree(struct arguswatch **watch, const char *root, int level, unsigned int *seed);
+static void free_dirs(char **dirs, int dirc);
+static unsigned long elapsed_nsec(const struct timespec *start);
+
+#endif
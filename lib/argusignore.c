@@ -0,0 +1,483 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "argusignore.h"
+#include "argusutil.h"
+
+/**
+ * Load (or reload) the `.argusignore` file in directory `dir` into the watch.
+ * If the file no longer exists, any rules previously loaded for `dir` are
+ * dropped. Called for each directory as it is reached during the tree walk,
+ * so rules are compiled incrementally before the directory's children are
+ * visited.
+ *
+ * @param watch
+ * @param dir
+ */
+void load_ignore_file(struct arguswatch **watch, const char *const dir) {
+    char path[PATH_MAX], *buf;
+    struct argusignore ignore = {0}, *ignores;
+    FILE *fp;
+    size_t len;
+    int i, slot = -1;
+
+    for (i = 0; i < (*watch)->ignorefilec; ++i) {
+        if (strcmp((*watch)->ignorefiles[i].dir, dir) == 0) {
+            slot = i;
+            break;
+        }
+    }
+
+    FORMAT_PATH(path, dir, ARGUSIGNORE_FILE);
+    if ((buf = read_ignore_file(path, &len)) == NULL) {
+        if (slot > -1) {
+            // File was removed (or replaced by something we don't read);
+            // forget its rules.
+            free_ignore_rules(&(*watch)->ignorefiles[slot]);
+            (*watch)->ignorefiles[slot] = (*watch)->ignorefiles[--(*watch)->ignorefilec];
+        }
+        return;
+    }
+    // An empty file has no rules (and `fmemopen` may refuse a zero size).
+    if (len > 0) {
+        if ((fp = fmemopen(buf, len, "r")) == NULL) {
+#if DEBUG
+            perror("fmemopen");
+#endif
+            free(buf);
+            return;
+        }
+        if (parse_ignore_file(fp, &ignore) == EOF) {
+            fclose(fp);
+            free(buf);
+            free_ignore_rules(&ignore);
+            return;
+        }
+        fclose(fp);
+    }
+    free(buf);
+
+#if DEBUG
+    printf("%s: %s: %d rules\n", __func__, path, ignore.rulec);
+    fflush(stdout);
+#endif
+
+    ignore.dir = strdup(dir);
+    ignore.dirlen = strlen(dir);
+    if (slot > -1) {
+        free_ignore_rules(&(*watch)->ignorefiles[slot]);
+        (*watch)->ignorefiles[slot] = ignore;
+        return;
+    }
+
+    if ((ignores = realloc((*watch)->ignorefiles,
+        ((*watch)->ignorefilec + 1) * sizeof(struct argusignore))) == NULL) {
+#if DEBUG
+        perror("realloc");
+#endif
+        free_ignore_rules(&ignore);
+        return;
+    }
+    (*watch)->ignorefiles = ignores;
+    (*watch)->ignorefiles[(*watch)->ignorefilec++] = ignore;
+}
+
+/**
+ * Read an `.argusignore` file. It is written by the container, so only a
+ * regular file is read, not what a link points to (which would be resolved
+ * against the host's filesystem), and not a FIFO or device, which could block
+ * the watcher or never end. Files larger than `ARGUSIGNORE_MAX_SIZE` are not
+ * read at all.
+ *
+ * @param path
+ * @param len Set to the number of bytes read.
+ * @return Contents to be freed by the caller, or NULL.
+ */
+static char *read_ignore_file(const char *const path, size_t *const len) {
+    struct stat sb;
+    char *buf;
+    ssize_t n = 0;
+    int fd;
+
+    if ((fd = openat(AT_FDCWD, path, O_RDONLY | O_NOFOLLOW | O_NONBLOCK | O_CLOEXEC | O_NOCTTY)) == EOF) {
+        return NULL;
+    }
+    if (fstat(fd, &sb) == EOF ||
+        !S_ISREG(sb.st_mode) ||
+        sb.st_size > ARGUSIGNORE_MAX_SIZE) {
+#if DEBUG
+        fprintf(stderr, "not reading '%s'\n", path);
+#endif
+        close(fd);
+        return NULL;
+    }
+    // One byte over the cap tells a file that grew since `fstat`.
+    if ((buf = malloc(ARGUSIGNORE_MAX_SIZE + 1)) == NULL) {
+#if DEBUG
+        perror("malloc");
+#endif
+        close(fd);
+        return NULL;
+    }
+    *len = 0;
+    while (*len <= ARGUSIGNORE_MAX_SIZE &&
+        (n = read(fd, buf + *len, ARGUSIGNORE_MAX_SIZE + 1 - *len)) != 0) {
+        if (n == EOF) {
+            if (errno == EINTR) {
+                continue;
+            }
+#if DEBUG
+            perror("read");
+#endif
+            break;
+        }
+        *len += n;
+    }
+    close(fd);
+    if (n == EOF ||
+        *len > ARGUSIGNORE_MAX_SIZE) {
+        free(buf);
+        return NULL;
+    }
+    return buf;
+}
+
+/**
+ * Free every loaded `.argusignore` rule set on the watch.
+ *
+ * @param watch
+ */
+void clear_ignore_files(struct arguswatch **watch) {
+    int i;
+    for (i = 0; i < (*watch)->ignorefilec; ++i) {
+        free_ignore_rules(&(*watch)->ignorefiles[i]);
+    }
+    free((*watch)->ignorefiles);
+    (*watch)->ignorefiles = NULL;
+    (*watch)->ignorefilec = 0;
+}
+
+/**
+ * Check `path` against the `.argusignore` files loaded from its ancestor
+ * directories. As with gitignore, rules from a deeper file take precedence
+ * over rules from a shallower one, and within a file the last matching rule
+ * wins.
+ *
+ * @param watch
+ * @param path
+ * @param isdir
+ * @return
+ */
+bool match_ignore_files(const struct arguswatch *const watch, const char *const path, const bool isdir) {
+    const struct argusignore *ignore;
+    size_t depth = 0;
+    int i, result, ignored = 0;
+
+    for (i = 0; i < watch->ignorefilec; ++i) {
+        ignore = &watch->ignorefiles[i];
+        if (ignore->dirlen < depth ||
+            strncmp(path, ignore->dir, ignore->dirlen) != 0 ||
+            path[ignore->dirlen] != '/') {
+            continue;
+        }
+        if ((result = match_rules(ignore, path, isdir)) != EOF) {
+            depth = ignore->dirlen;
+            ignored = result;
+        }
+    }
+    return ignored;
+}
+
+/**
+ * Whether `event` is a change to an `.argusignore` file that should cause
+ * its rules to be reloaded.
+ *
+ * @param watch
+ * @param event
+ * @return
+ */
+bool is_ignore_file_event(const struct arguswatch *const watch, const struct inotify_event *const event) {
+    return (watch->flags & AW_IGNOREFILE) &&
+        event->len &&
+        !(event->mask & IN_ISDIR) &&
+        (event->mask & (IN_CLOSE_WRITE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO)) &&
+        strcmp(event->name, ARGUSIGNORE_FILE) == 0;
+}
+
+/**
+ * Parse gitignore-style lines from `fp` into `ignore`. Blank lines and lines
+ * starting with `#` are skipped; a leading `!` negates the pattern, a
+ * trailing `/` restricts it to directories, and a pattern containing a `/`
+ * is matched relative to the directory of the `.argusignore` file instead of
+ * against the basename.
+ *
+ * @param fp
+ * @param ignore
+ * @return
+ */
+static int parse_ignore_file(FILE *const fp, struct argusignore *const ignore) {
+    struct argusignore_rule rule, *rules;
+    char *line = NULL, *p;
+    size_t linelen = 0, len;
+
+    while (getline(&line, &linelen, fp) != EOF) {
+        len = strcspn(line, "\r\n");
+        // Trailing spaces are ignored unless escaped.
+        while (len && line[len - 1] == ' ' &&
+            !(len > 1 && line[len - 2] == '\\')) {
+            --len;
+        }
+        line[len] = '\0';
+        p = line;
+        if (*p == '\0' || *p == '#') {
+            continue;
+        }
+
+        rule = (struct argusignore_rule){0};
+        if (*p == '!') {
+            rule.negate = true;
+            ++p;
+        }
+        if (len > 0 && line[len - 1] == '/') {
+            rule.dironly = true;
+            line[--len] = '\0';
+        }
+        if (*p == '/') {
+            rule.anchored = true;
+            ++p;
+        }
+        if (strchr(p, '/') != NULL) {
+            rule.anchored = true;
+        }
+        if (*p == '\0') {
+            continue;
+        }
+
+        if ((rules = realloc(ignore->rules, (ignore->rulec + 1) * sizeof(struct argusignore_rule))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            free(line);
+            return EOF;
+        }
+        ignore->rules = rules;
+        rule.pattern = strdup(p);
+        ignore->rules[ignore->rulec++] = rule;
+    }
+
+    free(line);
+    return 0;
+}
+
+/**
+ * Free the rules and directory name of a single rule set.
+ *
+ * @param ignore
+ */
+static void free_ignore_rules(struct argusignore *const ignore) {
+    int i;
+    for (i = 0; i < ignore->rulec; ++i) {
+        free(ignore->rules[i].pattern);
+    }
+    free(ignore->rules);
+    free(ignore->dir);
+    ignore->rules = NULL;
+    ignore->rulec = 0;
+    ignore->dir = NULL;
+}
+
+/**
+ * Match `path`, which lies under `ignore->dir`, against its rules. Returns 1
+ * if ignored, 0 if explicitly re-included by a negated rule, or -1 if no
+ * rule matched.
+ *
+ * @param ignore
+ * @param path
+ * @param isdir
+ * @return
+ */
+static int match_rules(const struct argusignore *const ignore, const char *const path, const bool isdir) {
+    const char *relpath = path + ignore->dirlen + 1;
+    const char *basename = strrchr(relpath, '/');
+    int i, result = EOF;
+
+    basename = basename ? basename + 1 : relpath;
+    for (i = 0; i < ignore->rulec; ++i) {
+        if (ignore->rules[i].dironly && !isdir) {
+            continue;
+        }
+        if (match_glob(ignore->rules[i].pattern, ignore->rules[i].anchored ? relpath : basename)) {
+            result = ignore->rules[i].negate ? 0 : 1;
+        }
+    }
+    return result;
+}
+
+/**
+ * Match `str` against a glob `pattern`. `*` and `?` do not match `/`,
+ * `[...]` matches a character class and `\` escapes the next character. As
+ * in gitignore, `**` matches across directories only as a whole path
+ * component (`**` followed by `/`, or at the end of the pattern) and is a
+ * plain `*` elsewhere.
+ *
+ * Patterns come from the watched tree, so this runs in O(len(pattern) *
+ * len(str)) rather than backtracking recursively: only the last `*` and the
+ * last `**` are retried. An earlier `*` never needs to grow, since a later
+ * one in the same directory can absorb the same characters and `*` can't
+ * cross a `/`; likewise for `**`.
+ *
+ * @param pattern
+ * @param str
+ * @return
+ */
+static bool match_glob(const char *pattern, const char *str) {
+    const char *p = pattern, *s = str, *next;
+    const char *starp = NULL, *stars = NULL;   // Pattern after the last `*`, where its match ends.
+    const char *dstarp = NULL, *dstars = NULL; // Pattern after the last `**`, where its match ends.
+    bool dirs = false;                         // The last `**` was `**/`, matching whole directories.
+
+    for (;;) {
+        if (*p == '*') {
+            for (next = p; *next == '*'; ++next);
+            if (next - p > 1 &&
+                (p == pattern || p[-1] == '/') &&
+                (*next == '/' || *next == '\0')) {
+                // `**/` may also match zero directories.
+                dirs = *next == '/';
+                p = dstarp = dirs ? next + 1 : next;
+                dstars = s;
+                starp = NULL;
+            } else {
+                p = starp = next;
+                stars = s;
+            }
+            continue;
+        }
+        if (*p == '\0') {
+            if (*s == '\0') {
+                return true;
+            }
+            goto backtrack;
+        }
+        if (*s == '\0') {
+            goto backtrack;
+        }
+        if (*p == '?') {
+            if (*s == '/') {
+                goto backtrack;
+            }
+            ++p;
+        } else if (*p == '[') {
+            if (*s == '/' ||
+                (next = match_bracket(p, *s)) == NULL) {
+                goto backtrack;
+            }
+            p = next;
+        } else {
+            next = *p == '\\' && p[1] ? p + 1 : p;
+            if (*next != *s) {
+                goto backtrack;
+            }
+            p = next + 1;
+        }
+        ++s;
+        continue;
+
+backtrack:
+        // Let the last `*` match one more character of its directory.
+        if (starp != NULL &&
+            *stars != '\0' &&
+            *stars != '/') {
+            p = starp;
+            s = ++stars;
+            continue;
+        }
+        // Otherwise let the last `**` match one more character, or one
+        // more directory for `**/`.
+        if (dstarp != NULL &&
+            *dstars != '\0') {
+            if (!dirs) {
+                ++dstars;
+            } else if ((next = strchr(dstars, '/')) != NULL) {
+                dstars = next + 1;
+            } else {
+                return false;
+            }
+            p = dstarp;
+            s = dstars;
+            starp = NULL;
+            continue;
+        }
+        return false;
+    }
+}
+
+/**
+ * Match character `c` against the bracket expression starting at `pattern`.
+ * Returns a pointer just past the closing `]` on a match, otherwise NULL.
+ *
+ * @param pattern
+ * @param c
+ * @return
+ */
+static const char *match_bracket(const char *const pattern, const char c) {
+    const char *p = pattern + 1;
+    bool negate = false, matched = false;
+
+    if (*p == '!' || *p == '^') {
+        negate = true;
+        ++p;
+    }
+    // A `]` directly after the opening bracket is taken literally.
+    do {
+        if (*p == '\0') {
+            return NULL;
+        }
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+            if (c >= p[0] && c <= p[2]) {
+                matched = true;
+            }
+            p += 3;
+        } else {
+            if (c == *p) {
+                matched = true;
+            }
+            ++p;
+        }
+    } while (*p != ']');
+
+    return (matched != negate) ? p + 1 : NULL;
+}
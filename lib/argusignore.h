@@ -0,0 +1,64 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_IGNORE__
+#define __ARGUS_IGNORE__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <sys/inotify.h>
+
+#include "argusutil.h"
+
+#define ARGUSIGNORE_FILE ".argusignore"
+#ifndef ARGUSIGNORE_MAX_SIZE
+#define ARGUSIGNORE_MAX_SIZE (64 * 1024)
+#endif
+
+struct argusignore_rule {
+    char *pattern;                    // Glob pattern, without `!`, leading or trailing `/`.
+    bool negate;                      // Pattern started with `!`; re-includes a match.
+    bool dironly;                     // Pattern ended with `/`; only matches directories.
+    bool anchored;                    // Pattern contains a `/`; matched against the relative path.
+};
+
+struct argusignore {
+    char *dir;                        // Directory containing the `.argusignore` file.
+    size_t dirlen;
+    struct argusignore_rule *rules;   // Rules in file order; the last match wins.
+    unsigned int rulec;
+};
+
+void load_ignore_file(struct arguswatch **watch, const char *dir);
+void clear_ignore_files(struct arguswatch **watch);
+bool match_ignore_files(const struct arguswatch *watch, const char *path, bool isdir);
+bool is_ignore_file_event(const struct arguswatch *watch, const struct inotify_event *event);
+static char *read_ignore_file(const char *path, size_t *len);
+static int parse_ignore_file(FILE *fp, struct argusignore *ignore);
+static void free_ignore_rules(struct argusignore *ignore);
+static int match_rules(const struct argusignore *ignore, const char *path, bool isdir);
+static bool match_glob(const char *pattern, const char *str);
+static const char *match_bracket(const char *pattern, char c);
+
+#endif
@@ -39,7 +39,12 @@
 #include <unistd.h>
 
 #include "argusnotify.h"
+#include "argusbuffer.h"
+#include "argusbusypoll.h"
 #include "arguscache.h"
+#include "arguschurn.h"
+#include "argusignore.h"
+#include "argusreap.h"
 #include "argustree.h"
 #include "argusutil.h"
 
@@ -58,19 +63,46 @@ static void reinitialize(struct arguswatch **watch) {
     bool rebuild = (*watch)->slot > -1;
 
     if (rebuild) {
-        if ((*watch)->fd != EOF) {
-            close((*watch)->fd);
-        }
-        if ((*watch)->processevtfd != EOF) {
-            close((*watch)->processevtfd);
+        // Closing the old `inotify` fd and freeing the old cache happen on
+        // the reaper thread; stop polling the fd until then.
+        if (epoll_ctl((*watch)->efd, EPOLL_CTL_DEL, (*watch)->fd, NULL) == EOF) {
+#if DEBUG
+            perror("epoll_ctl");
+#endif
         }
+        reap_watch(watch);
+        // Keep the `eventfd` (and its registration with `epoll`) across the
+        // rebuild, so a kill signal sent meanwhile is not lost.
+        processevtfd = (*watch)->processevtfd;
         // Free watch cache.
         clear_watch(watch);
+        (*watch)->processevtfd = processevtfd;
     } else {
 #if DEBUG
         printf("initializing cache\n");
         fflush(stdout);
 #endif
+        if ((processevtfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == EOF) {
+#if DEBUG
+            perror("eventfd");
+#endif
+            return;
+        }
+#if DEBUG
+        printf("  new processevtfd = %d\n", processevtfd);
+        fflush(stdout);
+#endif
+        (*watch)->processevtfd = processevtfd;
+    }
+
+    // Cache the watch before walking the tree, which can take a while: a kill
+    // signal sent before the walk finishes (e.g. to a watcher superseded while
+    // still starting) has to find the `eventfd`; it is read once the watcher
+    // starts polling it.
+    slot = find_cached_slot((*watch)->pid, (*watch)->sid);
+    if (slot == -1) {
+        // Cache information about the watch.
+        add_watch_to_cache(watch);
     }
 
     if ((fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK)) == EOF) {
@@ -84,30 +116,22 @@ static void reinitialize(struct arguswatch **watch) {
     fflush(stdout);
 #endif
     (*watch)->fd = fd;
+    // Events still held in buffers read from the old fd name its watch
+    // descriptors, which the new fd reuses; they are dropped by generation.
+    ++(*watch)->gen;
 
     // Begin traversing tree, or non-recursive directories.
     watch_subtree(watch);
 
-    if ((processevtfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == EOF) {
-#if DEBUG
-        perror("eventfd");
-#endif
-        return;
-    }
+    if (rebuild) {
+        // `inotify` input; the `eventfd` is still registered.
+        (*watch)->epollevt[0].data.fd = (*watch)->fd;
+        (*watch)->epollevt[0].events = EPOLLIN;
+        if (epoll_ctl((*watch)->efd, EPOLL_CTL_ADD, (*watch)->fd, &(*watch)->epollevt[0]) == EOF) {
 #if DEBUG
-    printf("  new processevtfd = %d\n", processevtfd);
-    fflush(stdout);
+            perror("epoll_ctl");
 #endif
-    (*watch)->processevtfd = processevtfd;
-
-    if (rebuild) {
-        add_epoll_ctl_fds(watch);
-    }
-
-    slot = find_cached_slot((*watch)->pid, (*watch)->sid);
-    if (slot == -1) {
-        // Cache information about the watch.
-        add_watch_to_cache(watch);
+        }
     }
 
 #if DEBUG
@@ -127,16 +151,18 @@ static void reinitialize(struct arguswatch **watch) {
  * Process the next `inotify` event in the buffer specified by `event` and
  * `len`. In most cases, a single event is consumed, but if there is an * IN_MOVED_FROM+IN_MOVED_TO pair that share a cookie value, both events are
  * consumed returns the number of bytes in the event(s) consumed from `event`.
+ * Returning `len` discards all remaining events in the buffer.
  *
  * @param watch
+ * @param buf
  * @param event
  * @param len
  * @param first
  * @param logfn
  * @return
  */
-static size_t process_next_inotify_event(struct arguswatch **watch, const struct inotify_event *event,
-    const ssize_t len, const bool first, arguswatch_logfn logfn) {
+static size_t process_next_inotify_event(struct arguswatch **watch, struct arguswatch_buffer *const buf,
+    const struct inotify_event *event, const ssize_t len, const bool first, arguswatch_logfn logfn) {
 
     const char *path = NULL;
     char fullpath[PATH_MAX + NAME_MAX + 1];
@@ -145,31 +171,68 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
 
     if (event->wd != EOF) {
         slot = find_watch_checked(*watch, event->wd);
-        if (slot == -1 ||
-            // Only continue with the events we care about.
-            !(event->mask & (*watch)->event_mask)) {
+        if (slot == -1) {
+            if (event->mask & IN_IGNORED) {
+                // The watch was already removed from the cache, e.g. by
+                // `remove_child_watches`; skip just this event.
+                forget_retired_wd(watch, event->wd);
+                forget_churn(watch, event->wd);
+                return sizeof(struct inotify_event) + event->len;
+            }
+            if (is_retired_wd(*watch, event->wd)) {
+                // Queued before we removed the watch; the directory is no
+                // longer watched, so skip just this event.
+                return sizeof(struct inotify_event) + event->len;
+            }
             // Discard all remaining events in current `read` buffer.
-            return IN_BUFFER_SIZE;
+            return len;
         }
 
         path = wd_to_path_name(*watch, event->wd);
 
-        struct arguswatch_event awevent = {
-            .watch = *watch,
-            .event_mask = event->mask,
-            .path_name = path,                          // Name of the watched directory.
-            .file_name = event->len ? event->name : "", // Name of the file.
-            .is_dir = (bool)(event->mask & IN_ISDIR)
-        };
+        if (((*watch)->flags & AW_RECURSIVE) &&
+            track_churn(watch, event, path, logfn)) {
+            // Inside a directory demoted for churn: the event is only
+            // counted, and new subdirectories are not walked.
+            return sizeof(struct inotify_event) + event->len;
+        }
 
-#if DEBUG
-        printf("send event: path = %s; file: %s; event mask = %d; dir: %d\n", awevent.path_name,
-            awevent.file_name, awevent.event_mask, awevent.is_dir);
-        fflush(stdout);
+        // Only log the events we care about; the others are only watched to
+        // keep the cache consistent with the filesystem.
+        if (event->mask & (*watch)->event_mask) {
+            // Names handed to the log function live in `buf`, so consumers
+            // that take a reference on it can keep them without copying.
+            struct arguswatch_event awevent = {
+                .watch = *watch,
+                .buffer = buf,
+                .event_mask = event->mask,
+                .path_name = copy_path_to_buffer(buf, path), // Name of the watched directory.
+                .file_name = event->len ? event->name : "",  // Name of the file.
+                .is_dir = (bool)(event->mask & IN_ISDIR)
+            };
+
+#if DEBUG
+            printf("send event: path = %s; file: %s; event mask = %d; dir: %d\n", awevent.path_name,
+                awevent.file_name, awevent.event_mask, awevent.is_dir);
+            fflush(stdout);
 #endif
 
-        // Call ArgusdImpl log function passed into this watch.
-        (*logfn)(&awevent);
+            // Call ArgusdImpl log function passed into this watch.
+            (*logfn)(&awevent);
+        }
+
+        if (is_ignore_file_event(*watch, event)) {
+            // An `.argusignore` file changed. Rebuild so that watches under
+            // newly ignored directories are dropped and re-included ones are
+            // added back.
+#if DEBUG
+            printf("reloading %s/%s\n", path, event->name);
+            fflush(stdout);
+#endif
+            reinitialize(watch);
+            // Discard all remaining events in current `read` buffer.
+            return len;
+        }
 
         if (!(event->mask & IN_IGNORED)) {
             // IN_Q_OVERFLOW has (event->wd == EOF). Skip IN_IGNORED, since it
@@ -183,7 +246,7 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
                 // Cache reached an inconsistent state.
                 reinitialize(watch);
                 // Discard all remaining events in current `read` buffer.
-                return IN_BUFFER_SIZE;
+                return len;
             }
         }
     }
@@ -227,13 +290,15 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
          *      a second cache for the grandchild would leave the cache in a
          *      confused state).
          */
-        if (path_name_to_cache_slot(*watch, fullpath) == -1) {
+        if (path_name_to_cache_slot(*watch, fullpath) == -1 &&
+            // Don't walk subtrees pruned by an `.argusignore` rule.
+            !(((*watch)->flags & AW_IGNOREFILE) &&
+            match_ignore_files(*watch, fullpath, true))) {
             wdslot = find_watch(*watch, event->wd);
             if (wdslot > -1 &&
                 // Only do this if watching recursively.
                 ((*watch)->flags & AW_RECURSIVE)) {
-                (*watch)->pathc = 0;
-                watch_subtree(watch);
+                rewatch_tree(watch);
                 wlcache[(*watch)->slot] = *watch;
             }
         }
@@ -325,37 +390,49 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
          * compromise that catches the vast majority of intra-tree renames and
          * triggers relatively few cache rebuilds.
          */
-        const struct inotify_event *nextevent = event + evtlen;
+        const struct inotify_event *nextevent = IN_EVENT_NEXT(event, len, evtlen);
 
-        if ((nextevent < event + len) &&
+        if (IN_EVENT_OK(nextevent, event, len) &&
             (nextevent->mask & IN_MOVED_TO) &&
             (nextevent->cookie == event->cookie)) {
 
             // We have a `rename` event. We need to fix up the cached pathnames
             // for the corresponding directory and all of its subdirectories.
             int nextslot = find_watch_checked(*watch, nextevent->wd);
-            if (nextslot == -1) {
+            if (nextslot == -1 &&
+                is_retired_wd(*watch, nextevent->wd)) {
+                // Moved into a directory we have stopped watching, e.g. one
+                // moved out earlier in a storm of renames; that is the same as
+                // moving out of the tree.
+                FORMAT_PATH(fullpath, path, event->name);
+                if (remove_subtree(watch, fullpath) == -1) {
+                    // Cache reached an inconsistent state.
+                    reinitialize(watch);
+                    // Discard all remaining events in current `read` buffer.
+                    return len;
+                }
+            } else if (nextslot == -1) {
                 // Reinitialize the `inotify` watch.
                 (*watch)->fd = EOF;
                 // Cache reached an inconsistent state.
                 reinitialize(watch);
                 // Discard all remaining events in current `read` buffer.
-                return IN_BUFFER_SIZE;
+                return len;
+            } else {
+                rewrite_cached_paths(watch, path, event->name,
+                    wd_to_path_name(*watch, nextevent->wd), nextevent->name);
             }
 
-            rewrite_cached_paths(watch, path, event->name,
-                wd_to_path_name(*watch, nextevent->wd), nextevent->name);
-
             // Also processed the next (IN_MOVED_TO) event, so skip over it.
             evtlen += sizeof(struct inotify_event) + nextevent->len;
-        } else if ((nextevent < event + len) || !first) {
+        } else if (IN_EVENT_OK(nextevent, event, len) || !first) {
             // Got a "moved from" event without an accompanying "moved to"
             // event. The directory has been moved outside the tree we are
             // monitoring need to remove the watches and remove the cache
             // entries for the moved directory and all of its subdirectories.
 #if DEBUG
             printf("moved out: %p %p\n", (void *)path, (void *)event->name);
-            printf("first = %d; remaining bytes = %ld\n", first, event + len - nextevent);
+            printf("first = %d; remaining bytes = %ld\n", first, (char *)event + len - (char *)nextevent);
             fflush(stdout);
 #endif
             FORMAT_PATH(fullpath, path, event->name);
@@ -366,7 +443,7 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
                 // Cache reached an inconsistent state.
                 reinitialize(watch);
                 // Discard all remaining events in current `read` buffer.
-                return IN_BUFFER_SIZE;
+                return len;
             }
         } else {
 #if DEBUG
@@ -386,7 +463,7 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
             reinitialize(watch);
         }
         // Discard all remaining events in current `read` buffer.
-        evtlen = IN_EVENT_LEN;
+        evtlen = len;
     } else if (event->mask & IN_UNMOUNT) {
         // When a filesystem is unmounted, each of the watches on the is
         // dropped, and an unmount and an ignore event are generated. There's
@@ -425,7 +502,7 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
                     reinitialize(watch);
                 }
                 // Discard all remaining events in current `read` buffer.
-                return IN_BUFFER_SIZE;
+                return len;
             }
         }
     }
@@ -434,22 +511,19 @@ static size_t process_next_inotify_event(struct arguswatch **watch, const struct
 }
 
 /**
- * Read all available `inotify` events from the file descriptor `fd`.
+ * Read all available `inotify` events from the file descriptor `fd`. Events
+ * are read into a pooled, reference-counted buffer; the log function may take
+ * its own reference on it to keep using event names after this returns.
  *
  * @param watch
  * @param logfn
  * @return
  */
-static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn logfn) {
+void process_inotify_events(struct arguswatch **watch, arguswatch_logfn logfn) {
     const struct inotify_event *event;
-    // Some systems cannot read integer variables if they are not properly
-    // aligned on other systems, incorrect alignment may decrease performance
-    // hence, the buffer used for reading from the `inotify` file descriptor
-    // should have the same alignment as struct inotify_event.
-    struct inotify_event buf[IN_BUFFER_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
-    ssize_t len, readlen;
+    struct arguswatch_buffer *buf, *nextbuf;
+    ssize_t readlen;
     size_t evtlen;
-    int i;
     bool first = true;
 
     struct sigaction sa;
@@ -464,34 +538,45 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
         return;
     }
 
-    if ((len = read((*watch)->fd, (void *)&buf, IN_BUFFER_SIZE)) == EOF) {
+    if ((buf = acquire_buffer()) == NULL) {
+        return;
+    }
+    buf->gen = (*watch)->gen;
+
+    if ((buf->len = read((*watch)->fd, buf->data, sizeof(buf->data))) == EOF) {
         if (errno != EAGAIN) {
 #if DEBUG
             perror("read");
 #endif
         }
-        return;
-    } else if (len == 0) {
+        goto out;
+    } else if (buf->len == 0) {
 #if DEBUG
         fprintf(stderr, "`read` from `inotify` fd returned 0!");
 #endif
-        return;
+        goto out;
     }
 #if DEBUG
-    printf("`read` got %zd bytes\n", len);
+    printf("`read` got %zd bytes\n", buf->len);
     fflush(stdout);
 #endif
 
     // Point to the first event in the buffer.
-    event = buf;
+    event = (const struct inotify_event *)buf->data;
 
     // Process each event in the buffer returned by `read`. Loop over all
     // events in the buffer.
-    while (IN_EVENT_OK(event, buf, len)) {
-        evtlen = process_next_inotify_event(watch, event, buf + len - event, first, logfn);
+    while (IN_EVENT_OK(event, buf->data, buf->len)) {
+        evtlen = process_next_inotify_event(watch, buf, event, buf->data + buf->len - (char *)event, first, logfn);
         // Set `first` for the next `process_next_inotify_event` call.
         first = (bool)(evtlen > 0);
 
+        if (buf->gen != (*watch)->gen) {
+            // The cache was rebuilt on a new fd; the rest of this buffer was
+            // read from the old one and would map to the wrong paths.
+            break;
+        }
+
         if (evtlen == EOF) {
             // We got here because an IN_MOVED_FROM event was found at the end
             // of a previously read buffer and that event may be part of an
@@ -504,12 +589,18 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
             // gather further events, then when we reprocess the IN_MOVED_FROM
             // we should treat it as though this is an out-of-tree `rename`.
             int savederr;
-            len = buf + len - event;
 
-            // Shuffle remaining bytes to start of buffer.
-            for (i = 0; i < len; ++i) {
-                buf[i] = event[i];
+            // Consumers may still reference events earlier in this buffer, so
+            // carry the remaining bytes over into a fresh buffer rather than
+            // shuffling them to the start of this one.
+            if ((nextbuf = acquire_buffer()) == NULL) {
+                goto out;
             }
+            nextbuf->len = buf->data + buf->len - (char *)event;
+            nextbuf->gen = buf->gen;
+            memcpy(nextbuf->data, event, nextbuf->len);
+            unref_buffer(buf);
+            buf = nextbuf;
 
             // Set a timeout for `read`. Some rough testing suggests that a
             // 2ms timeout is sufficient to ensure that, in around 99.8% of
@@ -519,7 +610,7 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
             // hardware and in environments with different filesystem activity
             // levels.
             ualarm(2000, 0);
-            readlen = read((*watch)->fd, buf + len, IN_BUFFER_SIZE);
+            readlen = read((*watch)->fd, buf->data + buf->len, sizeof(buf->data) - buf->len);
 
             // In case `ualarm` should change errno.
             savederr = errno;
@@ -532,16 +623,16 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
 #if DEBUG
                 perror("read");
 #endif
-                return;
+                goto out;
             } else if (readlen == 0) {
 #if DEBUG
                 fprintf(stderr, "`read` from `inotify` fd returned 0!");
 #endif
-                return;
+                goto out;
             }
 
-            if (errno != -1) {
-                len += readlen;
+            if (readlen != EOF) {
+                buf->len += readlen;
 #if DEBUG
                 printf("secondary `read` got %zd bytes\n", readlen);
                 fflush(stdout);
@@ -553,13 +644,22 @@ static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn l
                 fflush(stdout);
 #endif
             }
-            // Start again at beginning of buffer.
-            event = buf;
+            // Start again at beginning of buffer. Only wait for the
+            // IN_MOVED_TO once; if it still isn't there, the IN_MOVED_FROM is
+            // treated as an out-of-tree `rename`.
+            event = (const struct inotify_event *)buf->data;
+            first = false;
+            continue;
         }
 
         // Advance to next event.
-        event = IN_EVENT_NEXT(event, len, evtlen);
+        event = IN_EVENT_NEXT(event, buf->len, evtlen);
     }
+
+out:
+    // Drop the reader's reference; the buffer returns to the pool once any
+    // consumer references are released too.
+    unref_buffer(buf);
 }
 
 /**
@@ -591,7 +691,7 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
     const unsigned int pathc, const char *paths[], const unsigned int ignorec, const char *ignores[], const uint32_t mask,
     const uint32_t flags, const int maxdepth, const char *tags, const char *logformat, arguswatch_logfn logfn) {
 
-    struct arguswatch *watch;
+    struct arguswatch *watch, newwatch;
     // To keep this function idempotent we need to handle both existing
     // arguswatch configuration updates as well as new ones.
     // `inotify_add_watch` will also handle updates properly if a wd exists for
@@ -602,8 +702,10 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
         watch = wlcache[slot];
     } else {
         // Create new arguswatch placeholder struct with select watch
-        // parameters that cannot change; the rest to be filled later.
-        watch = &(struct arguswatch){
+        // parameters that cannot change; the rest to be filled later. This
+        // lives in the function's frame (not a block-scoped literal) since
+        // the watch is used until the watcher exits.
+        newwatch = (struct arguswatch){
             .name = name,
             .node_name = nodename,
             .pod_name = podname,
@@ -613,6 +715,7 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
             .slot = -1,
             .fd = EOF
         };
+        watch = &newwatch;
     }
 
     // Assign or update the passed-in watch parameters that can possibly change
@@ -643,7 +746,7 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
     // @TODO: document this
 
     struct epoll_event *epollevts; // Buffer where events are returned.
-    int nfds, i;
+    int nfds, i, timeout = -1;
     if ((epollevts = calloc(EPOLL_MAX_EVENTS, sizeof(struct epoll_event))) == NULL) {
 #if DEBUG
         perror("calloc");
@@ -662,9 +765,27 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
     }
     add_epoll_ctl_fds(&watch);
 
+    // Report that the tree is watched, so a watcher this one replaces can be
+    // stopped without a gap in coverage.
+    struct arguswatch_event readyevt = {
+        .watch = watch,
+        .event_mask = AW_READY,
+        .path_name = watch->rootpathc > 0 ? watch->rootpaths[0] : "",
+        .file_name = "",
+        .is_dir = true
+    };
+    (*logfn)(&readyevt);
+
+    // With a busy-poll thread running, it reads this watcher's events instead
+    // of this thread; see `start_busy_poller`.
+    if (busy_poll_enabled() &&
+        busy_poll_watch(&watch, logfn)) {
+        goto out;
+    }
+
     // Wait for events.
     for (;;) {
-        if ((nfds = epoll_pwait(watch->efd, epollevts, EPOLL_MAX_EVENTS, -1, &sigmask)) == EOF) {
+        if ((nfds = epoll_pwait(watch->efd, epollevts, EPOLL_MAX_EVENTS, timeout, &sigmask)) == EOF) {
             if (errno == EINTR) {
                 continue;
             }
@@ -696,11 +817,17 @@ int start_inotify_watcher(const char *name, const char *nodename, const char *po
                 uint64_t value;
                 ssize_t len = read(epollevts[i].data.fd, &value, sizeof(uint64_t));
                 if (len != EOF &&
-                    (value & ARGUSNOTIFY_KILL)) {
+                    ARGUSNOTIFY_KILLED(value)) {
                     goto out;
                 }
             }
         }
+
+        if (watch->flags & AW_RECURSIVE) {
+            // Re-promote directories demoted for churn once they go quiet;
+            // wake up periodically while any are demoted.
+            timeout = check_churn(&watch, logfn);
+        }
     }
 
 out:
@@ -720,12 +847,10 @@ out:
 #endif
     }
 
-    // Close `inotify` file descriptor.
-    if (close(watch->fd) == EOF) {
-#if DEBUG
-        perror("close");
-#endif
-    }
+    // Hand the `inotify` fd and cache to the reaper so stopping the watcher
+    // (and starting its replacement) does not wait for the kernel to remove
+    // every watch.
+    reap_watch(&watch);
     // Close `eventfd` file descriptor.
     if (close(watch->processevtfd) == EOF) {
 #if DEBUG
@@ -743,6 +868,11 @@ out:
 
     // Free watch cache.
     clear_watch(&watch);
+    // `watch` lives on this thread's stack; don't leave it in `wlcache` for
+    // a restarted watcher with the same PID and subject to pick up.
+    if (watch->slot > -1) {
+        mark_cache_slot_empty(watch->slot);
+    }
 
     return errno ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -792,6 +922,26 @@ void send_watcher_kill_signal(const int pid) {
     }
 }
 
+/**
+ * Sends the custom kill signal to a single subject's watcher, leaving other
+ * watchers of the same PID running. A watcher that is still starting gets it
+ * once it is cached.
+ *
+ * @param pid
+ * @param sid
+ */
+void send_subject_kill_signal(const int pid, const int sid) {
+    int slot = find_cached_slot_or_defer_kill(pid, sid);
+    if (slot > -1) {
+        uint64_t value = ARGUSNOTIFY_KILL;
+        if (write(wlcache[slot]->processevtfd, &value, sizeof(value)) == EOF) {
+#if DEBUG
+            perror("write");
+#endif
+        }
+    }
+}
+
 /**
  * SIGALRM handler is designed simply to interrupt `read`.
  *
@@ -29,20 +29,25 @@
 #include <signal.h>
 #include <sys/inotify.h>
 
+#include "argusbuffer.h"
 #include "argusutil.h"
 
 #define EPOLL_MAX_EVENTS 64
 #define ARGUSNOTIFY_KILL SIGKILL
+// An `eventfd` adds up the values written to it, so kill signals sent before
+// the watcher reads them come back as a multiple of `ARGUSNOTIFY_KILL`.
+#define ARGUSNOTIFY_KILLED(value) ((value) >= ARGUSNOTIFY_KILL)
 
 static void reinitialize(struct arguswatch **watch);
-static size_t process_next_inotify_event(struct arguswatch **watch, const struct inotify_event *event, ssize_t len,
-    bool first, arguswatch_logfn logfn);
-static void process_inotify_events(struct arguswatch **watch, arguswatch_logfn logfn);
+static size_t process_next_inotify_event(struct arguswatch **watch, struct arguswatch_buffer *buf,
+    const struct inotify_event *event, ssize_t len, bool first, arguswatch_logfn logfn);
+void process_inotify_events(struct arguswatch **watch, arguswatch_logfn logfn);
 int start_inotify_watcher(const char *name, const char *nodename, const char *podname, int pid, int sid,
     unsigned int pathc, const char *paths[], unsigned int ignorec, const char *ignores[], uint32_t mask, uint32_t flags,
     int maxdepth, const char *tags, const char *logformat, arguswatch_logfn logfn);
 void add_epoll_ctl_fds(struct arguswatch **watch);
 void send_watcher_kill_signal(int pid);
+void send_subject_kill_signal(int pid, int sid);
 void alarm_handler(int sig);
 
 #endif
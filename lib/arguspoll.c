@@ -0,0 +1,750 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#include "arguscache.h"
+#include "argusnotify.h"
+#include "arguspoll.h"
+#include "argusutil.h"
+
+// Filesystems on which `inotify` misses changes made by other clients.
+static const long remote_fs_magic_[] = {
+    0x6969,                           // NFS
+    0x65735546,                       // FUSE
+    0x517B,                           // SMB
+    0xFF534D42,                       // CIFS
+    0xFE534D42,                       // SMB2
+    0x01021997,                       // 9P
+    0x00C36400,                       // Ceph
+    0x6B414653,                       // AFS
+};
+
+static long budget_ = 1000;           // File system operations per second across all polling watchers.
+static long tokens_, refilled_;       // Budget left in thousandths of an operation, and when it was last refilled.
+static pthread_mutex_t budget_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Set how many file system operations (`lstat`, `fstatat`, and opening and
+ * reading a directory) polling watchers on this node may make per second,
+ * together. Scans that would exceed it wait; 0 removes the limit.
+ *
+ * @param opspersec
+ */
+void set_poll_budget(const long opspersec) {
+    pthread_mutex_lock(&budget_mutex_);
+    budget_ = opspersec;
+    tokens_ = opspersec * 1000;
+    refilled_ = now_msec();
+    pthread_mutex_unlock(&budget_mutex_);
+}
+
+/**
+ * Whether `path` is on a file system where `inotify` only sees changes made
+ * through this node, such as NFS, FUSE or SMB; watchers of it should poll.
+ *
+ * @param path
+ * @return
+ */
+bool needs_poll_watcher(const char *path) {
+    struct statfs sfs;
+    unsigned int i;
+
+    if (statfs(path, &sfs) == EOF) {
+        return false;
+    }
+    for (i = 0; i < sizeof(remote_fs_magic_) / sizeof(remote_fs_magic_[0]); ++i) {
+        if ((unsigned long)sfs.f_type == (unsigned long)remote_fs_magic_[i]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Watch the paths of a subject by polling instead of `inotify`; takes the
+ * same parameters as `start_inotify_watcher` and, like it, returns once the
+ * watcher receives its kill signal. Each directory's listing is kept as a
+ * snapshot: a directory whose mtime changed is listed again, the others only
+ * have their entries `lstat`ed again, and differences are reported as
+ * `inotify` events. A directory that changed is scanned again after
+ * `POLL_MIN_INTERVAL`; each quiet scan doubles that, up to
+ * `POLL_MAX_INTERVAL`. Scans are paid for from the node's budget (see
+ * `set_poll_budget`), most overdue first.
+ *
+ * @param name
+ * @param nodename
+ * @param podname
+ * @param pid
+ * @param sid
+ * @param pathc
+ * @param paths
+ * @param ignorec
+ * @param ignores
+ * @param mask
+ * @param flags
+ * @param maxdepth
+ * @param tags
+ * @param logformat
+ * @param logfn
+ * @return
+ */
+int start_poll_watcher(const char *name, const char *nodename, const char *podname, const int pid, const int sid,
+    const unsigned int pathc, const char *paths[], const unsigned int ignorec, const char *ignores[], const uint32_t mask,
+    const uint32_t flags, const int maxdepth, const char *tags, const char *logformat, arguswatch_logfn logfn) {
+
+    struct arguswatch watch = {
+        .name = name,
+        .node_name = nodename,
+        .pod_name = podname,
+        .tags = tags,
+        .log_format = logformat,
+        .rootpaths = (char **)paths,
+        .rootpathc = pathc,
+        .ignores = (char **)ignores,
+        .ignorec = ignorec,
+        .event_mask = mask,
+        .flags = flags,
+        .max_depth = maxdepth,
+        .pid = pid,
+        .sid = sid,
+        .slot = -1,
+        .fd = EOF,
+        .processevtfd = EOF,
+        .efd = EOF
+    }, *watchp = &watch;
+    struct arguspoll poller = {
+        .watch = &watch,
+        .logfn = logfn
+    };
+    struct pollfd pfd = { .events = POLLIN };
+    char parent[PATH_MAX], *base;
+    struct stat sb;
+    unsigned int i, next;
+    long now, timeout;
+    uint64_t value;
+
+    if ((watch.processevtfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK)) == EOF) {
+#if DEBUG
+        perror("eventfd");
+#endif
+        return EXIT_FAILURE;
+    }
+    pfd.fd = watch.processevtfd;
+    // Cache the watch so kill signals reach it, including ones sent before
+    // the first snapshot is taken.
+    add_watch_to_cache(&watchp);
+
+    for (i = 0; i < pathc; ++i) {
+        if (lstat(paths[i], &sb) == EOF) {
+#if DEBUG
+            fprintf(stderr, "`lstat` failed on '%s'\n", paths[i]);
+            perror("lstat");
+#endif
+            continue;
+        }
+        if (S_ISDIR(sb.st_mode)) {
+            add_poll_dir(&poller, paths[i], NULL, 0);
+            continue;
+        }
+        // A file is polled as the only entry of its directory.
+        snprintf(parent, sizeof(parent), "%s", paths[i]);
+        if ((base = strrchr(parent, '/')) != NULL &&
+            !(watch.flags & AW_ONLYDIR)) {
+            *base = '\0';
+            add_poll_dir(&poller, *parent ? parent : "/", strrchr(paths[i], '/') + 1, 0);
+        }
+    }
+    snapshot_poll_tree(&poller, 0);
+
+    struct arguswatch_event readyevt = {
+        .watch = &watch,
+        .event_mask = AW_READY,
+        .path_name = pathc > 0 ? paths[0] : "",
+        .file_name = "",
+        .is_dir = true
+    };
+    (*logfn)(&readyevt);
+
+    for (;;) {
+        now = now_msec();
+        timeout = -1;
+        for (i = 0, next = 0; i < poller.dirc; ++i) {
+            if (poller.dirs[i].due < poller.dirs[next].due) {
+                next = i;
+            }
+        }
+        if (poller.dirc > 0) {
+            timeout = poller.dirs[next].due > now ? poller.dirs[next].due - now : 0;
+            if (timeout == 0) {
+                // Listing plus one `lstat` per entry.
+                timeout = take_poll_tokens(2 + poller.dirs[next].entryc, false);
+            }
+        }
+        if (timeout == 0) {
+            scan_poll_dir(&poller, next);
+            continue;
+        }
+
+        if (poll(&pfd, 1, timeout > INT_MAX ? INT_MAX : (int)timeout) == EOF) {
+            if (errno == EINTR) {
+                continue;
+            }
+#if DEBUG
+            perror("poll");
+#endif
+            break;
+        }
+        if ((pfd.revents & POLLIN) &&
+            read(watch.processevtfd, &value, sizeof(value)) != EOF &&
+            ARGUSNOTIFY_KILLED(value)) {
+            break;
+        }
+    }
+
+    for (i = 0; i < poller.dirc; ++i) {
+        clear_poll_dir(&poller.dirs[i]);
+    }
+    free(poller.dirs);
+    if (watch.slot > -1) {
+        mark_cache_slot_empty(watch.slot);
+    }
+    close(watch.processevtfd);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * Append a directory to the ones polled; its snapshot is taken by
+ * `snapshot_poll_tree`.
+ *
+ * @param poller
+ * @param path
+ * @param only
+ * @param depth
+ * @return Index of the directory, or -1 on error.
+ */
+static int add_poll_dir(struct arguspoll *poller, const char *path, const char *only, const int depth) {
+    struct arguspoll_dir *dirs;
+
+    if (poller->dirc == poller->dirmax) {
+        if ((dirs = realloc(poller->dirs, (poller->dirmax + POLL_DIRS_INC) * sizeof(struct arguspoll_dir))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            return -1;
+        }
+        poller->dirs = dirs;
+        poller->dirmax += POLL_DIRS_INC;
+    }
+    poller->dirs[poller->dirc] = (struct arguspoll_dir){
+        .path = strdup(path),
+        .only = only,
+        .depth = depth,
+        .interval = POLL_MIN_INTERVAL
+    };
+    if (poller->dirs[poller->dirc].path == NULL) {
+        return -1;
+    }
+    return poller->dirc++;
+}
+
+/**
+ * Stop polling a directory and every directory below it.
+ *
+ * @param poller
+ * @param path
+ */
+static void remove_poll_dirs(struct arguspoll *poller, const char *path) {
+    size_t len = strlen(path);
+    unsigned int i, j;
+
+    for (i = 0, j = 0; i < poller->dirc; ++i) {
+        if (poller->dirs[i].only == NULL &&
+            strncmp(poller->dirs[i].path, path, len) == 0 &&
+            (poller->dirs[i].path[len] == '\0' || poller->dirs[i].path[len] == '/')) {
+            clear_poll_dir(&poller->dirs[i]);
+            continue;
+        }
+        poller->dirs[j++] = poller->dirs[i];
+    }
+    poller->dirc = j;
+}
+
+static void clear_poll_dir(struct arguspoll_dir *dir) {
+    unsigned int i;
+    for (i = 0; i < dir->entryc; ++i) {
+        free(dir->entries[i].name);
+    }
+    free(dir->entries);
+    free(dir->path);
+    dir->entries = NULL;
+    dir->entryc = 0;
+}
+
+/**
+ * Take the first snapshot of the directories from `from` on, adding the
+ * subdirectories found for recursive watchers as they are listed, so a whole
+ * tree is walked without reporting anything. Charged to the budget without
+ * waiting for it.
+ *
+ * @param poller
+ * @param from
+ */
+static void snapshot_poll_tree(struct arguspoll *poller, const unsigned int from) {
+    struct arguspoll_entry *entries;
+    unsigned int i, j, entryc;
+    char path[PATH_MAX];
+    long now = now_msec();
+
+    for (i = from; i < poller->dirc; ++i) {
+        if (list_poll_dir(&poller->dirs[i], true, &entries, &entryc) == -1) {
+            poller->dirs[i].due = now + POLL_MAX_INTERVAL;
+            continue;
+        }
+        take_poll_tokens(2 + entryc, true);
+        poller->dirs[i].entries = entries;
+        poller->dirs[i].entryc = entryc;
+        poller->dirs[i].due = now + poller->dirs[i].interval;
+
+        for (j = 0; j < entryc; ++j) {
+            if (should_poll_subdir(poller, poller->dirs[i].depth, &entries[j])) {
+                if (!join_poll_path(path, poller->dirs[i].path, entries[j].name)) {
+                    continue;
+                }
+                // May move `poller->dirs`; `entries` stays put.
+                add_poll_dir(poller, path, NULL, poller->dirs[i].depth + 1);
+            }
+        }
+    }
+}
+
+/**
+ * Read a directory into a list of entries sorted by name, with their
+ * attributes. With `relist` the directory is read; otherwise the names of
+ * the current snapshot are `lstat`ed again, dropping any that are gone. Also
+ * records the directory's mtime.
+ *
+ * @param dir
+ * @param relist
+ * @param entries
+ * @param entryc
+ * @return 0 on success, -1 if the directory can't be read.
+ */
+static int list_poll_dir(struct arguspoll_dir *dir, const bool relist, struct arguspoll_entry **entries,
+    unsigned int *entryc) {
+
+    struct arguspoll_entry *list = NULL, *grown;
+    unsigned int count = 0, max = 0, i;
+    struct dirent *ent;
+    struct stat sb;
+    DIR *dp;
+    int fd;
+
+    *entries = NULL;
+    *entryc = 0;
+    if ((fd = open(dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == EOF) {
+#if DEBUG
+        perror("open");
+#endif
+        return -1;
+    }
+    if (fstat(fd, &sb) == 0) {
+        dir->mtime = sb.st_mtim;
+    }
+    if ((dp = fdopendir(fd)) == NULL) {
+        close(fd);
+        return -1;
+    }
+
+    for (i = 0;; ++i) {
+        const char *name;
+        if (relist) {
+            if ((ent = readdir(dp)) == NULL) {
+                break;
+            }
+            name = ent->d_name;
+            if (strcmp(name, ".") == 0 ||
+                strcmp(name, "..") == 0) {
+                continue;
+            }
+        } else {
+            if (i >= dir->entryc) {
+                break;
+            }
+            name = dir->entries[i].name;
+        }
+        if (dir->only != NULL &&
+            strcmp(name, dir->only) != 0) {
+            continue;
+        }
+        if (fstatat(fd, name, &sb, AT_SYMLINK_NOFOLLOW) == EOF) {
+            continue;
+        }
+        if (count == max) {
+            if ((grown = realloc(list, (max + POLL_ENTRIES_INC) * sizeof(struct arguspoll_entry))) == NULL) {
+#if DEBUG
+                perror("realloc");
+#endif
+                break;
+            }
+            list = grown;
+            max += POLL_ENTRIES_INC;
+        }
+        list[count] = (struct arguspoll_entry){
+            .name = strdup(name),
+            .ino = sb.st_ino,
+            .mode = sb.st_mode,
+            .size = sb.st_size,
+            .mtime = sb.st_mtim,
+            .ctime = sb.st_ctim
+        };
+        if (list[count].name != NULL) {
+            ++count;
+        }
+    }
+    closedir(dp);
+
+    if (relist) {
+        qsort(list, count, sizeof(struct arguspoll_entry), compare_poll_entries);
+    }
+    *entries = list;
+    *entryc = count;
+    return 0;
+}
+
+static int compare_poll_entries(const void *a, const void *b) {
+    return strcmp(((const struct arguspoll_entry *)a)->name, ((const struct arguspoll_entry *)b)->name);
+}
+
+/**
+ * Scan a directory that is due: list it again if its mtime changed (or just
+ * `lstat` its entries if not), report the differences from its snapshot and
+ * set when it is due next.
+ *
+ * @param poller
+ * @param index
+ */
+static void scan_poll_dir(struct arguspoll *poller, const unsigned int index) {
+    struct arguspoll_dir *dir = &poller->dirs[index];
+    struct arguspoll_entry *entries;
+    unsigned int entryc;
+    struct stat sb;
+    bool relist;
+
+    if (lstat(dir->path, &sb) == EOF) {
+        // Reported as deleted by its parent's scan; a root path is retried.
+        dir->interval = POLL_MAX_INTERVAL;
+        dir->due = now_msec() + dir->interval;
+        return;
+    }
+    relist = dir->entries == NULL ||
+        sb.st_mtim.tv_sec != dir->mtime.tv_sec ||
+        sb.st_mtim.tv_nsec != dir->mtime.tv_nsec;
+    // Without an mtime change only files can have changed.
+    if ((relist ||
+        !(poller->watch->flags & AW_ONLYDIR)) &&
+        list_poll_dir(dir, relist, &entries, &entryc) == 0) {
+        diff_poll_entries(poller, index, entries, entryc);
+        return;
+    }
+    reschedule_poll_dir(dir, 0);
+}
+
+/**
+ * Report the differences between a directory's snapshot and a new listing,
+ * then make the listing its snapshot and schedule its next scan. Entries gone
+ * and added with the same inode are reported as a move; changes to the size
+ * or mtime of a file as a modification, and to the ctime alone as an
+ * attribute change. Directories added to or removed from a recursive
+ * watcher's tree start or stop being polled, which can move
+ * `poller->dirs`.
+ *
+ * @param poller
+ * @param index
+ * @param entries
+ * @param entryc
+ */
+static void diff_poll_entries(struct arguspoll *poller, const unsigned int index, struct arguspoll_entry *entries,
+    const unsigned int entryc) {
+
+    struct arguspoll_dir *dir = &poller->dirs[index];
+    struct arguspoll_entry *old = dir->entries, *oldent, *newent;
+    unsigned int oldc = dir->entryc, i = 0, j = 0, k, changes = 0, removedc = 0, addedc = 0;
+    unsigned int *removed = calloc(oldc + 1, sizeof(unsigned int)), *added = calloc(entryc + 1, sizeof(unsigned int));
+    bool *moved = calloc(entryc + 1, sizeof(bool));
+    int depth = dir->depth, cmp, slot;
+    char path[PATH_MAX], dirpath[PATH_MAX];
+
+    if (removed == NULL ||
+        added == NULL ||
+        moved == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        free(removed);
+        free(added);
+        free(moved);
+        for (k = 0; k < entryc; ++k) {
+            free(entries[k].name);
+        }
+        free(entries);
+        return;
+    }
+
+    // Both lists are sorted by name.
+    while (i < oldc || j < entryc) {
+        cmp = i == oldc ? 1 : j == entryc ? -1 : strcmp(old[i].name, entries[j].name);
+        if (cmp < 0) {
+            removed[removedc++] = i++;
+            continue;
+        }
+        if (cmp > 0) {
+            added[addedc++] = j++;
+            continue;
+        }
+        oldent = &old[i++];
+        newent = &entries[j++];
+        if (oldent->ino != newent->ino ||
+            (oldent->mode & S_IFMT) != (newent->mode & S_IFMT)) {
+            // Replaced under the same name.
+            removed[removedc++] = i - 1;
+            added[addedc++] = j - 1;
+        } else if (!S_ISDIR(newent->mode) &&
+            (oldent->size != newent->size ||
+            oldent->mtime.tv_sec != newent->mtime.tv_sec ||
+            oldent->mtime.tv_nsec != newent->mtime.tv_nsec)) {
+            report_poll_event(poller, dir, newent, IN_MODIFY);
+            ++changes;
+        } else if ((oldent->ctime.tv_sec != newent->ctime.tv_sec ||
+            oldent->ctime.tv_nsec != newent->ctime.tv_nsec) &&
+            // A directory's ctime also moves when its entries change.
+            oldent->mtime.tv_sec == newent->mtime.tv_sec &&
+            oldent->mtime.tv_nsec == newent->mtime.tv_nsec) {
+            report_poll_event(poller, dir, newent, IN_ATTRIB);
+            ++changes;
+        }
+    }
+
+    for (i = 0; i < removedc; ++i) {
+        oldent = &old[removed[i]];
+        for (k = 0; k < addedc; ++k) {
+            if (!moved[k] &&
+                entries[added[k]].ino == oldent->ino &&
+                strcmp(entries[added[k]].name, oldent->name) != 0) {
+                break;
+            }
+        }
+        if (k < addedc) {
+            moved[k] = true;
+            report_poll_event(poller, dir, oldent, IN_MOVED_FROM);
+            report_poll_event(poller, dir, &entries[added[k]], IN_MOVED_TO);
+        } else {
+            report_poll_event(poller, dir, oldent, IN_DELETE);
+        }
+        ++changes;
+    }
+    for (k = 0; k < addedc; ++k) {
+        if (!moved[k]) {
+            report_poll_event(poller, dir, &entries[added[k]], IN_CREATE);
+            ++changes;
+        }
+    }
+
+    dir->entries = entries;
+    dir->entryc = entryc;
+    reschedule_poll_dir(dir, changes);
+    snprintf(dirpath, sizeof(dirpath), "%s", dir->path);
+
+    if (poller->watch->flags & AW_RECURSIVE) {
+        for (i = 0; i < removedc; ++i) {
+            if (S_ISDIR(old[removed[i]].mode) &&
+                join_poll_path(path, dirpath, old[removed[i]].name)) {
+                remove_poll_dirs(poller, path);
+            }
+        }
+        for (k = 0; k < addedc; ++k) {
+            if (should_poll_subdir(poller, depth, &entries[added[k]]) &&
+                join_poll_path(path, dirpath, entries[added[k]].name)) {
+                if ((slot = add_poll_dir(poller, path, NULL, depth + 1)) > -1) {
+                    snapshot_poll_tree(poller, slot);
+                }
+            }
+        }
+    }
+
+    for (k = 0; k < oldc; ++k) {
+        free(old[k].name);
+    }
+    free(old);
+    free(removed);
+    free(added);
+    free(moved);
+}
+
+/**
+ * Scan again soon after a change, and back off while nothing changes.
+ *
+ * @param dir
+ * @param changes
+ */
+static void reschedule_poll_dir(struct arguspoll_dir *dir, const unsigned int changes) {
+    if (changes) {
+        dir->interval = POLL_MIN_INTERVAL;
+    } else if ((dir->interval *= 2) > POLL_MAX_INTERVAL) {
+        dir->interval = POLL_MAX_INTERVAL;
+    }
+    dir->due = now_msec() + dir->interval;
+}
+
+/**
+ * Report a change to an entry if the watcher's event mask, `onlydir` and
+ * ignore list let it through, named as `inotify` would: the directory and
+ * the entry's name in it, or a watched file's own path.
+ *
+ * @param poller
+ * @param dir
+ * @param entry
+ * @param mask
+ */
+static void report_poll_event(const struct arguspoll *poller, const struct arguspoll_dir *dir,
+    const struct arguspoll_entry *entry, const uint32_t mask) {
+
+    const struct arguswatch *watch = poller->watch;
+    bool isdir = S_ISDIR(entry->mode);
+    char path[PATH_MAX];
+    unsigned int i;
+
+    if (!(watch->event_mask & mask) ||
+        ((watch->flags & AW_ONLYDIR) && !isdir)) {
+        return;
+    }
+    for (i = 0; i < watch->ignorec; ++i) {
+        if (strcmp(entry->name, watch->ignores[i]) == 0) {
+            return;
+        }
+    }
+    if (dir->only != NULL) {
+        FORMAT_PATH(path, dir->path, dir->only);
+    }
+
+    struct arguswatch_event awevent = {
+        .watch = poller->watch,
+        .event_mask = mask | (isdir ? IN_ISDIR : 0),
+        .path_name = dir->only != NULL ? path : dir->path,
+        .file_name = dir->only != NULL ? "" : entry->name,
+        .is_dir = isdir
+    };
+    (*poller->logfn)(&awevent);
+}
+
+/**
+ * Whether a recursive watcher polls a subdirectory found in a directory
+ * `depth` levels below its root path.
+ *
+ * @param poller
+ * @param depth
+ * @param entry
+ * @return
+ */
+static bool should_poll_subdir(const struct arguspoll *poller, const int depth, const struct arguspoll_entry *entry) {
+    const struct arguswatch *watch = poller->watch;
+    unsigned int i;
+
+    if (!(watch->flags & AW_RECURSIVE) ||
+        !S_ISDIR(entry->mode) ||
+        (watch->max_depth && depth + 1 > watch->max_depth)) {
+        return false;
+    }
+    for (i = 0; i < watch->ignorec; ++i) {
+        if (strcmp(entry->name, watch->ignores[i]) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Write `dir`/`name` to `path`, a `PATH_MAX` buffer. Paths that don't fit are
+ * skipped rather than truncated into another directory's path.
+ *
+ * @param path
+ * @param dir
+ * @param name
+ * @return False if the path is too long.
+ */
+static bool join_poll_path(char *path, const char *dir, const char *name) {
+    int len = snprintf(path, PATH_MAX, "%s/%s", dir, name);
+    return len >= 0 && len < PATH_MAX;
+}
+
+/**
+ * Pay for `cost` file system operations from the node's budget, which
+ * refills at `budget_` per second and holds at most one second's worth.
+ * With `force` the cost is always taken, leaving the budget in debt.
+ *
+ * @param cost
+ * @param force
+ * @return 0 if paid, else milliseconds until the budget can cover it.
+ */
+static long take_poll_tokens(long cost, const bool force) {
+    long now = now_msec(), wait = 0;
+
+    pthread_mutex_lock(&budget_mutex_);
+    if (budget_ > 0) {
+        tokens_ += (now - refilled_) * budget_;
+        refilled_ = now;
+        if (tokens_ > budget_ * 1000) {
+            tokens_ = budget_ * 1000;
+        }
+        // A directory bigger than the whole budget is scanned once it is full.
+        cost = (cost < budget_ ? cost : budget_) * 1000;
+        if (force ||
+            tokens_ >= cost) {
+            tokens_ -= cost;
+        } else {
+            wait = (cost - tokens_ + budget_ - 1) / budget_;
+        }
+    }
+    pthread_mutex_unlock(&budget_mutex_);
+    return wait;
+}
+
+static long now_msec(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
@@ -0,0 +1,93 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUS_POLL__
+#define __ARGUS_POLL__
+
+#include <stdbool.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "argusutil.h"
+
+#ifndef POLL_MIN_INTERVAL
+#define POLL_MIN_INTERVAL 1000        // Milliseconds between scans of a directory that just changed.
+#endif
+#ifndef POLL_MAX_INTERVAL
+#define POLL_MAX_INTERVAL 60000       // Longest a quiet directory goes between scans, in milliseconds.
+#endif
+#define POLL_DIRS_INC    64
+#define POLL_ENTRIES_INC 32
+
+struct arguspoll_entry {
+    char *name;
+    ino_t ino;
+    mode_t mode;
+    off_t size;
+    struct timespec mtime, ctime;
+};
+
+struct arguspoll_dir {
+    char *path;                       // Directory listed, under `/proc/[pid]/root`.
+    const char *only;                 // For a root path that is a file: its name in `path`, the only entry kept.
+    struct arguspoll_entry *entries;  // Snapshot of the last listing, sorted by name.
+    unsigned int entryc;
+    struct timespec mtime;            // Directory mtime when it was last listed.
+    long interval, due;               // Current scan interval, next scan (ms on `CLOCK_MONOTONIC`).
+    int depth;                        // Levels below its root path.
+};
+
+struct arguspoll {
+    struct arguswatch *watch;
+    arguswatch_logfn logfn;
+    struct arguspoll_dir *dirs;
+    unsigned int dirc, dirmax;
+};
+
+void set_poll_budget(long opspersec);
+bool needs_poll_watcher(const char *path);
+int start_poll_watcher(const char *name, const char *nodename, const char *podname, int pid, int sid,
+    unsigned int pathc, const char *paths[], unsigned int ignorec, const char *ignores[], uint32_t mask, uint32_t flags,
+    int maxdepth, const char *tags, const char *logformat, arguswatch_logfn logfn);
+static int add_poll_dir(struct arguspoll *poller, const char *path, const char *only, int depth);
+static void remove_poll_dirs(struct arguspoll *poller, const char *path);
+static void clear_poll_dir(struct arguspoll_dir *dir);
+static void snapshot_poll_tree(struct arguspoll *poller, unsigned int from);
+static int list_poll_dir(struct arguspoll_dir *dir, bool relist, struct arguspoll_entry **entries,
+    unsigned int *entryc);
+static int compare_poll_entries(const void *a, const void *b);
+static void scan_poll_dir(struct arguspoll *poller, unsigned int index);
+static void diff_poll_entries(struct arguspoll *poller, unsigned int index, struct arguspoll_entry *entries,
+    unsigned int entryc);
+static void reschedule_poll_dir(struct arguspoll_dir *dir, unsigned int changes);
+static void report_poll_event(const struct arguspoll *poller, const struct arguspoll_dir *dir,
+    const struct arguspoll_entry *entry, uint32_t mask);
+static bool should_poll_subdir(const struct arguspoll *poller, int depth, const struct arguspoll_entry *entry);
+static bool join_poll_path(char *path, const char *dir, const char *name);
+static long take_poll_tokens(long cost, bool force);
+static long now_msec(void);
+
+#endif
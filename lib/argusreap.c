@@ -0,0 +1,171 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "argusreap.h"
+#include "argussched.h"
+#include "argusutil.h"
+
+static struct argusreap_job *jobs_, **lastjob_ = &jobs_; // Queued jobs, oldest first.
+static struct argusreap_stats stats_;
+static pthread_mutex_t reap_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reap_cond_ = PTHREAD_COND_INITIALIZER;
+static pthread_once_t reap_once_ = PTHREAD_ONCE_INIT;
+static bool reaper_started_;
+
+/**
+ * Detach the `inotify` fd and the path cache from `watch` and hand them to
+ * the reaper thread. Closing an `inotify` fd makes the kernel remove every
+ * one of its watches before `close` returns, and freeing the cache is
+ * proportional to its size; neither should hold up a watcher being stopped
+ * or rebuilt. `watch` is left with no fd and an empty cache. If the job
+ * cannot be allocated or the reaper cannot be started, it is done in place.
+ *
+ * @param watch
+ */
+void reap_watch(struct arguswatch **watch) {
+    struct argusreap_job *job, inplace = {0};
+
+    if ((job = calloc(1, sizeof(struct argusreap_job))) == NULL) {
+#if DEBUG
+        perror("calloc");
+#endif
+        // Still detach and release everything, just on this thread.
+        job = &inplace;
+    }
+    job->fd = (*watch)->fd;
+    job->paths = (*watch)->paths;
+    job->wd = (*watch)->wd;
+    job->pathidx = (*watch)->pathidx;
+    job->pathc = (*watch)->pathc;
+
+    (*watch)->fd = EOF;
+    (*watch)->paths = NULL;
+    (*watch)->wd = NULL;
+    (*watch)->pathidx = NULL;
+    (*watch)->pathc = 0;
+    (*watch)->pathidxc = 0;
+
+    if (job == &inplace) {
+        release_job(job);
+        return;
+    }
+    pthread_once(&reap_once_, start_reaper);
+    if (!reaper_started_) {
+        free_job(job);
+        return;
+    }
+
+    pthread_mutex_lock(&reap_mutex_);
+    *lastjob_ = job;
+    lastjob_ = &job->next;
+    ++stats_.pending;
+    stats_.pendingwatches += job->pathc;
+    pthread_cond_signal(&reap_cond_);
+    pthread_mutex_unlock(&reap_mutex_);
+}
+
+/**
+ * Copy the reaper's backlog counters into `stats`.
+ *
+ * @param stats
+ */
+void get_reap_stats(struct argusreap_stats *stats) {
+    pthread_mutex_lock(&reap_mutex_);
+    *stats = stats_;
+    pthread_mutex_unlock(&reap_mutex_);
+}
+
+static void start_reaper(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reap_jobs, NULL) != 0) {
+#if DEBUG
+        perror("pthread_create");
+#endif
+        return;
+    }
+    pthread_setname_np(thread, "argus-reaper");
+    pthread_detach(thread);
+    reaper_started_ = true;
+}
+
+static void *reap_jobs(void *arg) {
+    struct argusreap_job *job;
+    unsigned int pathc;
+
+    // Reclaiming watches is background work; don't let it compete with the
+    // event loops.
+    begin_background_work();
+    for (;;) {
+        pthread_mutex_lock(&reap_mutex_);
+        while (jobs_ == NULL) {
+            pthread_cond_wait(&reap_cond_, &reap_mutex_);
+        }
+        job = jobs_;
+        if ((jobs_ = job->next) == NULL) {
+            lastjob_ = &jobs_;
+        }
+        pthread_mutex_unlock(&reap_mutex_);
+
+#if DEBUG
+        printf("%s: closing fd %d with %d watches\n", __func__, job->fd, job->pathc);
+        fflush(stdout);
+#endif
+        pathc = job->pathc;
+        free_job(job);
+
+        pthread_mutex_lock(&reap_mutex_);
+        --stats_.pending;
+        stats_.pendingwatches -= pathc;
+        ++stats_.reaped;
+        pthread_mutex_unlock(&reap_mutex_);
+    }
+    return NULL;
+}
+
+static void release_job(struct argusreap_job *job) {
+    int i;
+    if (job->fd != EOF &&
+        close(job->fd) == EOF) {
+#if DEBUG
+        perror("close");
+#endif
+    }
+    for (i = 0; i < job->pathc; ++i) {
+        free(job->paths[i]);
+    }
+    free(job->paths);
+    free(job->wd);
+    free(job->pathidx);
+}
+
+static void free_job(struct argusreap_job *job) {
+    release_job(job);
+    free(job);
+}
@@ -0,0 +1,51 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_REAP__
+#define __ARGUS_REAP__
+
+#include "argusutil.h"
+
+struct argusreap_job {
+    int fd;                           // `inotify` fd; closing it removes all of its watches.
+    char **paths;                     // Cached path names.
+    int *wd, *pathidx;                // Watch descriptors, path index.
+    unsigned int pathc;
+    struct argusreap_job *next;
+};
+
+struct argusreap_stats {
+    unsigned int pending;             // Jobs queued or being reaped.
+    unsigned long pendingwatches;     // Watches held by those jobs.
+    unsigned long reaped;             // Jobs reaped since start.
+};
+
+void reap_watch(struct arguswatch **watch);
+void get_reap_stats(struct argusreap_stats *stats);
+static void start_reaper(void);
+static void *reap_jobs(void *arg);
+static void release_job(struct argusreap_job *job);
+static void free_job(struct argusreap_job *job);
+
+#endif
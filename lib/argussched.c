@@ -0,0 +1,55 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "argussched.h"
+
+static arguswatch_bgfn bgfn_;
+static __thread int bgdepth_; // Background work can nest, e.g. `rewatch_tree` in a sweep.
+
+/**
+ * Install the function used to adjust a watcher thread's scheduling around
+ * background work; NULL to leave threads alone. Set before starting watchers.
+ *
+ * @param fn
+ */
+void set_background_hook(arguswatch_bgfn fn) {
+    bgfn_ = fn;
+}
+
+void begin_background_work(void) {
+    if (bgfn_ != NULL &&
+        bgdepth_++ == 0) {
+        bgfn_(true);
+    }
+}
+
+void end_background_work(void) {
+    if (bgfn_ != NULL &&
+        --bgdepth_ == 0) {
+        bgfn_(false);
+    }
+}
@@ -0,0 +1,541 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/xattr.h>
+#include <unistd.h>
+
+#include "argusshare.h"
+#include "argusutil.h"
+
+static struct argusshare_tree *trees_;             // Cached image trees, newest first.
+static unsigned int treec_;
+static pthread_mutex_t share_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+
+// State of the layer walk in progress; guarded by `share_mutex_`.
+static size_t layerlen_;
+static struct argusshare_hide *hides_, *layerhides_; // Hidden by higher layers, by the layer being walked.
+static unsigned int hidec_, layerhidec_;
+static char **dirs_;
+static unsigned int dirc_;
+static bool redirect_;
+
+/**
+ * Return the directories below `rootpath`, a path in `/proc/[pid]/root`, as
+ * the container sees them, without walking the whole tree: the image layers
+ * of the container's overlay root are walked once per node and cached by
+ * their `lowerdir`, so replicas of an image only walk their own upperdir.
+ * Returns -1 if the listing cannot be shared (not an overlay root, another
+ * directory is mounted below `rootpath`, or the layers are not reachable
+ * through `SHARE_HOST_ROOT`); the caller should walk the tree instead.
+ *
+ * @param pid
+ * @param rootpath
+ * @param listing
+ * @return
+ */
+int get_shared_listing(const int pid, const char *const rootpath, struct argusshare_listing *listing) {
+    char procroot[PATH_MAX], *lowerdir = NULL, *upperdir = NULL;
+    const char *relpath;
+    struct argusshare_tree *tree;
+    struct stat rootsb, sb;
+    int i, ret = EOF, stop;
+
+    snprintf(procroot, sizeof(procroot), "/proc/%d/root", pid);
+    if (strncmp(rootpath, procroot, strlen(procroot)) != 0) {
+        return EOF;
+    }
+    relpath = rootpath + strlen(procroot);
+    // The subject must be a directory on the root filesystem itself.
+    if (stat(procroot, &rootsb) == EOF ||
+        (*relpath ? lstat(rootpath, &sb) : stat(rootpath, &sb)) == EOF ||
+        !S_ISDIR(sb.st_mode) ||
+        sb.st_dev != rootsb.st_dev) {
+        return EOF;
+    }
+    if (read_overlay_dirs(pid, relpath, &lowerdir, &upperdir) == EOF) {
+        goto out_free;
+    }
+
+    pthread_mutex_lock(&share_mutex_);
+    if ((tree = find_shared_tree(lowerdir, relpath)) == NULL) {
+        if ((tree = walk_lower_layers(lowerdir, relpath)) == NULL) {
+            goto out_unlock;
+        }
+#if DEBUG
+        printf("%s: cached %d directories of '%s' for %s\n", __func__, tree->dirc, relpath, lowerdir);
+        fflush(stdout);
+#endif
+    }
+
+    // Walk the container's own changes; anything it whites out or makes
+    // opaque hides the cached image directories below it.
+    hides_ = NULL;
+    hidec_ = 0;
+    dirs_ = NULL;
+    dirc_ = 0;
+    if ((stop = walk_layer(upperdir, relpath)) == EOF) {
+        for (i = 0; i < dirc_; ++i) {
+            free(dirs_[i]);
+        }
+        free(dirs_);
+        goto out_hides;
+    }
+    if (!stop) {
+        for (i = 0; i < tree->dirc; ++i) {
+            if (!is_hidden_path(layerhides_, layerhidec_, tree->dirs[i])) {
+                add_dir(&dirs_, &dirc_, tree->dirs[i]);
+            }
+        }
+    }
+    sort_dirs(dirs_, &dirc_);
+    listing->dirs = dirs_;
+    listing->dirc = dirc_;
+    ret = 0;
+
+out_hides:
+    for (i = 0; i < layerhidec_; ++i) {
+        free(layerhides_[i].path);
+    }
+    free(layerhides_);
+    layerhides_ = NULL;
+    layerhidec_ = 0;
+out_unlock:
+    dirs_ = NULL;
+    dirc_ = 0;
+    pthread_mutex_unlock(&share_mutex_);
+out_free:
+    free(lowerdir);
+    free(upperdir);
+    return ret;
+}
+
+/**
+ * Free a listing returned by `get_shared_listing`.
+ *
+ * @param listing
+ */
+void free_shared_listing(struct argusshare_listing *listing) {
+    int i;
+    for (i = 0; i < listing->dirc; ++i) {
+        free(listing->dirs[i]);
+    }
+    free(listing->dirs);
+    listing->dirs = NULL;
+    listing->dirc = 0;
+}
+
+/**
+ * Read the `lowerdir` and `upperdir` of the overlay mounted as the root of
+ * `pid` from its mountinfo. Fails if the root is not an overlay, or if a
+ * directory is mounted at or below `relpath`, since its contents are not
+ * part of the image.
+ *
+ * @param pid
+ * @param relpath
+ * @param lowerdir
+ * @param upperdir
+ * @return
+ */
+static int read_overlay_dirs(const int pid, const char *const relpath, char **lowerdir, char **upperdir) {
+    char path[PATH_MAX], mountpath[PATH_MAX], *line = NULL, *fields[5], *sep, *fstype, *opts, *opt, *saveptr;
+    size_t linelen = 0, rellen = strlen(relpath);
+    struct stat sb;
+    FILE *fp;
+    int i, ret = 0;
+
+    snprintf(path, sizeof(path), "/proc/%d/mountinfo", pid);
+    if ((fp = fopen(path, "re")) == NULL) {
+#if DEBUG
+        perror("fopen");
+#endif
+        return EOF;
+    }
+
+    while (getline(&line, &linelen, fp) != EOF) {
+        // ID PARENT MAJ:MIN ROOT MOUNTPOINT OPTIONS [OPTIONAL...] - FSTYPE SOURCE SUPEROPTIONS
+        fields[0] = strtok_r(line, " ", &saveptr);
+        for (i = 1; i < 5; ++i) {
+            fields[i] = strtok_r(NULL, " ", &saveptr);
+        }
+        if (fields[4] == NULL ||
+            (sep = strstr(saveptr, " - ")) == NULL) {
+            continue;
+        }
+        fstype = strtok_r(sep + 3, " ", &saveptr);
+        strtok_r(NULL, " ", &saveptr);
+        opts = strtok_r(NULL, " \n", &saveptr);
+
+        if (strcmp(fields[4], "/") != 0) {
+            if (strncmp(fields[4], relpath, rellen) == 0 &&
+                (fields[4][rellen] == '/' || fields[4][rellen] == '\0')) {
+                // Files bind-mounted into the tree (e.g. /etc/hosts) do not
+                // change its directories.
+                snprintf(mountpath, sizeof(mountpath), "/proc/%d/root%s", pid, fields[4]);
+                if (lstat(mountpath, &sb) == EOF ||
+                    S_ISDIR(sb.st_mode)) {
+                    ret = EOF;
+                }
+            }
+            continue;
+        }
+        if (fstype == NULL ||
+            opts == NULL ||
+            strcmp(fstype, "overlay") != 0) {
+            // Root was mounted over; the last root mount wins.
+            free(*lowerdir);
+            free(*upperdir);
+            *lowerdir = *upperdir = NULL;
+            continue;
+        }
+
+        free(*lowerdir);
+        free(*upperdir);
+        *lowerdir = *upperdir = NULL;
+        for (opt = strtok_r(opts, ",", &saveptr); opt != NULL; opt = strtok_r(NULL, ",", &saveptr)) {
+            if (strncmp(opt, "lowerdir=", 9) == 0) {
+                free(*lowerdir);
+                *lowerdir = strdup(opt + 9);
+            } else if (strncmp(opt, "lowerdir+=", 10) == 0) {
+                // Layers added one at a time with the new mount API.
+                if (*lowerdir == NULL) {
+                    *lowerdir = strdup(opt + 10);
+                } else if ((*lowerdir = realloc(*lowerdir, strlen(*lowerdir) + strlen(opt + 10) + 2)) != NULL) {
+                    strcat(strcat(*lowerdir, ":"), opt + 10);
+                }
+            } else if (strncmp(opt, "upperdir=", 9) == 0) {
+                free(*upperdir);
+                *upperdir = strdup(opt + 9);
+            }
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    if (*lowerdir == NULL ||
+        *upperdir == NULL) {
+        ret = EOF;
+    }
+    return ret;
+}
+
+/**
+ * Return the cached tree of `relpath` in the image identified by `lowerdir`,
+ * moving it to the front of the cache, or NULL if it is not cached.
+ *
+ * @param lowerdir
+ * @param relpath
+ * @return
+ */
+static struct argusshare_tree *find_shared_tree(const char *const lowerdir, const char *const relpath) {
+    struct argusshare_tree **prev, *tree;
+    for (prev = &trees_; (tree = *prev) != NULL; prev = &tree->next) {
+        if (strcmp(tree->lowerdir, lowerdir) == 0 &&
+            strcmp(tree->relpath, relpath) == 0) {
+            *prev = tree->next;
+            tree->next = trees_;
+            trees_ = tree;
+            return tree;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Walk `relpath` in each image layer, topmost first, as overlayfs merges
+ * them, and cache the resulting directories. The least recently used tree
+ * is dropped once `SHARE_CACHE_MAX` are cached.
+ *
+ * @param lowerdir
+ * @param relpath
+ * @return
+ */
+static struct argusshare_tree *walk_lower_layers(const char *const lowerdir, const char *const relpath) {
+    struct argusshare_tree *tree, **prev;
+    char *layers, *layer, *saveptr;
+    int i, stop = 0;
+
+    hides_ = NULL;
+    hidec_ = 0;
+    dirs_ = NULL;
+    dirc_ = 0;
+    layers = strdup(lowerdir);
+    for (layer = strtok_r(layers, ":", &saveptr); layer != NULL && !stop; layer = strtok_r(NULL, ":", &saveptr)) {
+        stop = walk_layer(layer, relpath);
+        // Whiteouts and opaque directories of this layer apply to the layers
+        // below it.
+        for (i = 0; i < layerhidec_; ++i) {
+            if (stop != EOF) {
+                add_hide(&hides_, &hidec_, layerhides_[i].path, layerhides_[i].childrenonly);
+            }
+            free(layerhides_[i].path);
+        }
+        free(layerhides_);
+        layerhides_ = NULL;
+        layerhidec_ = 0;
+    }
+    free(layers);
+    for (i = 0; i < hidec_; ++i) {
+        free(hides_[i].path);
+    }
+    free(hides_);
+    hides_ = NULL;
+    hidec_ = 0;
+
+    if (stop == EOF ||
+        (tree = calloc(1, sizeof(struct argusshare_tree))) == NULL) {
+        for (i = 0; i < dirc_; ++i) {
+            free(dirs_[i]);
+        }
+        free(dirs_);
+        return NULL;
+    }
+    sort_dirs(dirs_, &dirc_);
+    tree->lowerdir = strdup(lowerdir);
+    tree->relpath = strdup(relpath);
+    tree->dirs = dirs_;
+    tree->dirc = dirc_;
+    tree->next = trees_;
+    trees_ = tree;
+
+    if (++treec_ > SHARE_CACHE_MAX) {
+        for (prev = &trees_; (*prev)->next != NULL; prev = &(*prev)->next);
+        tree = *prev;
+        *prev = NULL;
+        for (i = 0; i < tree->dirc; ++i) {
+            free(tree->dirs[i]);
+        }
+        free(tree->dirs);
+        free(tree->lowerdir);
+        free(tree->relpath);
+        free(tree);
+        --treec_;
+    }
+    return trees_;
+}
+
+/**
+ * Walk `relpath` in one overlay layer (a host path), adding its directories
+ * to `dirs_` unless hidden by a higher layer, and its whiteouts and opaque
+ * directories to `layerhides_`. Returns 1 if `relpath` or one of its parents
+ * is whited out or opaque in this layer, so lower layers are not visible, 0
+ * otherwise, or -1 if the layer cannot be read or uses redirected
+ * directories.
+ *
+ * @param layer
+ * @param relpath
+ * @return
+ */
+static int walk_layer(const char *const layer, const char *const relpath) {
+    char path[PATH_MAX], value[2];
+    const char *p;
+    struct stat sb;
+
+    snprintf(path, sizeof(path), "%s%s", SHARE_HOST_ROOT, layer);
+    if (access(path, R_OK | X_OK) == EOF) {
+#if DEBUG
+        fprintf(stderr, "%s: layer '%s' is not reachable\n", __func__, path);
+#endif
+        return EOF;
+    }
+
+    // Parents of `relpath`, then `relpath` itself.
+    for (p = relpath; p != NULL && *p; p = strchr(p + 1, '/')) {
+        if (p == relpath) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s%s%.*s", SHARE_HOST_ROOT, layer, (int)(p - relpath), relpath);
+        if (lstat(path, &sb) == EOF) {
+            // Not in this layer.
+            return 0;
+        }
+        if (S_ISCHR(sb.st_mode) && sb.st_rdev == 0) {
+            return 1;
+        }
+        if (getxattr(path, "trusted.overlay.opaque", value, sizeof(value)) == 1 &&
+            value[0] == 'y') {
+            return 1;
+        }
+    }
+
+    snprintf(path, sizeof(path), "%s%s%s", SHARE_HOST_ROOT, layer, relpath);
+    if (lstat(path, &sb) == EOF) {
+        return 0;
+    }
+    if (S_ISCHR(sb.st_mode) && sb.st_rdev == 0) {
+        return 1;
+    }
+    layerlen_ = strlen(path);
+    redirect_ = false;
+    if (nftw(path, traverse_layer, 20, FTW_ACTIONRETVAL | FTW_PHYS) == EOF) {
+#if DEBUG
+        printf("nftw: %s: %s\n", path, strerror(errno));
+        fflush(stdout);
+#endif
+        return EOF;
+    }
+    if (redirect_) {
+        return EOF;
+    }
+    // An opaque `relpath` hides all of it in lower layers.
+    return layerhidec_ && layerhides_[0].path[0] == '\0' ? 1 : 0;
+}
+
+/**
+ * Function called by `nftw` for each entry of a layer.
+ *
+ * @param path
+ * @param sb
+ * @param tflag
+ * @param ftwbuf
+ * @return
+ */
+static int traverse_layer(const char *path, const struct stat *sb, int tflag, struct FTW *ftwbuf) {
+    const char *rel = path + layerlen_;
+    char value[2];
+
+    if (*rel == '/') {
+        ++rel;
+    }
+    if (*rel &&
+        is_hidden_path(hides_, hidec_, rel)) {
+        return FTW_SKIP_SUBTREE;
+    }
+    if (S_ISCHR(sb->st_mode) && sb->st_rdev == 0) {
+        // Whiteout; removed from the layers below.
+        add_hide(&layerhides_, &layerhidec_, rel, false);
+        return FTW_CONTINUE;
+    }
+    if (tflag != FTW_D) {
+        return FTW_CONTINUE;
+    }
+    if (getxattr(path, "trusted.overlay.redirect", NULL, 0) > 0) {
+        // Renamed directory whose contents still live in a lower layer.
+        redirect_ = true;
+        return FTW_STOP;
+    }
+    if (getxattr(path, "trusted.overlay.opaque", value, sizeof(value)) == 1 &&
+        value[0] == 'y') {
+        add_hide(&layerhides_, &layerhidec_, rel, true);
+    }
+    return add_dir(&dirs_, &dirc_, rel) == EOF ? FTW_STOP : FTW_CONTINUE;
+}
+
+/**
+ * Check if `path` is hidden by a whiteout or opaque directory in `hides`.
+ *
+ * @param hides
+ * @param hidec
+ * @param path
+ * @return
+ */
+static bool is_hidden_path(const struct argusshare_hide *const hides, const unsigned int hidec,
+    const char *const path) {
+    size_t len;
+    int i;
+    for (i = 0; i < hidec; ++i) {
+        len = strlen(hides[i].path);
+        if (len == 0) {
+            // Opaque root; everything below it is hidden.
+            if (*path) {
+                return true;
+            }
+            continue;
+        }
+        if (strncmp(path, hides[i].path, len) == 0 &&
+            (path[len] == '/' || (path[len] == '\0' && !hides[i].childrenonly))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static int add_dir(char ***dirs, unsigned int *dirc, const char *const path) {
+    char **d;
+    if (*dirc == 0 ||
+        (*dirc >= SHARE_DIRS_INC && (*dirc & (*dirc - 1)) == 0)) {
+        // Grow in powers of two.
+        if ((d = realloc(*dirs, (*dirc ? *dirc * 2 : SHARE_DIRS_INC) * sizeof(char *))) == NULL) {
+#if DEBUG
+            perror("realloc");
+#endif
+            return EOF;
+        }
+        *dirs = d;
+    }
+    (*dirs)[(*dirc)++] = strdup(path);
+    return 0;
+}
+
+static int add_hide(struct argusshare_hide **hides, unsigned int *hidec, const char *const path,
+    const bool childrenonly) {
+    struct argusshare_hide *h;
+    if ((h = realloc(*hides, (*hidec + 1) * sizeof(struct argusshare_hide))) == NULL) {
+#if DEBUG
+        perror("realloc");
+#endif
+        return EOF;
+    }
+    *hides = h;
+    (*hides)[*hidec].path = strdup(path);
+    (*hides)[*hidec].childrenonly = childrenonly;
+    ++(*hidec);
+    return 0;
+}
+
+static int compare_dirs(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+/**
+ * Sort `dirs` and drop duplicates (a directory present in several layers).
+ * Sorting also puts each directory before everything below it.
+ *
+ * @param dirs
+ * @param dirc
+ */
+static void sort_dirs(char **dirs, unsigned int *dirc) {
+    int i, j;
+    if (*dirc == 0) {
+        return;
+    }
+    qsort(dirs, *dirc, sizeof(char *), compare_dirs);
+    for (i = 1, j = 0; i < *dirc; ++i) {
+        if (strcmp(dirs[i], dirs[j]) == 0) {
+            free(dirs[i]);
+            continue;
+        }
+        dirs[++j] = dirs[i];
+    }
+    *dirc = j + 1;
+}
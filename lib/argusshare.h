@@ -0,0 +1,71 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUS_SHARE__
+#define __ARGUS_SHARE__
+
+#include <ftw.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+
+#include "argusutil.h"
+
+#ifndef SHARE_HOST_ROOT
+#define SHARE_HOST_ROOT "/proc/1/root" // Host filesystem, where overlay layer paths are resolved.
+#endif
+#define SHARE_CACHE_MAX 64             // Cached image trees kept before the oldest is dropped.
+#define SHARE_DIRS_INC 16              // Initial directory count of a listing.
+
+struct argusshare_hide {
+    char *path;                       // Relative path hidden from lower layers.
+    bool childrenonly;                // Opaque directory; only its children are hidden.
+};
+
+struct argusshare_tree {
+    char *lowerdir;                   // Overlay `lowerdir` option; identifies the image layers.
+    char *relpath;                    // Walked path, relative to the container root.
+    char **dirs;                      // Relative directory paths below `relpath`, sorted.
+    unsigned int dirc;
+    struct argusshare_tree *next;     // Next (older) cached tree.
+};
+
+struct argusshare_listing {
+    char **dirs;                      // Relative directory paths below a root path, sorted.
+    unsigned int dirc;
+};
+
+int get_shared_listing(int pid, const char *rootpath, struct argusshare_listing *listing);
+void free_shared_listing(struct argusshare_listing *listing);
+static int read_overlay_dirs(int pid, const char *relpath, char **lowerdir, char **upperdir);
+static struct argusshare_tree *find_shared_tree(const char *lowerdir, const char *relpath);
+static struct argusshare_tree *walk_lower_layers(const char *lowerdir, const char *relpath);
+static int walk_layer(const char *layer, const char *relpath);
+static int traverse_layer(const char *path, const struct stat *sb, int tflag, struct FTW *ftwbuf);
+static bool is_hidden_path(const struct argusshare_hide *hides, unsigned int hidec, const char *path);
+static int add_dir(char ***dirs, unsigned int *dirc, const char *path);
+static int add_hide(struct argusshare_hide **hides, unsigned int *hidec, const char *path, bool childrenonly);
+static int compare_dirs(const void *a, const void *b);
+static void sort_dirs(char **dirs, unsigned int *dirc);
+
+#endif
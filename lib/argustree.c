@@ -36,6 +36,10 @@
 
 #include "argustree.h"
 #include "arguscache.h"
+#include "arguschurn.h"
+#include "argusignore.h"
+#include "argussched.h"
+#include "argusshare.h"
 #include "argusutil.h"
 
 static struct arguswatch **watch_;
@@ -216,6 +220,7 @@ void find_replace_root_path(struct arguswatch **watch, const char *const path) {
     watch_ = watch;
     rootstat_ = rootstat;
     foundpath_[0] = '\0';
+    begin_background_work();
     if (nftw(procpath, traverse_root, 20, FTW_ACTIONRETVAL | FTW_PHYS) == EOF) {
 #if DEBUG
         printf("nftw: %s: %s (directory probably deleted before we could watch)\n",
@@ -223,6 +228,7 @@ void find_replace_root_path(struct arguswatch **watch, const char *const path) {
         fflush(stdout);
 #endif
     }
+    end_background_work();
 
     if (foundpath_[0] == '\0') {
 #if DEBUG
@@ -287,6 +293,35 @@ static bool should_ignore_path(const struct arguswatch *const watch, const char
     return true;
 }
 
+/**
+ * Returns the `inotify` mask a watch for `path` is added with: the subject's
+ * events plus those needed to keep the cache consistent.
+ *
+ * @param watch
+ * @param path
+ * @return
+ */
+uint32_t get_watch_mask(const struct arguswatch *const watch, const char *const path) {
+    // We need to watch certain events at all times for keeping a consistent
+    // view of the filesystem tree.
+    uint32_t flags = IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
+    if (watch->flags & AW_ONLYDIR) {
+        flags |= IN_ONLYDIR;
+    }
+    if (find_root_path(watch, path) != NULL) {
+        flags |= IN_MOVE_SELF;
+    }
+    if (watch->flags & AW_RECURSIVE) {
+        // Deletes count towards a directory's churn.
+        flags |= IN_DELETE;
+    }
+    if (watch->flags & AW_IGNOREFILE) {
+        // Catch `.argusignore` files being written, replaced or removed.
+        flags |= IN_CLOSE_WRITE | IN_DELETE;
+    }
+    return watch->event_mask | flags;
+}
+
 /**
  * Add `path` to the watch list of the `inotify` file descriptor. The process
  * is not recursive. Returns number of watches/cache entries added for this
@@ -298,7 +333,6 @@ static bool should_ignore_path(const struct arguswatch *const watch, const char
  */
 static int watch_path(struct arguswatch **watch, const char *const path) {
     int wd;
-    uint32_t flags;
 
     // Dont add non-directories unless directly specified by `rootpaths` and
     // `AW_ONLYDIR` flag is not set.
@@ -306,18 +340,8 @@ static int watch_path(struct arguswatch **watch, const char *const path) {
         return 0;
     }
 
-    // We need to watch certain events at all times for keeping a consistent
-    // view of the filesystem tree.
-    flags = IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF;
-    if ((*watch)->flags & AW_ONLYDIR) {
-        flags |= IN_ONLYDIR;
-    }
-    if (find_root_path(*watch, path) != NULL) {
-        flags |= IN_MOVE_SELF;
-    }
-
     // Make directories for events.
-    if ((wd = inotify_add_watch((*watch)->fd, path, (*watch)->event_mask | flags)) == EOF) {
+    if ((wd = inotify_add_watch((*watch)->fd, path, get_watch_mask(*watch, path))) == EOF) {
         // By the time we come to create a watch, the directory might already
         // have been deleted or renamed, in which case we'll get an ENOENT
         // error. Log the error, but carry on execution. Other errors are
@@ -345,6 +369,15 @@ static int watch_path(struct arguswatch **watch, const char *const path) {
     }
     (*watch)->wd[(*watch)->pathc] = wd;
 
+    if (((*watch)->ino = realloc((*watch)->ino, ((*watch)->pathc + 1) * sizeof(ino_t))) == NULL) {
+#if DEBUG
+        perror("realloc");
+#endif
+        return -1;
+    }
+    // Filled in from fdinfo by the next `check_cache_consistency`.
+    (*watch)->ino[(*watch)->pathc] = 0;
+
     if (((*watch)->paths = realloc((*watch)->paths, ((*watch)->pathc + 1) * sizeof(char *))) == NULL) {
 #if DEBUG
         perror("realloc");
@@ -357,7 +390,7 @@ static int watch_path(struct arguswatch **watch, const char *const path) {
 
     ++(*watch)->pathc;
 
-    return 0;
+    return add_path_to_index(watch, (*watch)->pathc - 1);
 }
 
 /**
@@ -385,6 +418,21 @@ int traverse_tree(const char *path, const struct stat *sb, int tflag, struct FTW
             return FTW_SKIP_SUBTREE;
         }
     }
+    // Stop recursing subtree if below a directory demoted for churn.
+    if ((*watch_)->demotedc &&
+        is_demoted_path(*watch_, path)) {
+        return FTW_SKIP_SUBTREE;
+    }
+    // Stop recursing subtree if path matches a `.argusignore` rule.
+    if ((*watch_)->flags & AW_IGNOREFILE) {
+        if (match_ignore_files(*watch_, path, tflag == FTW_D)) {
+            return FTW_SKIP_SUBTREE;
+        }
+        // Compile this directory's rules before `nftw` descends into it.
+        if (tflag == FTW_D) {
+            load_ignore_file(watch_, path);
+        }
+    }
     // Stop recursing siblings if reached max depth.
     if ((*watch_)->max_depth &&
         ftwbuf->level + 1 > (*watch_)->max_depth) {
@@ -424,6 +472,91 @@ static int watch_path_recursive(struct arguswatch **watch, const char *const pat
     return (*watch)->pathc;
 }
 
+/**
+ * Add `path` and its subdirectories to the watch list from the node-level
+ * listing of the container image shared between replicas, instead of walking
+ * the tree with `nftw`. The same filters as `traverse_tree` are applied.
+ * Returns -1 if no shared listing is available for `path`.
+ *
+ * @param watch
+ * @param path
+ * @return
+ */
+static int watch_path_shared(struct arguswatch **watch, const char *const path) {
+    struct argusshare_listing listing;
+    char fullpath[PATH_MAX], **skipped = NULL, **s;
+    const char *rel, *base;
+    size_t len;
+    int i, j, level, skippedc = 0;
+
+    if (get_shared_listing((*watch)->pid, path, &listing) == EOF) {
+        return EOF;
+    }
+#if DEBUG
+    printf("  watch_path_shared: %s: %d directories\n", path, listing.dirc);
+    fflush(stdout);
+#endif
+
+    for (i = 0; i < listing.dirc; ++i) {
+        rel = listing.dirs[i];
+        // Skip below directories skipped earlier; the listing is sorted so
+        // they come before their children.
+        for (j = 0; j < skippedc; ++j) {
+            len = strlen(skipped[j]);
+            if (strncmp(rel, skipped[j], len) == 0 &&
+                rel[len] == '/') {
+                break;
+            }
+        }
+        if (j < skippedc) {
+            continue;
+        }
+
+        if (*rel) {
+            FORMAT_PATH(fullpath, path, rel);
+        } else {
+            snprintf(fullpath, sizeof(fullpath), "%s", path);
+        }
+        base = strrchr(fullpath, '/') + 1;
+        for (level = 0, j = 0; *rel && rel[j]; ++j) {
+            level += rel[j] == '/';
+        }
+        level += *rel ? 1 : 0;
+
+        // Stop recursing subtree if below max depth, in ignores list, below a
+        // directory demoted for churn, or matches a `.argusignore` rule.
+        if ((*watch)->max_depth &&
+            level + 1 > (*watch)->max_depth) {
+            continue;
+        }
+        for (j = 0; j < (*watch)->ignorec; ++j) {
+            if (strcmp(base, (*watch)->ignores[j]) == 0) {
+                break;
+            }
+        }
+        if (j < (*watch)->ignorec ||
+            ((*watch)->demotedc && is_demoted_path(*watch, fullpath)) ||
+            (((*watch)->flags & AW_IGNOREFILE) && match_ignore_files(*watch, fullpath, true))) {
+            if ((s = realloc(skipped, (skippedc + 1) * sizeof(char *))) != NULL) {
+                skipped = s;
+                skipped[skippedc++] = (char *)rel;
+            }
+            continue;
+        }
+        if ((*watch)->flags & AW_IGNOREFILE) {
+            load_ignore_file(watch, fullpath);
+        }
+
+        if (watch_path(watch, fullpath) == EOF) {
+            break;
+        }
+    }
+
+    free(skipped);
+    free_shared_listing(&listing);
+    return (*watch)->pathc;
+}
+
 /**
  * Add watches and cache entries for a subtree, logging a message noting the
  * number entries added.
@@ -432,9 +565,13 @@ static int watch_path_recursive(struct arguswatch **watch, const char *const pat
  */
 void watch_subtree(struct arguswatch **watch) {
     int i;
+    begin_background_work();
     for (i = 0; i < (*watch)->rootpathc; ++i) {
         if ((*watch)->flags & AW_RECURSIVE) {
-            watch_path_recursive(watch, (*watch)->rootpaths[i]);
+            if (!((*watch)->flags & AW_SHARETREE) ||
+                watch_path_shared(watch, (*watch)->rootpaths[i]) == EOF) {
+                watch_path_recursive(watch, (*watch)->rootpaths[i]);
+            }
         } else {
             watch_path(watch, (*watch)->rootpaths[i]);
         }
@@ -444,6 +581,7 @@ void watch_subtree(struct arguswatch **watch) {
         fflush(stdout);
 #endif
     }
+    end_background_work();
 }
 
 /**
@@ -479,8 +617,11 @@ void rewrite_cached_paths(struct arguswatch **watch, const char *const oldpathpf
             (*watch)->paths[i][len] == '\0')) {
 
             FORMAT_PATH(newpath, newpf, &(*watch)->paths[i][len]);
+            // Re-key the path index under the new name.
+            remove_path_from_index(watch, i);
             free((*watch)->paths[i]);
             (*watch)->paths[i] = strdup(newpath);
+            add_path_to_index(watch, i);
 #if DEBUG
             printf("    wd %d => %s\n", (*watch)->wd[i], newpath);
             fflush(stdout);
@@ -500,7 +641,8 @@ void rewrite_cached_paths(struct arguswatch **watch, const char *const oldpathpf
  */
 int remove_subtree(struct arguswatch **watch, const char *const path) {
     size_t len = strlen(path);
-    int i, cnt = 0;
+    int i, j, cnt = 0;
+    bool failed = false;
     // The argument we receive might be a pointer to a path string that is
     // actually stored in the cache. If we remove that path part way through
     // scanning the whole cache then chaos ensues; so, create a temporary copy.
@@ -511,8 +653,9 @@ int remove_subtree(struct arguswatch **watch, const char *const path) {
     fflush(stdout);
 #endif
 
-    for (i = 0; i < (*watch)->pathc; ++i) {
-        if (strncmp(pn, (*watch)->paths[i], len) == 0 &&
+    for (i = 0, j = 0; i < (*watch)->pathc; ++i) {
+        if (!failed &&
+            strncmp(pn, (*watch)->paths[i], len) == 0 &&
             ((*watch)->paths[i][len] == '/' ||
             (*watch)->paths[i][len] == '\0')) {
 #if DEBUG
@@ -530,16 +673,93 @@ int remove_subtree(struct arguswatch **watch, const char *const path) {
 
                 // When we have multiple renamers, sometimes
                 // `inotify_rm_watch` fails. In this case, force a cache
-                // rebuild by returning -1.
-                cnt = -1;
-                break;
+                // rebuild by returning -1; the remaining entries are kept
+                // for the rebuild to free.
+                failed = true;
+            } else {
+                // Events already queued for it are skipped, not taken as a
+                // sign the cache is inconsistent.
+                retire_wd(watch, (*watch)->wd[i]);
+                free((*watch)->paths[i]);
+                ++cnt;
+                continue;
             }
+        }
+        (*watch)->wd[j] = (*watch)->wd[i];
+        (*watch)->ino[j] = (*watch)->ino[i];
+        (*watch)->paths[j] = (*watch)->paths[i];
+        ++j;
+    }
+    (*watch)->pathc = j;
+    if (cnt) {
+        rebuild_path_index(watch);
+    }
 
-            mark_cache_slot_empty(i);
+    free(pn);
+    return failed ? -1 : cnt;
+}
+
+/**
+ * Remove watches and cache entries for everything below directory `path`,
+ * keeping the watch on `path` itself. Returns number of entries removed.
+ *
+ * @param watch
+ * @param path
+ * @return
+ */
+int remove_child_watches(struct arguswatch **watch, const char *const path) {
+    size_t len = strlen(path);
+    int i, j, cnt = 0;
+    // `path` might point at a string stored in the cache.
+    char *pn = strdup(path);
+
+    for (i = 0, j = 0; i < (*watch)->pathc; ++i) {
+        if (strncmp(pn, (*watch)->paths[i], len) == 0 &&
+            (*watch)->paths[i][len] == '/') {
+#if DEBUG
+            printf("  removing watch: wd = %d (%s)\n",
+                (*watch)->wd[i], (*watch)->paths[i]);
+            fflush(stdout);
+#endif
+            if (inotify_rm_watch((*watch)->fd, (*watch)->wd[i]) == EOF) {
+#if DEBUG
+                printf("    inotify_rm_watch wd = %d (%s): %s\n", (*watch)->wd[i],
+                    (*watch)->paths[i], strerror(errno));
+                fflush(stdout);
+#endif
+            }
+            retire_wd(watch, (*watch)->wd[i]);
+            free((*watch)->paths[i]);
             ++cnt;
+            continue;
         }
+        (*watch)->wd[j] = (*watch)->wd[i];
+        (*watch)->ino[j] = (*watch)->ino[i];
+        (*watch)->paths[j] = (*watch)->paths[i];
+        ++j;
+    }
+    (*watch)->pathc = j;
+    if (cnt) {
+        rebuild_path_index(watch);
     }
 
     free(pn);
     return cnt;
 }
+
+/**
+ * Drop all cache entries and walk the root paths again. Existing watches are
+ * kept by the kernel; `inotify_add_watch` returns the same watch descriptor
+ * for a path that is already watched.
+ *
+ * @param watch
+ */
+void rewatch_tree(struct arguswatch **watch) {
+    int i;
+    for (i = 0; i < (*watch)->pathc; ++i) {
+        free((*watch)->paths[i]);
+    }
+    (*watch)->pathc = 0;
+    rebuild_path_index(watch);
+    watch_subtree(watch);
+}
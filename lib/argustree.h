@@ -25,6 +25,8 @@
 #ifndef __ARGUS_TREE__
 #define __ARGUS_TREE__
 
+#include <ftw.h>
+
 #include "argusutil.h"
 
 void validate_root_paths(struct arguswatch *watch);
@@ -34,12 +36,16 @@ void remove_root_path(struct arguswatch **watch, const char *path);
 int traverse_root(const char *path, const struct stat *sb, int tflag, struct FTW *ftwbuf);
 void find_replace_root_path(struct arguswatch **watch, const char *path);
 static bool should_ignore_path(const struct arguswatch *watch, const char *path);
+uint32_t get_watch_mask(const struct arguswatch *watch, const char *path);
 static int watch_path(struct arguswatch **watch, const char *path);
 int traverse_tree(const char *path, const struct stat *sb, int tflag, struct FTW *ftwbuf);
 static int watch_path_recursive(struct arguswatch **watch, const char *path);
+static int watch_path_shared(struct arguswatch **watch, const char *path);
 void watch_subtree(struct arguswatch **watch);
 void rewrite_cached_paths(struct arguswatch **watch, const char *oldpathpf, const char *oldname,
     const char *newpathpf, const char *newname);
 int remove_subtree(struct arguswatch **watch, const char *path);
+int remove_child_watches(struct arguswatch **watch, const char *path);
+void rewatch_tree(struct arguswatch **watch);
 
 #endif
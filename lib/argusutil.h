@@ -35,9 +35,19 @@
 #define DEBUG 0
 #endif
 
-#define AW_ONLYDIR   0x00000001
-#define AW_RECURSIVE 0x00000002
-#define AW_FOLLOW    0x00000004
+#define AW_ONLYDIR    0x00000001
+#define AW_RECURSIVE  0x00000002
+#define AW_FOLLOW     0x00000004
+#define AW_IGNOREFILE 0x00000008
+#define AW_SHARETREE  0x00000010
+#define AW_DIFF       0x00000020 // Not used by the lib; read by the log function.
+#define AW_MANIFEST   0x00000040 // Not used by the lib; read by the log function.
+
+// Pseudo events reported through `arguswatch_logfn`; `inotify` never sets
+// these bits in an event mask.
+#define AW_DEMOTE     0x00100000
+#define AW_PROMOTE    0x00200000
+#define AW_READY      0x00400000
 
 #define IN_EVENT_LEN (sizeof(struct inotify_event))
 #define IN_BUFFER_SIZE (IN_EVENT_LEN + NAME_MAX + 1)
@@ -63,8 +73,8 @@
     }                                                                                    \
     printf("    $$   pathc = %d\n", (watch)->pathc);                                     \
     for (int i = 0; i < (watch)->pathc; ++i) {                                           \
-        printf("     $     [%d] wd = %d; path = %s\n", i, (watch)->wd[i],                \
-            (watch)->paths[i]);                                                          \
+        printf("     $     [%d] wd = %d; ino = %lu; path = %s\n", i, (watch)->wd[i],     \
+            (unsigned long)(watch)->ino[i], (watch)->paths[i]);                          \
     }                                                                                    \
     printf("    $$   event_mask = %d\n", (watch)->event_mask);                           \
     printf("    $$   only_dir = %d\n", ((watch)->flags & AW_ONLYDIR));                   \
@@ -73,6 +83,10 @@
         printf("    $$     max_depth = %d\n", (watch)->max_depth);                       \
     }                                                                                    \
     printf("    $$   follow_move = %d\n", ((watch)->flags & AW_FOLLOW));                 \
+    printf("    $$   ignore_file = %d\n", ((watch)->flags & AW_IGNOREFILE));             \
+    printf("    $$   share_tree = %d\n", ((watch)->flags & AW_SHARETREE));              \
+    printf("    $$   diff = %d\n", ((watch)->flags & AW_DIFF));                         \
+    printf("    $$   manifest = %d\n", ((watch)->flags & AW_MANIFEST));                 \
     fflush(stdout);                                                                      \
 } while(0)
 
@@ -84,12 +98,22 @@ struct arguswatch {
     const char *log_format;           // Custom logging format for printing ArgusWatcher event.
     char **rootpaths;                 // Cached path name(s).
     char **ignores;                   // Ignore path patterns.
+    struct argusignore *ignorefiles;  // Rules loaded from `.argusignore` files found in the tree.
+    struct arguschurn *churn;         // Create/delete churn of recently active directories.
     char **paths;                     // Cached path name(s), including recursive traversal.
     int *wd;                          // Array of watch descriptors (-1 if slot unused).
+    ino_t *ino;                       // Inode of each watch as the kernel lists it (0 until first checked).
+    int *pathidx;                     // Hash index of `paths` to their cache slot (-1 if bucket unused).
+    int *retiredwd;                   // Watch descriptors removed from the cache whose IN_IGNORED is still due.
     struct stat *rootstat;            // `stat` structures for root directories.
     unsigned int rootpathc;           // Cached path count.
     unsigned int ignorec;             // Ignore path pattern count.
+    unsigned int ignorefilec;         // Loaded `.argusignore` file count.
+    unsigned int churnc, demotedc;    // Tracked directory count, demoted directory count.
     unsigned int pathc;               // Cached path count, including recursive traversal.
+    unsigned int pathidxc;            // Bucket count of `pathidx`; always a power of two.
+    unsigned int retiredc, retirednext; // Entries used in `retiredwd`, next entry to overwrite when full.
+    unsigned int gen;                 // Generation of `fd`; bumped each time the cache is rebuilt on a new fd.
     uint32_t event_mask;              // Event mask for `inotify`.
     uint32_t flags;                   // Flags for ArgusWatcher.
     int pid, sid, slot;               // PID, Subject ID, `wlcache` slot.
@@ -99,8 +123,10 @@ struct arguswatch {
 
 struct arguswatch_event {
     struct arguswatch *watch;
+    struct arguswatch_buffer *buffer; // Read buffer `path_name`, `file_name` point into; see `ref_buffer`.
     const char *path_name, *file_name;
     uint32_t event_mask;
+    unsigned int count;               // Events summarized by an AW_DEMOTE/AW_PROMOTE report.
     bool is_dir;
 };
 
@@ -0,0 +1,318 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include "vmlinux.h"
+#include <bpf/bpf_core_read.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+
+#include "argus.bpf.h"
+
+// `inotify` event bits, which `vmlinux.h` does not carry.
+#define IN_ACCESS        0x00000001
+#define IN_MODIFY        0x00000002
+#define IN_ATTRIB        0x00000004
+#define IN_CLOSE_WRITE   0x00000008
+#define IN_CLOSE_NOWRITE 0x00000010
+#define IN_OPEN          0x00000020
+#define IN_MOVED_FROM    0x00000040
+#define IN_MOVED_TO      0x00000080
+#define IN_CREATE        0x00000100
+#define IN_DELETE        0x00000200
+#define IN_ISDIR         0x40000000
+
+#define MAY_WRITE        0x00000002
+#define MAY_READ         0x00000004
+#define FMODE_WRITE      0x00000002
+#define S_IFMT           00170000
+#define S_IFDIR          0040000
+
+#define PATH_MASK        (ARGUSBPF_PATH_MAX - 1)
+
+char LICENSE[] SEC("license") = "Dual MIT/GPL";
+
+// (cgroup, path prefix) -> subjects watching it.
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(max_entries, ARGUSBPF_MAX_TARGETS);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, struct argusbpf_key);
+    __type(value, struct argusbpf_match);
+} targets SEC(".maps");
+
+// Cgroup ID -> union of the event masks watched in it; checked before any
+// path is built.
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(max_entries, ARGUSBPF_MAX_TARGETS);
+    __type(key, __u64);
+    __type(value, __u32);
+} cgroups SEC(".maps");
+
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, ARGUSBPF_RINGBUF_SIZE);
+} events SEC(".maps");
+
+// Events lost to a full ring buffer.
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, __u64);
+} dropped SEC(".maps");
+
+// Paths are built back to front in `buf`, which is twice as long as a path so
+// the verifier can bound every copy into it.
+struct scratch {
+    char buf[ARGUSBPF_PATH_MAX * 2];
+    struct argusbpf_key key;
+};
+
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __uint(max_entries, 1);
+    __type(key, __u32);
+    __type(value, struct scratch);
+} scratches SEC(".maps");
+
+__u32 move_cookie = 0;
+
+/**
+ * Find the watched cgroup the current task runs in: its own, or the closest
+ * ancestor registered by the loader, so processes in nested cgroups of a
+ * container match too. Returns 0 if none is watched for any bit of `mask`.
+ *
+ * @param mask
+ * @return
+ */
+static __always_inline __u64 watched_cgroup(const __u32 mask) {
+    __u64 id = bpf_get_current_cgroup_id();
+    __u32 *watched = bpf_map_lookup_elem(&cgroups, &id);
+    int level;
+
+    if (watched) {
+        return (*watched & mask) ? id : 0;
+    }
+    for (level = 1; level < ARGUSBPF_MAX_CGROUP_DEPTH; ++level) {
+        if (!(id = bpf_get_current_ancestor_cgroup_id(level))) {
+            return 0;
+        }
+        if ((watched = bpf_map_lookup_elem(&cgroups, &id))) {
+            return (*watched & mask) ? id : 0;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Write the path of `dentry`, relative to the root of its filesystem, to the
+ * end of the first half of `s->buf`. Returns the offset it starts at, or -1
+ * if it is longer than `ARGUSBPF_PATH_MAX` or `ARGUSBPF_MAX_DEPTH` levels.
+ *
+ * @param dentry
+ * @param s
+ * @return
+ */
+static __always_inline int build_path(struct dentry *dentry, struct scratch *s) {
+    struct dentry *parent;
+    const unsigned char *name;
+    __u32 off = ARGUSBPF_PATH_MAX, len;
+    int i;
+
+    for (i = 0; i < ARGUSBPF_MAX_DEPTH; ++i) {
+        parent = BPF_CORE_READ(dentry, d_parent);
+        if (parent == dentry) {
+            return off;
+        }
+        len = BPF_CORE_READ(dentry, d_name.len);
+        name = BPF_CORE_READ(dentry, d_name.name);
+        // Keep `off` above zero so every copy below is shorter than a path.
+        if (len + 1 >= off) {
+            return -1;
+        }
+        off -= len;
+        bpf_probe_read_kernel(&s->buf[off & PATH_MASK], len & PATH_MASK, name);
+        s->buf[--off & PATH_MASK] = '/';
+        dentry = parent;
+    }
+    return -1;
+}
+
+/**
+ * Report `mask` on `dentry` if the current task's cgroup and the dentry's
+ * path fall under a watched prefix.
+ *
+ * @param dentry
+ * @param mask
+ * @param cookie
+ * @param isdir
+ */
+static __always_inline void report(struct dentry *dentry, const __u32 mask, const __u32 cookie, const bool isdir) {
+    struct argusbpf_match *match;
+    struct argusbpf_event *event;
+    struct scratch *s;
+    __u64 cgroup, *lost;
+    __u32 zero = 0, len;
+    int off;
+
+    if (!(cgroup = watched_cgroup(mask)) ||
+        !(s = bpf_map_lookup_elem(&scratches, &zero)) ||
+        (off = build_path(dentry, s)) < 0) {
+        return;
+    }
+    len = ARGUSBPF_PATH_MAX - off;
+    s->key.prefixlen = (sizeof(s->key.cgroup) + len) * 8;
+    __builtin_memcpy(s->key.cgroup, &cgroup, sizeof(s->key.cgroup));
+    bpf_probe_read_kernel(s->key.path, len & PATH_MASK, &s->buf[off & PATH_MASK]);
+
+    if (!(match = bpf_map_lookup_elem(&targets, &s->key)) ||
+        !(match->mask & mask)) {
+        return;
+    }
+    // "/etc" is a prefix of "/etcd" in the trie, but not a parent of it.
+    if (match->pathlen < len &&
+        s->key.path[match->pathlen & PATH_MASK] != '/') {
+        return;
+    }
+
+    if (!(event = bpf_ringbuf_reserve(&events, sizeof(*event), 0))) {
+        if ((lost = bpf_map_lookup_elem(&dropped, &zero))) {
+            ++*lost;
+        }
+        return;
+    }
+    event->id = match->id;
+    event->mask = mask | (isdir ? IN_ISDIR : 0);
+    event->cookie = cookie;
+    event->pathlen = len;
+    bpf_probe_read_kernel(event->path, len & PATH_MASK, s->key.path);
+    bpf_ringbuf_submit(event, 0);
+}
+
+static __always_inline bool dentry_is_dir(struct dentry *dentry) {
+    struct inode *inode = BPF_CORE_READ(dentry, d_inode);
+    return inode && (BPF_CORE_READ(inode, i_mode) & S_IFMT) == S_IFDIR;
+}
+
+static __always_inline void report_file(struct file *file, const __u32 mask) {
+    struct dentry *dentry = BPF_CORE_READ(file, f_path.dentry);
+    report(dentry, mask, 0, dentry_is_dir(dentry));
+}
+
+// LSM hooks run before the operation, so each returns the verdict of the
+// hooks before it unchanged and reports nothing once one has denied it.
+
+SEC("lsm/inode_create")
+int BPF_PROG(argus_inode_create, struct inode *dir, struct dentry *dentry, umode_t mode, int ret) {
+    if (!ret) {
+        report(dentry, IN_CREATE, 0, false);
+    }
+    return ret;
+}
+
+SEC("lsm/inode_mkdir")
+int BPF_PROG(argus_inode_mkdir, struct inode *dir, struct dentry *dentry, umode_t mode, int ret) {
+    if (!ret) {
+        report(dentry, IN_CREATE, 0, true);
+    }
+    return ret;
+}
+
+SEC("lsm/inode_unlink")
+int BPF_PROG(argus_inode_unlink, struct inode *dir, struct dentry *dentry, int ret) {
+    if (!ret) {
+        report(dentry, IN_DELETE, 0, false);
+    }
+    return ret;
+}
+
+SEC("lsm/inode_rmdir")
+int BPF_PROG(argus_inode_rmdir, struct inode *dir, struct dentry *dentry, int ret) {
+    if (!ret) {
+        report(dentry, IN_DELETE, 0, true);
+    }
+    return ret;
+}
+
+SEC("lsm/inode_rename")
+int BPF_PROG(argus_inode_rename, struct inode *old_dir, struct dentry *old_dentry, struct inode *new_dir,
+    struct dentry *new_dentry, unsigned int flags, int ret) {
+
+    if (!ret) {
+        __u32 cookie = __sync_fetch_and_add(&move_cookie, 1) + 1;
+        bool isdir = dentry_is_dir(old_dentry);
+        report(old_dentry, IN_MOVED_FROM, cookie, isdir);
+        report(new_dentry, IN_MOVED_TO, cookie, isdir);
+    }
+    return ret;
+}
+
+// The `inode_setattr` hook takes an idmap since 6.8; `start_bpf_backend`
+// loads whichever of these two matches the running kernel. A `vmlinux.h`
+// from before 6.3 has no `struct mnt_idmap`.
+struct mnt_idmap;
+
+SEC("lsm/inode_setattr")
+int BPF_PROG(argus_inode_setattr, struct dentry *dentry, struct iattr *attr, int ret) {
+    if (!ret) {
+        report(dentry, IN_ATTRIB, 0, dentry_is_dir(dentry));
+    }
+    return ret;
+}
+
+SEC("lsm/inode_setattr")
+int BPF_PROG(argus_inode_setattr_idmap, struct mnt_idmap *idmap, struct dentry *dentry, struct iattr *attr, int ret) {
+    if (!ret) {
+        report(dentry, IN_ATTRIB, 0, dentry_is_dir(dentry));
+    }
+    return ret;
+}
+
+SEC("lsm/file_open")
+int BPF_PROG(argus_file_open, struct file *file, int ret) {
+    if (!ret) {
+        report_file(file, IN_OPEN);
+    }
+    return ret;
+}
+
+SEC("lsm/file_permission")
+int BPF_PROG(argus_file_permission, struct file *file, int mask, int ret) {
+    if (!ret) {
+        if (mask & MAY_WRITE) {
+            report_file(file, IN_MODIFY);
+        } else if (mask & MAY_READ) {
+            report_file(file, IN_ACCESS);
+        }
+    }
+    return ret;
+}
+
+SEC("lsm/file_free_security")
+int BPF_PROG(argus_file_free_security, struct file *file) {
+    report_file(file, (BPF_CORE_READ(file, f_mode) & FMODE_WRITE) ? IN_CLOSE_WRITE : IN_CLOSE_NOWRITE);
+    return 0;
+}
@@ -0,0 +1,65 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUS_BPF__
+#define __ARGUS_BPF__
+
+// Shared by the BPF programs, which get their types from `vmlinux.h`, and by
+// the loader in `argusbpf.c`.
+#ifndef __VMLINUX_H__
+#include <linux/types.h>
+#endif
+
+#define ARGUSBPF_PATH_MAX        256     // Bytes of path built per event; a power of two.
+#define ARGUSBPF_MAX_DEPTH       32      // Path components walked up from an event's dentry.
+#define ARGUSBPF_MAX_CGROUP_DEPTH 16     // Cgroup levels searched for a watched ancestor.
+#define ARGUSBPF_MAX_TARGETS     4096    // Watched (cgroup, path prefix) pairs.
+#define ARGUSBPF_RINGBUF_SIZE    (1 << 22)
+
+// Key of the `targets` LPM trie: the cgroup ID followed by a path relative to
+// the root of its filesystem, so one longest-prefix lookup matches both.
+struct argusbpf_key {
+    __u32 prefixlen;                  // Significant bits of `cgroup` and `path`.
+    __u32 cgroup[2];                  // Cgroup ID; two words so the key has no padding.
+    char path[ARGUSBPF_PATH_MAX];
+};
+
+// Value of the `targets` LPM trie.
+struct argusbpf_match {
+    __u32 mask;                       // Union of the event masks of subjects watching the prefix.
+    __u32 id;                         // Index of the prefix in the loader's table.
+    __u32 pathlen;                    // Length of the prefix path; a match must end on a `/`.
+};
+
+// Record written to the `events` ring buffer.
+struct argusbpf_event {
+    __u32 id;                         // `argusbpf_match.id` of the matched prefix.
+    __u32 mask;                       // `inotify` event bit, with IN_ISDIR for directories.
+    __u32 cookie;                     // Pairs IN_MOVED_FROM with IN_MOVED_TO.
+    __u32 pathlen;
+    char path[ARGUSBPF_PATH_MAX];     // Not NUL-terminated.
+};
+
+#endif
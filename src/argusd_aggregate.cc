@@ -0,0 +1,123 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <algorithm>
+
+#include "argusd_aggregate.h"
+#include "argusd_sched.h"
+
+namespace argusd {
+namespace {
+const size_t kMaxPending = 4096; // Distinct events held before new ones bypass aggregation.
+const std::chrono::milliseconds kMinFlushInterval(1);
+} // namespace
+
+/**
+ * @param window
+ * @param emit    Called with each (aggregated) event once its window closes.
+ */
+EventAggregator::EventAggregator(const std::chrono::milliseconds window, std::function<void(const WatchEvent &)> emit)
+    : window_(window), emit_(std::move(emit)) {
+    flusher_ = std::thread(&EventAggregator::flushLoop, this);
+}
+
+EventAggregator::~EventAggregator() {
+    {
+        std::lock_guard<std::mutex> lock(mux_);
+        done_ = true;
+    }
+    cv_.notify_one();
+    flusher_.join();
+}
+
+/**
+ * Hold `event` until its window closes, merging it into an identical event
+ * from another pod (or the same pod) already being held.
+ *
+ * @param event
+ */
+void EventAggregator::Add(WatchEvent &&event) {
+    std::string key;
+    key.reserve(event.watcherName.size() + event.path.size() + event.file.size() + event.event.size() + 3);
+    key.append(event.watcherName).append(1, '\0')
+        .append(event.path).append(1, '/').append(event.file).append(1, '\0')
+        .append(event.event);
+
+    std::unique_lock<std::mutex> lock(mux_);
+    auto it = pending_.find(key);
+    if (it != pending_.end()) {
+        auto &pods = it->second.event.podNames;
+        if (std::find(pods.cbegin(), pods.cend(), event.podNames.front()) == pods.cend()) {
+            pods.push_back(event.podNames.front());
+        }
+        ++it->second.event.count;
+        return;
+    }
+    if (pending_.size() >= kMaxPending) {
+        lock.unlock();
+        emit_(event);
+        return;
+    }
+    pending_.emplace(std::move(key), Pending{std::move(event), std::chrono::steady_clock::now(), nextSeq_++});
+}
+
+void EventAggregator::flushLoop() {
+    SetThreadName("argusd-aggr");
+    SetThreadRole(ThreadRole::kFormatter);
+    std::vector<std::pair<uint64_t, WatchEvent>> ready;
+    // A window under 4ms would otherwise make this a busy loop.
+    const auto interval = std::max<std::chrono::milliseconds>(window_ / 4, kMinFlushInterval);
+    std::unique_lock<std::mutex> lock(mux_);
+    for (bool done = false; !done;) {
+        cv_.wait_for(lock, interval);
+        // Everything still held is written out when stopping.
+        done = done_;
+
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = pending_.begin(); it != pending_.end();) {
+            if (done || now - it->second.first >= window_) {
+                ready.emplace_back(it->second.seq, std::move(it->second.event));
+                it = pending_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (ready.empty()) {
+            continue;
+        }
+        // Format and write without holding up `Add`, in the order the events
+        // were first seen (e.g. a file's CREATE before its DELETE), not the
+        // map's.
+        lock.unlock();
+        std::sort(ready.begin(), ready.end(), [](const auto &a, const auto &b) {
+            return a.first < b.first;
+        });
+        for (const auto &event : ready) {
+            emit_(event.second);
+        }
+        ready.clear();
+        lock.lock();
+    }
+}
+} // namespace argusd
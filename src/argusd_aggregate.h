@@ -0,0 +1,85 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUSD_AGGREGATE_H__
+#define __ARGUSD_AGGREGATE_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace argusd {
+/**
+ * A formatted-ready watcher event, detached from the `arguswatch` it came
+ * from. `podNames` holds more than one pod when replicas were aggregated.
+ */
+struct WatchEvent {
+    std::string watcherName, nodeName, tags, logFormat;
+    std::string event, path, file;
+    std::vector<std::string> podNames;
+    std::string diff;          // Unified diff of the file's content, if tracked.
+    uint32_t mask = 0;         // `inotify` mask the event was reported with.
+    unsigned int count = 1;
+    bool isDir = false;
+};
+
+/**
+ * Folds identical events (same watcher, container-relative path and event)
+ * from replicas on this node that occur within `window` into one event
+ * listing the pods it happened in and how many times.
+ */
+class EventAggregator final {
+public:
+    explicit EventAggregator(std::chrono::milliseconds window, std::function<void(const WatchEvent &)> emit);
+    ~EventAggregator();
+
+    void Add(WatchEvent &&event);
+
+private:
+    struct Pending {
+        WatchEvent event;
+        std::chrono::steady_clock::time_point first;
+        uint64_t seq;              // Order the event was first seen in.
+    };
+
+    void flushLoop();
+
+    std::unordered_map<std::string, Pending> pending_;
+    uint64_t nextSeq_ = 0;
+    std::chrono::milliseconds window_;
+    std::function<void(const WatchEvent &)> emit_;
+    std::condition_variable cv_;
+    std::mutex mux_;
+    std::thread flusher_;
+    bool done_ = false;
+};
+} // namespace argusd
+
+#endif
@@ -0,0 +1,305 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <regex>
+#include <sstream>
+
+#include <glog/logging.h>
+#include <grpc++/client_context.h>
+#include <grpc++/completion_queue.h>
+#include <grpc++/create_channel.h>
+#include <grpc++/security/credentials.h>
+#include <libcontainer/container_util.h>
+
+#include "argusd_cri.h"
+
+namespace argusd {
+namespace {
+const size_t kMaxCachedPids = 4096; // Cached containers before those that exited are dropped.
+
+/**
+ * Returns the PID of a container's init process from the verbose `info` of
+ * its `ContainerStatus` (`"pid": 1234`), or 0 if it is missing or out of
+ * range.
+ *
+ * @param json
+ * @return
+ */
+int findJsonPid(const std::string &json) {
+    static const std::regex kPid("\"pid\"\\s*:\\s*([0-9]+)");
+    std::smatch match;
+    if (!std::regex_search(json, match, kPid)) {
+        return 0;
+    }
+    const std::string digits = match[1];
+    errno = 0;
+    const long pid = strtol(digits.c_str(), nullptr, 10);
+    if (errno == ERANGE ||
+        pid > INT_MAX) {
+        return 0;
+    }
+    return static_cast<int>(pid);
+}
+
+/**
+ * Returns the start time of process `pid` in clock ticks since boot (field
+ * 22 of `/proc/[pid]/stat`), or 0 if it is not running.
+ *
+ * @param pid
+ * @return
+ */
+uint64_t readStartTime(int pid) {
+    std::ifstream fh("/proc/" + std::to_string(pid) + "/stat");
+    std::string stat;
+    if (!std::getline(fh, stat)) {
+        return 0;
+    }
+    // The command name may contain spaces and parentheses; fields after it
+    // start with the state (field 3).
+    auto pos = stat.rfind(')');
+    if (pos == std::string::npos) {
+        return 0;
+    }
+    std::istringstream fields(stat.substr(pos + 1));
+    std::string field;
+    for (int i = 3; i < 22 && fields >> field; ++i);
+    uint64_t startTime = 0;
+    fields >> startTime;
+    return startTime;
+}
+} // namespace
+
+/**
+ * `endpoint` is a gRPC target for the runtime's CRI socket, such as
+ * `unix:///run/containerd/containerd.sock`; an empty endpoint only probes
+ * cgroups. `timeout` bounds each batch of `ContainerStatus` calls.
+ *
+ * @param endpoint
+ * @param timeout
+ */
+ContainerResolver::ContainerResolver(const std::string &endpoint, std::chrono::milliseconds timeout) :
+    endpoint_(endpoint), timeout_(timeout) {}
+
+/**
+ * Creates the CRI client and asks the runtime for its version. The client is
+ * kept if the runtime doesn't answer, since gRPC reconnects once it is up;
+ * until then every container is probed.
+ *
+ * @return
+ */
+bool ContainerResolver::Connect() {
+    if (endpoint_.empty()) {
+        return false;
+    }
+    stub_ = runtime::v1::RuntimeService::NewStub(grpc::CreateChannel(endpoint_, grpc::InsecureChannelCredentials()));
+
+    grpc::ClientContext context;
+    context.set_deadline(std::chrono::system_clock::now() + timeout_);
+    runtime::v1::VersionRequest request;
+    runtime::v1::VersionResponse response;
+    request.set_version("v1");
+    auto status = stub_->Version(&context, request, &response);
+    if (!status.ok()) {
+        LOG(WARNING) << "Could not reach CRI runtime at " << endpoint_ << ": " << status.error_message();
+        return false;
+    }
+    LOG(INFO) << "Looking up containers with " << response.runtime_name() << " " << response.runtime_version()
+        << " (CRI " << response.runtime_api_version() << ") at " << endpoint_;
+    return true;
+}
+
+/**
+ * Returns the PID of each container in `cids`, in the same order, with 0 for
+ * containers that could not be found. Container IDs carry their runtime
+ * prefix, as in `runtime://id`.
+ *
+ * @param cids
+ * @return
+ */
+std::vector<int> ContainerResolver::Resolve(const std::vector<std::string> &cids) {
+    std::vector<int> pids(cids.size(), 0);
+    std::vector<std::string> ids, runtimes, missing;
+    {
+        std::lock_guard<std::mutex> lock(mux_);
+        for (size_t i = 0; i < cids.size(); ++i) {
+            std::string id = cids[i];
+            std::string runtime = clustergarage::container::Util::findContainerRuntime(id);
+            clustergarage::container::Util::eraseSubstr(id, runtime + "://");
+            ids.push_back(id);
+            runtimes.push_back(runtime);
+
+            auto it = pids_.find(id);
+            if (it != pids_.end() &&
+                isCachedPidLive(it->second)) {
+                pids[i] = it->second.pid;
+                continue;
+            }
+            if (it != pids_.end()) {
+                pids_.erase(it);
+            }
+            missing.push_back(id);
+        }
+    }
+    if (missing.empty()) {
+        return pids;
+    }
+
+    std::map<std::string, int> found;
+    if (stub_ != nullptr) {
+        lookupContainers(missing, found);
+    }
+    for (size_t i = 0; i < cids.size(); ++i) {
+        if (pids[i]) {
+            continue;
+        }
+        // A PID the runtime reports is only used if its process is visible
+        // here, as it is not without the host PID namespace.
+        auto it = found.find(ids[i]);
+        if (it != found.end() &&
+            cachePid(ids[i], it->second)) {
+            pids[i] = it->second;
+            continue;
+        }
+        ++fallbacks_;
+        pids[i] = probeContainer(ids[i], runtimes[i]);
+        if (pids[i]) {
+            cachePid(ids[i], pids[i]);
+        }
+    }
+    return pids;
+}
+
+/**
+ * Sends a `ContainerStatus` call for each of `ids` at once and waits for all
+ * of them; PIDs of the running containers are stored in `found`.
+ *
+ * @param ids
+ * @param found
+ */
+void ContainerResolver::lookupContainers(const std::vector<std::string> &ids, std::map<std::string, int> &found) {
+    struct Call {
+        grpc::ClientContext context;
+        runtime::v1::ContainerStatusResponse response;
+        grpc::Status status;
+        std::unique_ptr<grpc::ClientAsyncResponseReader<runtime::v1::ContainerStatusResponse>> reader;
+    };
+
+    grpc::CompletionQueue cq;
+    std::vector<std::unique_ptr<Call>> calls;
+    auto deadline = std::chrono::system_clock::now() + timeout_;
+    for (size_t i = 0; i < ids.size(); ++i) {
+        auto call = std::make_unique<Call>();
+        call->context.set_deadline(deadline);
+        runtime::v1::ContainerStatusRequest request;
+        request.set_container_id(ids[i]);
+        // The PID is only reported in the verbose `info`.
+        request.set_verbose(true);
+        call->reader = stub_->AsyncContainerStatus(&call->context, request, &cq);
+        call->reader->Finish(&call->response, &call->status, reinterpret_cast<void *>(i));
+        calls.push_back(std::move(call));
+    }
+    lookups_ += ids.size();
+
+    void *tag;
+    bool ok;
+    for (size_t n = 0; n < calls.size() && cq.Next(&tag, &ok); ++n) {
+        size_t i = reinterpret_cast<size_t>(tag);
+        const auto &call = calls[i];
+        if (!ok ||
+            !call->status.ok()) {
+            if (call->status.error_code() != grpc::StatusCode::NOT_FOUND) {
+                LOG_EVERY_N(WARNING, 100) << "CRI `ContainerStatus` failed for " << ids[i] << ": "
+                    << call->status.error_message();
+            }
+            continue;
+        }
+        if (call->response.status().state() != runtime::v1::CONTAINER_RUNNING) {
+            continue;
+        }
+        auto info = call->response.info().find("info");
+        if (info == call->response.info().end()) {
+            continue;
+        }
+        int pid = findJsonPid(info->second);
+        if (pid > 0) {
+            found[ids[i]] = pid;
+        }
+    }
+    cq.Shutdown();
+    while (cq.Next(&tag, &ok));
+}
+
+/**
+ * Finds the PID of a container from its cgroup or the runtime's pidfile.
+ *
+ * @param id
+ * @param runtime
+ * @return
+ */
+int ContainerResolver::probeContainer(const std::string &id, const std::string &runtime) const {
+    return clustergarage::container::Util::getPidForContainer(id, runtime);
+}
+
+/**
+ * A cached PID is still the container's while a process with that PID exists
+ * and started at the same time.
+ *
+ * @param cached
+ * @return
+ */
+bool ContainerResolver::isCachedPidLive(const CachedPid &cached) const {
+    return cached.startTime != 0 &&
+        readStartTime(cached.pid) == cached.startTime;
+}
+
+/**
+ * Caches `pid` for container `id`; returns false if no process with that PID
+ * is running.
+ *
+ * @param id
+ * @param pid
+ * @return
+ */
+bool ContainerResolver::cachePid(const std::string &id, int pid) {
+    CachedPid cached;
+    cached.pid = pid;
+    cached.startTime = readStartTime(pid);
+    if (!cached.startTime) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(mux_);
+    if (pids_.size() >= kMaxCachedPids) {
+        for (auto it = pids_.begin(); it != pids_.end();) {
+            it = isCachedPidLive(it->second) ? std::next(it) : pids_.erase(it);
+        }
+    }
+    pids_[id] = cached;
+    return true;
+}
+} // namespace argusd
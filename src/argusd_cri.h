@@ -0,0 +1,78 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUSD_CRI_H__
+#define __ARGUSD_CRI_H__
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <runtime/v1/api.grpc.pb.h>
+
+#include "argusd_stats.h"
+
+namespace argusd {
+/**
+ * Finds the PIDs of containers by asking the node's CRI runtime (containerd,
+ * cri-o) over its socket. All containers of a request are looked up with
+ * concurrent `ContainerStatus` calls, and PIDs are cached by container ID
+ * until their process exits. Containers the runtime can't answer for are
+ * found by probing cgroups and pidfiles with libcontainer, as before.
+ */
+class ContainerResolver final {
+public:
+    explicit ContainerResolver(const std::string &endpoint, std::chrono::milliseconds timeout);
+    ~ContainerResolver() = default;
+
+    bool Connect();
+    std::vector<int> Resolve(const std::vector<std::string> &cids);
+
+private:
+    struct CachedPid {
+        int pid = 0;
+        uint64_t startTime = 0; // Process start time from `/proc/[pid]/stat`, to detect PID reuse.
+    };
+
+    void lookupContainers(const std::vector<std::string> &ids, std::map<std::string, int> &found);
+    int probeContainer(const std::string &id, const std::string &runtime) const;
+    bool isCachedPidLive(const CachedPid &cached) const;
+    bool cachePid(const std::string &id, int pid);
+
+    std::string endpoint_;
+    std::chrono::milliseconds timeout_;
+    std::unique_ptr<runtime::v1::RuntimeService::Stub> stub_;
+    std::map<std::string, CachedPid> pids_; // Container ID -> PID.
+    std::mutex mux_;
+    std::atomic<uint64_t> &lookups_ = Stats::Get().Counter("cri_lookups");
+    std::atomic<uint64_t> &fallbacks_ = Stats::Get().Counter("cri_fallbacks");
+};
+} // namespace argusd
+
+#endif
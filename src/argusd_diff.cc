@@ -0,0 +1,471 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <linux/openat2.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "argusd_diff.h"
+#include "argusd_sched.h"
+
+namespace argusd {
+namespace {
+const size_t kMaxQueued = 1024;      // Events queued per shard before new ones skip the diff.
+const int kMaxEdits = 512;           // Line edits between versions before a diff is not worth reporting.
+const size_t kMaxDiffBytes = 4096;   // Diff output kept per event.
+const size_t kContextLines = 3;
+
+/**
+ * Open `fullPath` for reading without following symbolic links. Paths under
+ * `/proc/[pid]/root` are resolved inside that root (`RESOLVE_IN_ROOT`), so a
+ * link in the container can't point argusd at a file of the node. Kernels
+ * without `openat2` walk the path one component at a time with `O_NOFOLLOW`.
+ * Opens non-blocking, so a FIFO doesn't hang the caller.
+ *
+ * @param fullPath
+ * @return File descriptor, or -1.
+ */
+int openNoFollow(const std::string &fullPath) {
+    const int flags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+    // "/proc/[pid]/root" of the container, and the path inside it.
+    size_t rootEnd = std::string::npos;
+    if (fullPath.compare(0, 6, "/proc/") == 0) {
+        const size_t pidEnd = fullPath.find_first_not_of("0123456789", 6);
+        if (pidEnd != std::string::npos && pidEnd > 6 &&
+            fullPath.compare(pidEnd, 5, "/root") == 0 &&
+            (pidEnd + 5 == fullPath.size() || fullPath[pidEnd + 5] == '/')) {
+            rootEnd = pidEnd + 5;
+        }
+    }
+    if (rootEnd == std::string::npos) {
+        return open(fullPath.c_str(), flags | O_NOFOLLOW);
+    }
+
+    int dirfd = open(fullPath.substr(0, rootEnd).c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd == -1) {
+        return -1;
+    }
+    std::string relPath = fullPath.substr(rootEnd);
+    relPath.erase(0, relPath.find_first_not_of('/'));
+    if (relPath.empty()) {
+        close(dirfd);
+        errno = EISDIR;
+        return -1;
+    }
+
+    struct open_how how;
+    memset(&how, 0, sizeof(how));
+    how.flags = flags;
+    how.resolve = RESOLVE_IN_ROOT | RESOLVE_NO_SYMLINKS | RESOLVE_NO_MAGICLINKS;
+    int fd = syscall(SYS_openat2, dirfd, relPath.c_str(), &how, sizeof(how));
+    if (fd != -1 ||
+        errno != ENOSYS) {
+        close(dirfd);
+        return fd;
+    }
+
+    // No `openat2` (before 5.6): descend with `O_NOFOLLOW` and refuse "..".
+    std::stringstream ss(relPath);
+    std::string component, next;
+    std::getline(ss, component, '/');
+    while (std::getline(ss, next, '/')) {
+        if (component.empty() || component == ".") {
+            component = next;
+            continue;
+        }
+        if (component == "..") {
+            close(dirfd);
+            errno = EXDEV;
+            return -1;
+        }
+        const int subfd = openat(dirfd, component.c_str(), O_PATH | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        close(dirfd);
+        if (subfd == -1) {
+            return -1;
+        }
+        dirfd = subfd;
+        component = next;
+    }
+    fd = component.empty() || component == "." || component == ".." ? -1 :
+        openat(dirfd, component.c_str(), flags | O_NOFOLLOW);
+    close(dirfd);
+    return fd;
+}
+
+enum class Edit {
+    kKeep,
+    kDelete,
+    kInsert,
+};
+
+std::vector<std::string> splitLines(const std::string &text) {
+    std::vector<std::string> lines;
+    std::istringstream in(text);
+    std::string line;
+    while (std::getline(in, line)) {
+        lines.push_back(line);
+    }
+    return lines;
+}
+
+/**
+ * Myers' O(ND) shortest edit script between line sequences `a` and `b`.
+ * Only the reachable diagonals of each step are kept, so memory grows with
+ * the square of the edit distance, which is bounded by `kMaxEdits`.
+ *
+ * @param a
+ * @param b
+ * @param script Filled with one edit per line of `a` and `b`, in order.
+ * @return False if the versions differ by more than `kMaxEdits` lines.
+ */
+bool editScript(const std::vector<std::string> &a, const std::vector<std::string> &b, std::vector<Edit> &script) {
+    const int n = a.size(), m = b.size();
+    std::vector<std::vector<int>> trace; // trace[d][k + d]: furthest x on diagonal k after d edits.
+    int d = 0;
+    for (bool found = false; !found; ++d) {
+        if (d > kMaxEdits) {
+            return false;
+        }
+        std::vector<int> v(2 * d + 1);
+        for (int k = -d; k <= d; k += 2) {
+            int x;
+            if (d == 0) {
+                x = 0;
+            } else if (k == -d ||
+                (k != d && trace[d - 1][k - 1 + d - 1] < trace[d - 1][k + 1 + d - 1])) {
+                x = trace[d - 1][k + 1 + d - 1];
+            } else {
+                x = trace[d - 1][k - 1 + d - 1] + 1;
+            }
+            int y = x - k;
+            while (x < n && y < m && a[x] == b[y]) {
+                ++x;
+                ++y;
+            }
+            v[k + d] = x;
+            if (x >= n && y >= m) {
+                found = true;
+                break;
+            }
+        }
+        trace.push_back(std::move(v));
+    }
+
+    // Walk back from the end to recover the edits.
+    int x = n, y = m;
+    for (d = trace.size() - 1; d >= 0; --d) {
+        const int k = x - y;
+        int prevK = 0, prevX = 0, prevY = 0;
+        if (d > 0) {
+            const auto &prev = trace[d - 1];
+            prevK = (k == -d || (k != d && prev[k - 1 + d - 1] < prev[k + 1 + d - 1])) ? k + 1 : k - 1;
+            prevX = prev[prevK + d - 1];
+            prevY = prevX - prevK;
+        }
+        while (x > prevX && y > prevY) {
+            script.push_back(Edit::kKeep);
+            --x;
+            --y;
+        }
+        if (d > 0) {
+            script.push_back(prevK == k + 1 ? Edit::kInsert : Edit::kDelete);
+            x = prevX;
+            y = prevY;
+        }
+    }
+    std::reverse(script.begin(), script.end());
+    return true;
+}
+} // namespace
+
+/**
+ * Render the changes from `before` to `after` as a unified diff with three
+ * lines of context, truncated to `kMaxDiffBytes`.
+ *
+ * @param before
+ * @param after
+ * @param label  File name used in the `---`/`+++` header.
+ * @return Empty if the contents have the same lines.
+ */
+std::string UnifiedDiff(const std::string &before, const std::string &after, const std::string &label) {
+    const auto a = splitLines(before), b = splitLines(after);
+    std::vector<Edit> script;
+    if (!editScript(a, b, script)) {
+        return "--- " + label + "\n+++ " + label + "\n(more than " + std::to_string(kMaxEdits) + " lines changed)\n";
+    }
+    if (std::all_of(script.cbegin(), script.cend(), [](const Edit edit) { return edit == Edit::kKeep; })) {
+        return "";
+    }
+
+    // Line numbers in `a` and `b` before each edit.
+    std::vector<std::pair<size_t, size_t>> pos(script.size() + 1);
+    for (size_t i = 0; i < script.size(); ++i) {
+        pos[i + 1] = pos[i];
+        if (script[i] != Edit::kInsert) {
+            ++pos[i + 1].first;
+        }
+        if (script[i] != Edit::kDelete) {
+            ++pos[i + 1].second;
+        }
+    }
+
+    std::string out = "--- " + label + "\n+++ " + label + "\n";
+    for (size_t i = 0; i < script.size();) {
+        if (script[i] == Edit::kKeep) {
+            ++i;
+            continue;
+        }
+        // Extend the hunk over changes separated by at most twice the context.
+        const size_t start = i - std::min(i, kContextLines);
+        size_t end = i + 1, keeps = 0;
+        for (size_t j = i + 1; j < script.size(); ++j) {
+            if (script[j] != Edit::kKeep) {
+                keeps = 0;
+                end = j + 1;
+            } else if (++keeps > 2 * kContextLines) {
+                break;
+            }
+        }
+        const size_t stop = std::min(script.size(), end + kContextLines);
+        const size_t oldLen = pos[stop].first - pos[start].first, newLen = pos[stop].second - pos[start].second;
+        out += "@@ -" + std::to_string(oldLen ? pos[start].first + 1 : pos[start].first) + "," + std::to_string(oldLen) +
+            " +" + std::to_string(newLen ? pos[start].second + 1 : pos[start].second) + "," + std::to_string(newLen) + " @@\n";
+        for (size_t j = start; j < stop; ++j) {
+            switch (script[j]) {
+            case Edit::kKeep:   out += " " + a[pos[j].first] + "\n"; break;
+            case Edit::kDelete: out += "-" + a[pos[j].first] + "\n"; break;
+            case Edit::kInsert: out += "+" + b[pos[j].second] + "\n"; break;
+            }
+        }
+        if (out.size() > kMaxDiffBytes) {
+            out.resize(kMaxDiffBytes);
+            out += "\n(diff truncated)\n";
+            break;
+        }
+        i = stop;
+    }
+    return out;
+}
+
+/**
+ * @param threads      Diff threads; events for one file always use the same one.
+ * @param cacheBytes   Bytes of distinct file contents kept.
+ * @param maxFileBytes Larger files are not cached or diffed.
+ * @param emit         Called with each event once its diff (if any) is attached.
+ */
+ContentDiffer::ContentDiffer(const unsigned int threads, const size_t cacheBytes, const size_t maxFileBytes,
+    std::function<void(const WatchEvent &)> emit)
+    : emit_(std::move(emit)), cacheBytes_(cacheBytes), maxFileBytes_(maxFileBytes) {
+    for (unsigned int i = 0; i < std::max(threads, 1u); ++i) {
+        shards_.push_back(std::make_unique<Shard>());
+    }
+    for (auto &shard : shards_) {
+        shard->thread = std::thread(&ContentDiffer::diffLoop, this, std::ref(*shard));
+        SetThreadName("argusd-diff", shard->thread.native_handle());
+        SetThreadRole(ThreadRole::kFormatter, shard->thread.native_handle());
+    }
+}
+
+ContentDiffer::~ContentDiffer() {
+    for (auto &shard : shards_) {
+        {
+            std::lock_guard<std::mutex> lock(shard->mux);
+            shard->done = true;
+        }
+        shard->cv.notify_one();
+        shard->thread.join();
+    }
+}
+
+/**
+ * Queue a write event on `fullPath` to be diffed against the file's last
+ * content, then emitted.
+ *
+ * @param event
+ * @param fullPath Path readable by argusd (under `/proc/[pid]/root`).
+ */
+void ContentDiffer::Submit(WatchEvent &&event, std::string fullPath) {
+    auto &shard = *shards_[std::hash<std::string>()(fullPath) % shards_.size()];
+    std::unique_lock<std::mutex> lock(shard.mux);
+    if (shard.jobs.size() >= kMaxQueued) {
+        lock.unlock();
+        emit_(event);
+        return;
+    }
+    shard.jobs.push_back(Job{std::move(event), std::move(fullPath)});
+    lock.unlock();
+    shard.cv.notify_one();
+}
+
+void ContentDiffer::diffLoop(Shard &shard) {
+    std::unique_lock<std::mutex> lock(shard.mux);
+    for (;;) {
+        shard.cv.wait(lock, [&] { return shard.done || !shard.jobs.empty(); });
+        if (shard.jobs.empty()) {
+            return;
+        }
+        Job job = std::move(shard.jobs.front());
+        shard.jobs.pop_front();
+        lock.unlock();
+        diffFile(job);
+        emit_(job.event);
+        lock.lock();
+    }
+}
+
+/**
+ * Read the file of `job`, store it as its last content and attach the diff
+ * against the previous content. The first event for a file only fills the
+ * cache.
+ *
+ * @param job
+ */
+void ContentDiffer::diffFile(Job &job) {
+    // Check and read the same open file, so it can't be swapped for a link
+    // in between.
+    const int fd = openNoFollow(job.fullPath);
+    struct stat st;
+    if (fd == -1 ||
+        fstat(fd, &st) == -1 ||
+        !S_ISREG(st.st_mode) ||
+        static_cast<size_t>(st.st_size) > maxFileBytes_) {
+        if (fd != -1) {
+            close(fd);
+        }
+        dropContent(job.fullPath);
+        return;
+    }
+    std::string content;
+    char buf[65536];
+    ssize_t n = 0;
+    while (content.size() <= maxFileBytes_ &&
+        (n = read(fd, buf, sizeof(buf))) > 0) {
+        content.append(buf, n);
+    }
+    close(fd);
+    if (n == -1) {
+        dropContent(job.fullPath);
+        return;
+    }
+    if (content.size() > maxFileBytes_ ||
+        content.find('\0') != std::string::npos) {
+        // Grew since `fstat`, or binary.
+        dropContent(job.fullPath);
+        return;
+    }
+
+    Blob current;
+    auto previous = swapContent(job.fullPath, std::move(content), current);
+    if (previous != nullptr &&
+        previous != current) {
+        job.event.diff = UnifiedDiff(*previous, *current,
+            job.event.path + (!job.event.file.empty() ? "/" : "") + job.event.file);
+    }
+}
+
+/**
+ * Store `content` as the last content of `path`, sharing it with any
+ * identical content already cached, and evict least recently used files
+ * while over budget.
+ *
+ * @param path
+ * @param content
+ * @param current Set to the stored content.
+ * @return The previous content of `path`, or null if it wasn't cached.
+ */
+std::shared_ptr<const std::string> ContentDiffer::swapContent(const std::string &path, std::string content, Blob &current) {
+    std::lock_guard<std::mutex> lock(cacheMux_);
+    const size_t hash = std::hash<std::string>()(content);
+    Blob blob;
+    auto found = blobs_.find(hash);
+    if (found != blobs_.end()) {
+        blob = found->second.lock();
+        if (blob != nullptr &&
+            *blob != content) {
+            // Hash collision; keep this content unshared.
+            blob = nullptr;
+            found = blobs_.end();
+        }
+    }
+    if (blob == nullptr) {
+        const size_t size = content.size();
+        usedBytes_ += size;
+        blob = Blob(new std::string(std::move(content)), [this, size](const std::string *s) {
+            usedBytes_ -= size;
+            delete s;
+        });
+        if (found == blobs_.end() ||
+            found->second.expired()) {
+            blobs_[hash] = blob;
+        }
+    }
+
+    current = blob;
+    Blob previous;
+    auto it = index_.find(path);
+    if (it != index_.end()) {
+        previous = it->second->second;
+        it->second->second = blob;
+        lru_.splice(lru_.begin(), lru_, it->second);
+    } else {
+        lru_.emplace_front(path, blob);
+        index_[path] = lru_.begin();
+    }
+
+    while (usedBytes_ > cacheBytes_ &&
+        lru_.size() > 1) {
+        index_.erase(lru_.back().first);
+        lru_.pop_back();
+    }
+    if (blobs_.size() > 2 * lru_.size() + 64) {
+        for (auto b = blobs_.begin(); b != blobs_.end();) {
+            b = b->second.expired() ? blobs_.erase(b) : std::next(b);
+        }
+    }
+    return previous;
+}
+
+/**
+ * Forget the last content of `path`, which is now too large, binary or gone.
+ *
+ * @param path
+ */
+void ContentDiffer::dropContent(const std::string &path) {
+    std::lock_guard<std::mutex> lock(cacheMux_);
+    auto it = index_.find(path);
+    if (it != index_.end()) {
+        lru_.erase(it->second);
+        index_.erase(it);
+    }
+}
+} // namespace argusd
@@ -0,0 +1,98 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUSD_DIFF_H__
+#define __ARGUSD_DIFF_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "argusd_aggregate.h"
+
+namespace argusd {
+std::string UnifiedDiff(const std::string &before, const std::string &after, const std::string &label);
+
+/**
+ * Keeps the last content of small watched files in a bounded LRU cache and
+ * attaches a unified diff against it to each write event. Files are read and
+ * diffed on a pool of threads, sharded by path so changes to one file are
+ * diffed in order; the watcher's event loop only queues the event.
+ * Identical contents (such as the same config in every replica) are stored
+ * once.
+ */
+class ContentDiffer final {
+public:
+    explicit ContentDiffer(unsigned int threads, size_t cacheBytes, size_t maxFileBytes,
+        std::function<void(const WatchEvent &)> emit);
+    ~ContentDiffer();
+
+    void Submit(WatchEvent &&event, std::string fullPath);
+
+private:
+    struct Job {
+        WatchEvent event;
+        std::string fullPath;
+    };
+
+    struct Shard {
+        std::deque<Job> jobs;
+        std::condition_variable cv;
+        std::mutex mux;
+        std::thread thread;
+        bool done = false;
+    };
+
+    void diffLoop(Shard &shard);
+    void diffFile(Job &job);
+    using Blob = std::shared_ptr<const std::string>;
+    Blob swapContent(const std::string &path, std::string content, Blob &current);
+    void dropContent(const std::string &path);
+
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::function<void(const WatchEvent &)> emit_;
+    size_t cacheBytes_, maxFileBytes_;
+
+    // LRU of path -> last content, most recently used first. Contents are
+    // shared by hash; `blobs_` holds weak references for deduplication and
+    // `usedBytes_` counts each distinct content once.
+    std::atomic<size_t> usedBytes_{0};
+    std::list<std::pair<std::string, Blob>> lru_;
+    std::unordered_map<std::string, std::list<std::pair<std::string, Blob>>::iterator> index_;
+    std::unordered_map<size_t, std::weak_ptr<const std::string>> blobs_;
+    std::mutex cacheMux_;
+};
+} // namespace argusd
+
+#endif
@@ -0,0 +1,188 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <algorithm>
+
+#include "argusd_format.h"
+#include "argusd_sched.h"
+
+extern "C" {
+#include <lib/argusbuffer.h>
+}
+
+namespace argusd {
+namespace {
+const size_t kOrderShards = 64;
+} // namespace
+
+/**
+ * @param threads Preparing threads.
+ * @param prepare Called on a pool thread with each event; the function it
+ *                returns is called in the order the subject's events were
+ *                submitted.
+ */
+FormatStage::FormatStage(const unsigned int threads, PrepareFn prepare) : prepare_(std::move(prepare)) {
+    for (size_t i = 0; i < kOrderShards; ++i) {
+        orderShards_.push_back(std::make_unique<OrderShard>());
+    }
+    for (unsigned int i = 0; i < std::max(threads, 1u); ++i) {
+        queues_.push_back(std::make_unique<Queue>());
+    }
+    for (auto &queue : queues_) {
+        queue->thread = std::thread(&FormatStage::prepareLoop, this, std::ref(*queue));
+        SetThreadName("argusd-format", queue->thread.native_handle());
+        SetThreadRole(ThreadRole::kFormatter, queue->thread.native_handle());
+    }
+}
+
+FormatStage::~FormatStage() {
+    for (auto &queue : queues_) {
+        {
+            std::lock_guard<std::mutex> lock(queue->mux);
+            queue->done = true;
+        }
+        queue->cv.notify_one();
+        queue->thread.join();
+    }
+}
+
+/**
+ * Queue `awevent` to be prepared on the pool. Called on the thread that read
+ * the event, which must be the only one submitting events of its subject.
+ * The event's read buffer is referenced rather than copied; events without
+ * one (synthesized reports, or records from a worker's ring) are copied.
+ *
+ * @param awevent
+ */
+void FormatStage::Submit(const struct arguswatch_event *awevent) {
+    auto task = std::make_unique<Task>();
+    task->watch = *awevent->watch;
+    task->name = awevent->watch->name != nullptr ? awevent->watch->name : "";
+    task->nodeName = awevent->watch->node_name != nullptr ? awevent->watch->node_name : "";
+    task->podName = awevent->watch->pod_name != nullptr ? awevent->watch->pod_name : "";
+    task->tags = awevent->watch->tags != nullptr ? awevent->watch->tags : "";
+    task->logFormat = awevent->watch->log_format != nullptr ? awevent->watch->log_format : "";
+    task->watch.name = task->name.c_str();
+    task->watch.node_name = task->nodeName.c_str();
+    task->watch.pod_name = task->podName.c_str();
+    task->watch.tags = task->tags.c_str();
+    task->watch.log_format = task->logFormat.c_str();
+
+    task->event = *awevent;
+    task->event.watch = &task->watch;
+    if (awevent->buffer != nullptr) {
+        ref_buffer(awevent->buffer);
+    } else {
+        task->pathName = awevent->path_name;
+        task->fileName = awevent->file_name;
+        task->event.path_name = task->pathName.c_str();
+        task->event.file_name = task->fileName.c_str();
+    }
+
+    task->key = (static_cast<uint64_t>(static_cast<uint32_t>(awevent->watch->pid)) << 32) |
+        static_cast<uint32_t>(awevent->watch->sid);
+    {
+        auto &shard = *orderShards_[task->key % kOrderShards];
+        std::lock_guard<std::mutex> lock(shard.mux);
+        task->seq = shard.orders[task->key].nextSeq++;
+    }
+    ++pending_;
+
+    auto &queue = *queues_[next_++ % queues_.size()];
+    {
+        std::lock_guard<std::mutex> lock(queue.mux);
+        queue.tasks.push_back(std::move(task));
+    }
+    queue.cv.notify_one();
+}
+
+/**
+ * Returns the number of events submitted but not yet emitted.
+ *
+ * @return
+ */
+uint64_t FormatStage::Pending() const {
+    return pending_.load(std::memory_order_relaxed);
+}
+
+void FormatStage::prepareLoop(Queue &queue) {
+    std::unique_lock<std::mutex> lock(queue.mux);
+    for (;;) {
+        queue.cv.wait(lock, [&] {
+            return queue.done || !queue.tasks.empty();
+        });
+        if (queue.tasks.empty()) {
+            // Done, and everything queued was prepared.
+            return;
+        }
+        auto task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        lock.unlock();
+
+        auto emit = prepare_(&task->event);
+        if (task->event.buffer != nullptr) {
+            unref_buffer(task->event.buffer);
+        }
+        complete(task->key, task->seq, std::move(emit));
+
+        lock.lock();
+    }
+}
+
+/**
+ * Emit the prepared event `seq` of subject `key` if all earlier ones have
+ * been, followed by any later ones already waiting; otherwise hold it.
+ *
+ * @param key
+ * @param seq
+ * @param emit May be empty if the event was dropped while preparing.
+ */
+void FormatStage::complete(const uint64_t key, const uint64_t seq, std::function<void()> emit) {
+    auto &shard = *orderShards_[key % kOrderShards];
+    std::lock_guard<std::mutex> lock(shard.mux);
+    auto &order = shard.orders[key];
+    if (seq != order.nextEmit) {
+        order.ready.emplace(seq, std::move(emit));
+        return;
+    }
+    for (;;) {
+        if (emit) {
+            emit();
+        }
+        ++order.nextEmit;
+        --pending_;
+        auto it = order.ready.find(order.nextEmit);
+        if (it == order.ready.end()) {
+            break;
+        }
+        emit = std::move(it->second);
+        order.ready.erase(it);
+    }
+    if (order.nextEmit == order.nextSeq) {
+        // Nothing in flight; a restarted subject starts over at 0.
+        shard.orders.erase(key);
+    }
+}
+} // namespace argusd
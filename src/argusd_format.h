@@ -0,0 +1,105 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUSD_FORMAT_H__
+#define __ARGUSD_FORMAT_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+extern "C" {
+#include <lib/argusutil.h>
+}
+
+namespace argusd {
+/**
+ * Spreads the work of turning `inotify` events into log lines and metrics
+ * (path rewriting, manifest checks, formatting) over a pool of threads while
+ * keeping each watcher subject's output in the order its events were read.
+ * Events get a sequence number per subject when submitted; each is prepared
+ * on whichever thread is free, and the result is held in a reorder buffer
+ * until every earlier event of the same subject has been emitted.
+ */
+class FormatStage final {
+public:
+    // Runs on a pool thread; returns what to do, in order, with the result.
+    using PrepareFn = std::function<std::function<void()>(struct arguswatch_event *)>;
+
+    explicit FormatStage(unsigned int threads, PrepareFn prepare);
+    ~FormatStage();
+
+    void Submit(const struct arguswatch_event *awevent);
+    uint64_t Pending() const;
+
+private:
+    struct Task {
+        struct arguswatch watch;              // Shallow copy; the watcher may stop before the task runs.
+        struct arguswatch_event event;
+        std::string name, nodeName, podName, tags, logFormat;
+        std::string pathName, fileName;       // Copies when the event has no read buffer to reference.
+        uint64_t key, seq;
+    };
+
+    struct Queue {
+        std::deque<std::unique_ptr<Task>> tasks;
+        std::condition_variable cv;
+        std::mutex mux;
+        std::thread thread;
+        bool done = false;
+    };
+
+    struct Order {
+        uint64_t nextSeq = 0;                 // Next sequence number to hand out.
+        uint64_t nextEmit = 0;                // Sequence number to emit next.
+        std::map<uint64_t, std::function<void()>> ready; // Prepared out of turn.
+    };
+
+    struct OrderShard {
+        std::unordered_map<uint64_t, Order> orders; // Watcher subject -> its ordering.
+        std::mutex mux;
+    };
+
+    void prepareLoop(Queue &queue);
+    void complete(uint64_t key, uint64_t seq, std::function<void()> emit);
+
+    PrepareFn prepare_;
+    std::vector<std::unique_ptr<Queue>> queues_;
+    std::vector<std::unique_ptr<OrderShard>> orderShards_;
+    std::atomic<uint64_t> next_{0};           // Round-robin queue choice.
+    std::atomic<uint64_t> pending_{0};        // Submitted but not yet emitted.
+};
+} // namespace argusd
+
+#endif
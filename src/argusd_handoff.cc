@@ -0,0 +1,245 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <climits>
+
+#include "argusd_handoff.h"
+
+namespace argusd {
+namespace {
+const size_t kMaxSeen = 65536; // Overlap events remembered per PID before the oldest are forgotten.
+} // namespace
+
+/**
+ * @param window How long an event reported by one epoch suppresses the same
+ *               event from the other, and how long the overlap lasts after
+ *               ownership flips (for events already queued by the old epoch).
+ */
+WatcherHandoff::WatcherHandoff(const std::chrono::milliseconds window) : window_(window) {}
+
+/**
+ * Allocate the next epoch for `pid`. With `handoff`, and if another epoch
+ * owns `pid`, the new one is pending until `Commit`; otherwise it owns `pid`
+ * immediately. An epoch still pending from an earlier call is superseded:
+ * it never becomes the owner, so the caller stops it.
+ *
+ * @param pid
+ * @param subjects Number of subjects the epoch's watchers are started for.
+ * @param handoff
+ * @param superseded Epoch and subject count of the superseded pending epoch;
+ *                   epoch is -1 if nothing was pending.
+ * @return Epoch, or -1 if `subjects` would not fit in one epoch's subject
+ *         IDs.
+ */
+int WatcherHandoff::Begin(const int pid, const int subjects, const bool handoff, std::pair<int, int> *superseded) {
+    *superseded = std::make_pair(-1, 0);
+    if (subjects >= kSubjectStride) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> lock(mux_);
+    auto &owner = owners_[pid];
+    const int epoch = owner.nextEpoch;
+    owner.nextEpoch = (epoch + 1) % (INT_MAX / kSubjectStride);
+    *superseded = std::make_pair(owner.pending.epoch, owner.pending.subjects);
+    if (!handoff ||
+        owner.current.epoch == -1) {
+        if (owner.pending.epoch != -1) {
+            --pendingc_;
+        }
+        owner.current = {epoch, subjects};
+        owner.pending = Generation();
+    } else {
+        if (owner.pending.epoch == -1) {
+            ++pendingc_;
+        }
+        if (std::chrono::steady_clock::now() >= owner.overlapUntil) {
+            // Left over from an earlier handoff, which `Admit` stopped
+            // looking at.
+            owner.seen.clear();
+            owner.expiry.clear();
+        }
+        owner.pending = {epoch, subjects};
+        owner.ready = 0;
+        owner.overlapUntil = std::chrono::steady_clock::time_point::max();
+    }
+    return epoch;
+}
+
+/**
+ * Wait until every subject of the pending epoch of each of `pids` is ready.
+ *
+ * @param pids
+ * @param timeout
+ * @return False if `timeout` elapsed first.
+ */
+bool WatcherHandoff::WaitReady(const std::vector<int> &pids, const std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mux_);
+    return cv_.wait_for(lock, timeout, [&] {
+        for (const auto &pid : pids) {
+            auto it = owners_.find(pid);
+            if (it != owners_.end() &&
+                it->second.pending.epoch != -1 &&
+                it->second.ready < it->second.pending.subjects) {
+                return false;
+            }
+        }
+        return true;
+    });
+}
+
+/**
+ * Flip ownership of `pid` to its pending epoch.
+ *
+ * @param pid
+ * @return Epoch and subject count of the replaced epoch, which the caller
+ *         stops; epoch is -1 if nothing was pending.
+ */
+std::pair<int, int> WatcherHandoff::Commit(const int pid) {
+    std::lock_guard<std::mutex> lock(mux_);
+    auto it = owners_.find(pid);
+    if (it == owners_.end() ||
+        it->second.pending.epoch == -1) {
+        return std::make_pair(-1, 0);
+    }
+    auto &owner = it->second;
+    auto old = owner.current;
+    owner.current = owner.pending;
+    owner.pending = Generation();
+    --pendingc_;
+    owner.overlapUntil = std::chrono::steady_clock::now() + window_;
+    if (overlapUntil_.load() < owner.overlapUntil.time_since_epoch().count()) {
+        overlapUntil_.store(owner.overlapUntil.time_since_epoch().count());
+    }
+    return std::make_pair(old.epoch, old.subjects);
+}
+
+/**
+ * Drop ownership of `pid` once its watchers are stopped for good. The epoch
+ * counter is kept so a later watcher for a reused PID never reuses the
+ * subject IDs of one still shutting down.
+ *
+ * @param pid
+ * @param pending If not null, set to the epoch and subject count of the
+ *                pending epoch (-1 if none).
+ * @return Epoch and subject count of the owning epoch (-1 if none).
+ */
+std::pair<int, int> WatcherHandoff::Retire(const int pid, std::pair<int, int> *pending) {
+    if (pending != nullptr) {
+        *pending = std::make_pair(-1, 0);
+    }
+    std::lock_guard<std::mutex> lock(mux_);
+    auto it = owners_.find(pid);
+    if (it == owners_.end()) {
+        return std::make_pair(-1, 0);
+    }
+    auto &owner = it->second;
+    auto old = owner.current;
+    if (owner.pending.epoch != -1) {
+        if (pending != nullptr) {
+            *pending = std::make_pair(owner.pending.epoch, owner.pending.subjects);
+        }
+        --pendingc_;
+    }
+    owner.current = owner.pending = Generation();
+    owner.overlapUntil = std::chrono::steady_clock::time_point();
+    owner.seen.clear();
+    owner.expiry.clear();
+    cv_.notify_all();
+    return std::make_pair(old.epoch, old.subjects);
+}
+
+/**
+ * Record an `AW_READY` report from subject `sid` of `pid`.
+ *
+ * @param pid
+ * @param sid
+ */
+void WatcherHandoff::Ready(const int pid, const int sid) {
+    std::lock_guard<std::mutex> lock(mux_);
+    auto it = owners_.find(pid);
+    if (it != owners_.end() &&
+        it->second.pending.epoch == sid / kSubjectStride) {
+        ++it->second.ready;
+        cv_.notify_all();
+    }
+}
+
+/**
+ * Decide whether an event should be logged. Outside of a handoff every event
+ * is; during one, an event is dropped if the other epoch of the same PID
+ * reported it within the window.
+ *
+ * @param awevent
+ * @return
+ */
+bool WatcherHandoff::Admit(const struct arguswatch_event *awevent) {
+    if (pendingc_.load() == 0 &&
+        std::chrono::steady_clock::now().time_since_epoch().count() >= overlapUntil_.load()) {
+        // No handoff anywhere; don't take the lock for every event.
+        return true;
+    }
+    const int epoch = awevent->watch->sid / kSubjectStride;
+    std::lock_guard<std::mutex> lock(mux_);
+    auto it = owners_.find(awevent->watch->pid);
+    if (it == owners_.end()) {
+        return true;
+    }
+    auto &owner = it->second;
+    const auto now = std::chrono::steady_clock::now();
+    if (owner.pending.epoch == -1 &&
+        now >= owner.overlapUntil) {
+        if (!owner.seen.empty()) {
+            owner.seen.clear();
+            owner.expiry.clear();
+        }
+        return true;
+    }
+
+    while (!owner.expiry.empty() &&
+        (owner.expiry.front().first + window_ < now || owner.expiry.size() > kMaxSeen)) {
+        auto seen = owner.seen.find(owner.expiry.front().second);
+        if (seen != owner.seen.end() &&
+            seen->second.second == owner.expiry.front().first) {
+            owner.seen.erase(seen);
+        }
+        owner.expiry.pop_front();
+    }
+
+    std::string key;
+    key.append(awevent->path_name).append(1, '\0')
+        .append(awevent->file_name).append(1, '\0')
+        .append(std::to_string(awevent->event_mask));
+    auto seen = owner.seen.find(key);
+    if (seen != owner.seen.end() &&
+        seen->second.first != epoch) {
+        // The other epoch already reported this one.
+        owner.seen.erase(seen);
+        return false;
+    }
+    owner.seen[key] = std::make_pair(epoch, now);
+    owner.expiry.emplace_back(now, std::move(key));
+    return true;
+}
+} // namespace argusd
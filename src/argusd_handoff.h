@@ -0,0 +1,95 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUSD_HANDOFF_H__
+#define __ARGUSD_HANDOFF_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+extern "C" {
+#include <lib/argusutil.h>
+}
+
+namespace argusd {
+// Subject IDs are `epoch * kSubjectStride + subject index`, so the watchers
+// of a replacement spec never share a `wlcache` slot with those they replace.
+const int kSubjectStride = 1024;
+
+/**
+ * Tracks which generation ("epoch") of watchers owns each PID while a
+ * watcher is replaced make-before-break. The new epoch is started next to
+ * the old one; once all of its subjects report `AW_READY`, ownership flips
+ * and the old epoch is stopped. While both run, an event already reported by
+ * one epoch is suppressed when the other reports it too.
+ */
+class WatcherHandoff final {
+public:
+    explicit WatcherHandoff(std::chrono::milliseconds window);
+    ~WatcherHandoff() = default;
+
+    int Begin(int pid, int subjects, bool handoff, std::pair<int, int> *superseded);
+    bool WaitReady(const std::vector<int> &pids, std::chrono::milliseconds timeout);
+    std::pair<int, int> Commit(int pid);
+    std::pair<int, int> Retire(int pid, std::pair<int, int> *pending);
+    void Ready(int pid, int sid);
+    bool Admit(const struct arguswatch_event *awevent);
+
+private:
+    struct Generation {
+        int epoch = -1, subjects = 0;
+    };
+
+    struct Owner {
+        Generation current, pending;
+        int ready = 0;                    // Subjects of `pending` that reported `AW_READY`.
+        int nextEpoch = 0;
+        std::chrono::steady_clock::time_point overlapUntil;
+        // Events recently reported during the overlap, with the epoch that
+        // reported them first and when; `expiry` holds them in report order.
+        std::unordered_map<std::string, std::pair<int, std::chrono::steady_clock::time_point>> seen;
+        std::deque<std::pair<std::chrono::steady_clock::time_point, std::string>> expiry;
+    };
+
+    std::map<int, Owner> owners_;
+    // Read by `Admit` without the lock: the number of PIDs with a pending
+    // epoch, and when the last overlap after a flip ends.
+    std::atomic<int> pendingc_{0};
+    std::atomic<std::chrono::steady_clock::rep> overlapUntil_{0};
+    std::chrono::milliseconds window_;
+    std::condition_variable cv_;
+    std::mutex mux_;
+};
+} // namespace argusd
+
+#endif
@@ -38,19 +38,38 @@
 #include <thread>
 
 #include <fmt/format.h>
+#include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <google/protobuf/util/message_differencer.h>
 #include <grpc/grpc.h>
 #include <grpc++/server_context.h>
 #include <libcontainer/container_util.h>
 
 #include "argusd_impl.h"
+#include "argusd_sched.h"
+#include "argusd_worker.h"
 
 extern "C" {
+#include <lib/argusbpf.h>
+#include <lib/arguschurn.h>
 #include <lib/argusnotify.h>
+#include <lib/arguspoll.h>
 #include <lib/argusutil.h>
 }
 
-grpc::ServerWriter<argus::ArgusdMetricsHandle> *kMetricsWriter;
+DECLARE_bool(argusignore);
+DECLARE_bool(sharetraversal);
+DECLARE_int32(createdebounce);
+DECLARE_string(eventbackend);
+DECLARE_int32(handofftimeout);
+
+argusd::MetricsSubscribers *kMetricsSubscribers;
+argusd::EventAggregator *kEventAggregator;
+argusd::WatcherHandoff *kWatcherHandoff;
+argusd::ContentDiffer *kContentDiffer;
+argusd::ManifestFilter *kManifestFilter;
+argusd::FormatStage *kFormatStage;
+argusd::ContainerResolver *kContainerResolver;
 
 namespace argusd {
 /**
@@ -59,27 +78,161 @@ namespace argusd {
  * create `inotify` watchers by spawning an argusnotify process that handles
  * the filesystem-level instructions.
  *
+ * Updates from the controller for a pod that is already watched are
+ * debounced: requests for the same pod arriving within `-createdebounce` of
+ * each other are coalesced, only the latest one is applied, and every caller
+ * is answered with its result. Updates arriving while the pod's watcher is
+ * being built are coalesced into one more run after it. Watchers started for
+ * new containers (`context` is null) take their turn for the pod too, without
+ * waiting, and are never coalesced with the controller's requests.
+ *
  * @param context
  * @param request
  * @param response
  * @return
  */
-grpc::Status ArgusdImpl::CreateWatch(grpc::ServerContext *context [[maybe_unused]], const argus::ArgusdConfig *request,
+grpc::Status ArgusdImpl::CreateWatch(grpc::ServerContext *context, const argus::ArgusdConfig *request,
+    argus::ArgusdHandle *response) {
+
+    const std::string key = request->nodename() + "/" + request->podname();
+    const bool proactive = context == nullptr;
+    const auto now = std::chrono::steady_clock::now();
+    std::shared_ptr<PendingCreate> pending;
+    bool leader = false;
+    {
+        std::lock_guard<std::mutex> lock(createMux_);
+        auto it = pendingCreates_.find(key);
+        std::shared_ptr<PendingCreate> tail;
+        if (it != pendingCreates_.end()) {
+            for (tail = it->second; tail->next != nullptr; tail = tail->next) {}
+        }
+        if (tail != nullptr &&
+            !tail->running &&
+            !tail->proactive &&
+            !proactive) {
+            // Supersede the request already waiting for this pod.
+            pending = tail;
+            pending->request = *request;
+            pending->last = now;
+            ++collapsed_;
+        } else {
+            pending = std::make_shared<PendingCreate>();
+            pending->request = *request;
+            pending->first = pending->last = now;
+            pending->proactive = proactive;
+            pending->result = pending->promise.get_future().share();
+            if (tail != nullptr) {
+                // Applied once the runs ahead of it for this pod are done.
+                pending->debounce = !proactive;
+                tail->next = pending;
+            } else {
+                std::lock_guard<std::mutex> watchersLock(watchersMux_);
+                auto watched = std::find_if(watchers_.cbegin(), watchers_.cend(),
+                    [&](std::shared_ptr<argus::ArgusdHandle> watcher) {
+                    return watcher->nodename() == request->nodename() && watcher->podname() == request->podname();
+                });
+                // Nothing to rebuild yet; start watching right away.
+                pending->debounce = !proactive && watched != watchers_.cend();
+                pendingCreates_[key] = pending;
+            }
+            leader = true;
+        }
+    }
+
+    if (leader) {
+        // Wait until the pod's previous run is done and no newer request has
+        // arrived for a full window, but no longer than a few windows in
+        // total. The entry stays in `pendingCreates_` until `createWatch`
+        // returns, so runs for the same pod never overlap.
+        const auto window = std::chrono::milliseconds(std::max(FLAGS_createdebounce, 0));
+        argus::ArgusdConfig latest;
+        std::unique_lock<std::mutex> lock(createMux_);
+        for (;;) {
+            auto it = pendingCreates_.find(key);
+            if (it == pendingCreates_.end() ||
+                it->second != pending) {
+                createCv_.wait(lock);
+                continue;
+            }
+            const auto deadline = pending->debounce ?
+                std::min(pending->last + window, pending->first + 4 * window) : pending->first;
+            if (std::chrono::steady_clock::now() >= deadline) {
+                latest = pending->request;
+                pending->running = true;
+                break;
+            }
+            createCv_.wait_until(lock, deadline);
+        }
+        lock.unlock();
+
+        argus::ArgusdHandle handle;
+        grpc::Status status = createWatch(context, &latest, &handle);
+
+        lock.lock();
+        if (pending->next != nullptr) {
+            pendingCreates_[key] = pending->next;
+        } else {
+            pendingCreates_.erase(key);
+        }
+        createCv_.notify_all();
+        lock.unlock();
+        pending->promise.set_value(std::make_pair(status, handle));
+    }
+
+    const auto &result = pending->result.get();
+    *response = result.second;
+    return result.first;
+}
+
+/**
+ * Applies a single `CreateWatch` request.
+ *
+ * @param context Null for requests that did not come from the controller.
+ * @param request
+ * @param response
+ * @return
+ */
+grpc::Status ArgusdImpl::createWatch(grpc::ServerContext *context, const argus::ArgusdConfig *request,
     argus::ArgusdHandle *response) {
 
     auto pids = getPidsFromRequest(std::make_shared<argus::ArgusdConfig>(*request));
     if (pids.empty()) {
         return grpc::Status::CANCELLED;
     }
+    if (request->subject_size() >= kSubjectStride) {
+        // Subject IDs would run into those of the PID's next epoch.
+        return grpc::Status(grpc::StatusCode::INVALID_ARGUMENT, "too many subjects");
+    }
+
+    // Requests from the controller (not from `startProactiveWatcher`) update
+    // the spec cache, and confirm a watcher that was already started for the
+    // same spec when its container started.
+    if (context != nullptr &&
+        containers_ != nullptr) {
+        cacheSpec(*request);
+        if (confirmProactiveWatcher(*request, pids, response)) {
+            return grpc::Status::OK;
+        }
+    }
 
     // Find existing watcher by pid in case we need to update
     // `inotify_add_watcher` is designed to both add and modify depending on if
     // a fd exists already for this path.
     auto watcher = findArgusdWatcherByPids(request->nodename(), pids);
+    if (context == nullptr &&
+        watcher != nullptr) {
+        // The controller got here first, while this start waited its turn.
+        return grpc::Status(grpc::StatusCode::ALREADY_EXISTS, "container is already watched");
+    }
     LOG(INFO) << (watcher == nullptr ? "Starting" : "Updating") << " `inotify` watcher ("
         << request->podname() << ":" << request->nodename() << ")";
 
-    if (watcher != nullptr) {
+    // With a handoff the existing watcher keeps running, and reporting
+    // events, until its replacement has walked its tree; otherwise it is
+    // stopped first.
+    const bool handoff = watcher != nullptr && kWatcherHandoff != nullptr && FLAGS_handofftimeout > 0;
+    if (watcher != nullptr &&
+        !handoff) {
         // Stop existing watcher polling.
         sendKillSignalToWatcher(watcher);
 
@@ -99,23 +252,76 @@ grpc::Status ArgusdImpl::CreateWatch(grpc::ServerContext *context [[maybe_unused
     response->set_podname(request->podname().c_str());
 
     for_each(pids.cbegin(), pids.cend(), [&](const int pid) {
-        int i = 0;
+        // Each (re)start uses subject IDs of a new epoch, so a replacement
+        // never picks up the cache of the watcher it replaces.
+        int epoch = 0;
+        if (kWatcherHandoff != nullptr) {
+            std::pair<int, int> superseded;
+            epoch = kWatcherHandoff->Begin(pid, request->subject_size(), handoff, &superseded);
+            // A replacement still waiting for its handoff will never own the
+            // PID now.
+            sendKillSignalToSubjects(pid, superseded.first, superseded.second);
+        }
+        int i = epoch * kSubjectStride;
         // Reset done map flags.
         doneMap_[pid] = false;
 
         for_each(request->subject().cbegin(), request->subject().cend(), [&](const argus::ArgusWatcherSubject subject) {
+            auto manifest = subject.tags().find(kReservedTagPrefix + "manifest");
+            if (kManifestFilter != nullptr &&
+                manifest != subject.tags().end()) {
+                auto action = subject.tags().find(kReservedTagPrefix + "manifestaction");
+                if (!kManifestFilter->Bind(pid, i, manifest->second,
+                    action != subject.tags().end() && action->second == "tag")) {
+                    LOG(WARNING) << "Not filtering events of ArgusWatcher " << request->name() << " by manifest "
+                        << manifest->second << " (" << request->podname() << ":" << request->nodename() << ")";
+                }
+            }
             // @TODO: Check if any watchers are started, if not, don't add to response.
-            createInotifyWatcher(request->name(), response->nodename(), response->podname(),
-                std::make_shared<argus::ArgusWatcherSubject>(subject), pid, i, request->subject_size(),
-                request->logformat());
+            if (workers_ != nullptr) {
+                workers_->StartWatcher(request->name(), response->nodename(), response->podname(), subject, pid, i,
+                    request->subject_size(), request->logformat(),
+                    getTagListFromSubject(std::make_shared<argus::ArgusWatcherSubject>(subject)));
+            } else {
+                createInotifyWatcher(request->name(), response->nodename(), response->podname(),
+                    std::make_shared<argus::ArgusWatcherSubject>(subject), pid, i, request->subject_size(),
+                    request->logformat());
+            }
             ++i;
         });
         response->add_pid(pid);
     });
 
-    if (watcher == nullptr) {
+    if (handoff) {
+        if (!kWatcherHandoff->WaitReady(pids, std::chrono::milliseconds(FLAGS_handofftimeout))) {
+            LOG(WARNING) << "Replacement `inotify` watcher not ready after " << FLAGS_handofftimeout
+                << "ms; stopping the old one anyway (" << request->podname() << ":" << request->nodename() << ")";
+        }
+        // Flip ownership to the new epoch and stop the old one; PIDs no longer
+        // in the request are stopped outright.
+        for (const auto &pid : watcher->pid()) {
+            auto old = std::find(pids.cbegin(), pids.cend(), pid) != pids.cend() ?
+                kWatcherHandoff->Commit(pid) : kWatcherHandoff->Retire(pid, nullptr);
+            sendKillSignalToSubjects(pid, old.first, old.second);
+        }
+    } else if (watcher != nullptr &&
+        kWatcherHandoff != nullptr) {
+        for (const auto &pid : watcher->pid()) {
+            if (std::find(pids.cbegin(), pids.cend(), pid) == pids.cend()) {
+                kWatcherHandoff->Retire(pid, nullptr);
+            }
+        }
+    }
+
+    // Replace rather than update the stored handle, so callers still holding
+    // the old one read a consistent copy.
+    std::lock_guard<std::mutex> lock(watchersMux_);
+    auto it = std::find(watchers_.begin(), watchers_.end(), watcher);
+    if (it == watchers_.end()) {
         // Store new watcher.
         watchers_.push_back(std::make_shared<argus::ArgusdHandle>(*response));
+    } else {
+        *it = std::make_shared<argus::ArgusdHandle>(*response);
     }
 
     return grpc::Status::OK;
@@ -139,8 +345,29 @@ grpc::Status ArgusdImpl::DestroyWatch(grpc::ServerContext *context [[maybe_unuse
     if (watcher != nullptr) {
         // Stop existing watcher polling.
         sendKillSignalToWatcher(watcher);
+        for (const auto &pid : watcher->pid()) {
+            if (kWatcherHandoff != nullptr) {
+                // Watchers still starting (not reached by the kill above) are
+                // stopped once they are cached.
+                std::pair<int, int> pending;
+                auto current = kWatcherHandoff->Retire(pid, &pending);
+                sendKillSignalToSubjects(pid, current.first, current.second);
+                sendKillSignalToSubjects(pid, pending.first, pending.second);
+            }
+            if (kManifestFilter != nullptr) {
+                kManifestFilter->Unbind(pid);
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(watchersMux_);
+        watchers_.erase(remove(watchers_.begin(), watchers_.end(), watcher), watchers_.end());
+    }
+
+    std::lock_guard<std::mutex> lock(specMux_);
+    for (const auto &pid : request->pid()) {
+        proactive_.erase(pid);
     }
-    watchers_.erase(remove(watchers_.begin(), watchers_.end(), watcher), watchers_.end());
 
     return grpc::Status::OK;
 }
@@ -158,7 +385,12 @@ grpc::Status ArgusdImpl::DestroyWatch(grpc::ServerContext *context [[maybe_unuse
 grpc::Status ArgusdImpl::GetWatchState(grpc::ServerContext *context [[maybe_unused]], const argus::Empty *request [[maybe_unused]],
     grpc::ServerWriter<argus::ArgusdHandle> *writer) {
 
-    std::for_each(watchers_.cbegin(), watchers_.cend(), [&](const std::shared_ptr<argus::ArgusdHandle> watcher) {
+    std::vector<std::shared_ptr<argus::ArgusdHandle>> watchers;
+    {
+        std::lock_guard<std::mutex> lock(watchersMux_);
+        watchers = watchers_;
+    }
+    std::for_each(watchers.cbegin(), watchers.cend(), [&](const std::shared_ptr<argus::ArgusdHandle> watcher) {
         if (!writer->Write(*watcher)) {
             // Broken stream.
         }
@@ -169,38 +401,79 @@ grpc::Status ArgusdImpl::GetWatchState(grpc::ServerContext *context [[maybe_unus
 
 /**
  * RecordMetrics is used to send the controller `inotify` events that occur on
- * this daemon by way of a gRPC stream.
+ * this daemon by way of a gRPC stream. Clients may narrow the stream with
+ * metadata; see `MetricsFilter`.
  *
  * @param context
  * @param request
  * @param writer
  * @return
  */
-grpc::Status ArgusdImpl::RecordMetrics(grpc::ServerContext *context [[maybe_unused]], const argus::Empty *request [[maybe_unused]],
+grpc::Status ArgusdImpl::RecordMetrics(grpc::ServerContext *context, const argus::Empty *request [[maybe_unused]],
     grpc::ServerWriter<argus::ArgusdMetricsHandle> *writer) {
 
-    kMetricsWriter = writer;
+    if (kMetricsSubscribers == nullptr) {
+        return grpc::Status::CANCELLED;
+    }
+    auto filter = MetricsFilter::FromMetadata(context->client_metadata());
+    LOG(INFO) << "Streaming metrics to " << context->peer() << " (" << filter.ToString() << ")";
 
-    std::condition_variable cv;
-    std::mutex mux;
-    std::unique_lock<std::mutex> lock(mux);
     // Keep alive so new events coming from argusnotify can be written to the
-    // bidirectional gRPC stream.
-    cv.wait(lock, [=] {
-        return kMetricsWriter == nullptr;
-    });
+    // gRPC stream, until the client goes away.
+    int id = kMetricsSubscribers->Subscribe(writer, std::move(filter));
+    kMetricsSubscribers->Wait(id, context);
+    kMetricsSubscribers->Unsubscribe(id);
 
     return grpc::Status::OK;
 }
 
 /**
- * Return list of PIDs looked up by container IDs from request.
+ * Run watchers in the worker processes of `workers` instead of as threads of
+ * this process. Must be called before the server is started.
+ *
+ * @param workers
+ */
+void ArgusdImpl::SetWorkerPool(std::shared_ptr<WorkerPool> workers) {
+    workers_ = workers;
+    workers_->SetDoneHandler([this](const int pid) {
+        doneMap_[pid] = true;
+        // Notify the `condition_variable` of changes.
+        cv_.notify_one();
+    });
+}
+
+/**
+ * Start watchers for new containers as soon as the runtime creates them,
+ * using the spec last requested for another pod of the same owner, so files
+ * changed before the controller calls `CreateWatch` are not missed.
+ *
+ * @param stateDirs
+ * @return
+ */
+bool ArgusdImpl::WatchContainerStarts(const std::string &stateDirs) {
+    containers_ = std::make_unique<ContainerStartWatcher>(stateDirs);
+    return containers_->Start([this](const ContainerInfo &info) {
+        startProactiveWatcher(info);
+    });
+}
+
+/**
+ * Return list of PIDs looked up by container IDs from request; through the
+ * node's CRI runtime when started with `-criendpoint`.
  *
  * @param request
  * @return
  */
 std::vector<int> ArgusdImpl::getPidsFromRequest(std::shared_ptr<argus::ArgusdConfig> request) const {
     std::vector<int> pids;
+    if (kContainerResolver != nullptr) {
+        for (const auto &pid : kContainerResolver->Resolve({request->cid().cbegin(), request->cid().cend()})) {
+            if (pid) {
+                pids.push_back(pid);
+            }
+        }
+        return pids;
+    }
     std::for_each(request->cid().cbegin(), request->cid().cend(), [&](std::string cid) {
         std::string runtime = clustergarage::container::Util::findContainerRuntime(cid);
         cleanContainerId(cid, runtime);
@@ -220,12 +493,13 @@ std::vector<int> ArgusdImpl::getPidsFromRequest(std::shared_ptr<argus::ArgusdCon
  * @return
  */
 std::shared_ptr<argus::ArgusdHandle> ArgusdImpl::findArgusdWatcherByPids(const std::string nodeName, const std::vector<int> pids) const {
+    std::lock_guard<std::mutex> lock(watchersMux_);
     auto it = find_if(watchers_.cbegin(), watchers_.cend(), [&](std::shared_ptr<argus::ArgusdHandle> watcher) {
         bool foundPid = false;
         for (const auto &pid : pids) {
             auto watcherPid = std::find_if(watcher->pid().cbegin(), watcher->pid().cend(),
                 [&](int p) { return p == pid; });
-            foundPid = watcherPid != watcher->pid().cend();
+            foundPid = foundPid || watcherPid != watcher->pid().cend();
         }
         return watcher->nodename() == nodeName && foundPid;
     });
@@ -260,27 +534,9 @@ char **ArgusdImpl::getPathArrayFromSubject(const int pid, std::shared_ptr<argus:
     return patharr;
 }
 
-/**
- * Returns array of char buffer paths to ignore given a subject. When doing a
- * recursive watch, if ignore paths are provided that match a specific path it
- * will be skipped, including all its children.
- *
- * @param subject
- * @return
- */
-char **ArgusdImpl::getIgnoreArrayFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
-    char **patharr = new char *[subject->ignore_size()];
-    size_t i = 0;
-    std::for_each(subject->ignore().cbegin(), subject->ignore().cend(), [&](std::string path) {
-        patharr[i] = new char[path.size() + 1];
-        strcpy(patharr[i], path.c_str());
-        ++i;
-    });
-    return patharr;
-}
-
 /**
  * Returns a comma-separated list of key=value pairs for a subject tag map.
+ * Tags prefixed with `argusd.` set per-subject options and are left out.
  *
  * @param subject
  * @return
@@ -288,6 +544,10 @@ char **ArgusdImpl::getIgnoreArrayFromSubject(std::shared_ptr<argus::ArgusWatcher
 std::string ArgusdImpl::getTagListFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
     std::string tags;
     for (const auto &tag : subject->tags()) {
+        if (tag.first.compare(0, kReservedTagPrefix.size(), kReservedTagPrefix) == 0) {
+            // Options for argusd, not for the log.
+            continue;
+        }
         if (!tags.empty()) {
             tags += ",";
         }
@@ -306,29 +566,18 @@ std::string ArgusdImpl::getTagListFromSubject(std::shared_ptr<argus::ArgusWatche
 uint32_t ArgusdImpl::getEventMaskFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
     uint32_t mask = 0;
     std::for_each(subject->event().cbegin(), subject->event().cend(), [&](std::string event) {
-        const char *evt = event.c_str();
-        if (strcmp(evt, "all") == 0)               mask |= IN_ALL_EVENTS;
-        else if (strcmp(evt, "access") == 0)       mask |= IN_ACCESS;
-        else if (strcmp(evt, "attrib") == 0)       mask |= IN_ATTRIB;
-        else if (strcmp(evt, "closewrite") == 0)   mask |= IN_CLOSE_WRITE;
-        else if (strcmp(evt, "closenowrite") == 0) mask |= IN_CLOSE_NOWRITE;
-        else if (strcmp(evt, "close") == 0)        mask |= IN_CLOSE;
-        else if (strcmp(evt, "create") == 0)       mask |= IN_CREATE;
-        else if (strcmp(evt, "delete") == 0)       mask |= IN_DELETE;
-        else if (strcmp(evt, "deleteself") == 0)   mask |= IN_DELETE_SELF;
-        else if (strcmp(evt, "modify") == 0)       mask |= IN_MODIFY;
-        else if (strcmp(evt, "moveself") == 0)     mask |= IN_MOVE_SELF;
-        else if (strcmp(evt, "movedfrom") == 0)    mask |= IN_MOVED_FROM;
-        else if (strcmp(evt, "movedto") == 0)      mask |= IN_MOVED_TO;
-        else if (strcmp(evt, "move") == 0)         mask |= IN_MOVE;
-        else if (strcmp(evt, "open") == 0)         mask |= IN_OPEN;
+        mask |= EventMaskFromName(event);
     });
     return mask;
 }
 
 /**
  * Returns a bitwise-OR combined flags given a subject. Options include
- * `only_dir`, `recursive`, and `follow_move`.
+ * `only_dir`, `recursive`, and `follow_move`. Recursive subjects also honor
+ * `.argusignore` files when the daemon runs with `-argusignore`, and reuse
+ * image directory listings between replicas with `-sharetraversal`. The
+ * `argusd.diff: "true"` tag attaches content diffs to file writes, and the
+ * `argusd.manifest` tag checks events against a manifest of expected files.
  *
  * @param subject
  * @return
@@ -340,13 +589,110 @@ uint32_t ArgusdImpl::getFlagsFromSubject(std::shared_ptr<argus::ArgusWatcherSubj
     }
     if (subject->recursive()) {
         flags |= AW_RECURSIVE;
+        if (FLAGS_argusignore) {
+            flags |= AW_IGNOREFILE;
+        }
+        if (FLAGS_sharetraversal) {
+            flags |= AW_SHARETREE;
+        }
     }
     if (subject->followmove()) {
         flags |= AW_FOLLOW;
     }
+    auto diff = subject->tags().find(kReservedTagPrefix + "diff");
+    if (diff != subject->tags().end() &&
+        diff->second == "true") {
+        flags |= AW_DIFF;
+    }
+    if (subject->tags().count(kReservedTagPrefix + "manifest")) {
+        flags |= AW_MANIFEST;
+    }
     return flags;
 }
 
+/**
+ * Helper function to pick how a subject's events are read: "inotify", "bpf"
+ * or "poll". The `argusd.backend` tag decides if set; otherwise subjects with
+ * a path on a file system where `inotify` misses remote changes, such as NFS
+ * or FUSE, poll, and the rest use `-eventbackend`. "bpf" falls back to
+ * "inotify" unless the BPF programs are loaded.
+ *
+ * @param pid
+ * @param subject
+ * @return
+ */
+std::string ArgusdImpl::getBackendFromSubject(const int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject) const {
+    std::string backend = FLAGS_eventbackend;
+    auto tag = subject->tags().find(kReservedTagPrefix + "backend");
+    if (tag != subject->tags().end()) {
+        backend = tag->second;
+    } else if (std::any_of(subject->path().cbegin(), subject->path().cend(), [&](const std::string &path) {
+        return needs_poll_watcher(("/proc/" + std::to_string(pid) + "/root" + path).c_str());
+    })) {
+        backend = "poll";
+    }
+#if ARGUS_BPF
+    if (backend == "bpf" &&
+        !bpf_backend_enabled()) {
+        backend = "inotify";
+    }
+#else
+    if (backend == "bpf") {
+        backend = "inotify";
+    }
+#endif
+    return backend;
+}
+
+/**
+ * Returns the event mask, flags, ignore list, tag list and log format of a
+ * subject, compiled once and shared by every watcher started from an
+ * identical subject and log format. With a recursive watch, directories
+ * matching an ignore entry are skipped, including all their children.
+ *
+ * @param subject
+ * @param logFormat
+ * @return
+ */
+std::shared_ptr<const CompiledSubject> ArgusdImpl::compileSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject,
+    const std::string &logFormat) {
+
+    // Each field is length-prefixed, so different subjects never encode the
+    // same; tags are sorted, since map order is not defined.
+    std::string spec;
+    auto append = [&spec](const std::string &field) {
+        spec += std::to_string(field.size()) + ":" + field;
+    };
+    append(std::to_string(subject->event_size()));
+    for (const auto &event : subject->event()) {
+        append(event);
+    }
+    append(std::to_string(subject->ignore_size()));
+    for (const auto &ignore : subject->ignore()) {
+        append(ignore);
+    }
+    std::map<std::string, std::string> tags;
+    for (const auto &tag : subject->tags()) {
+        tags[tag.first] = tag.second;
+    }
+    append(std::to_string(tags.size()));
+    for (const auto &tag : tags) {
+        append(tag.first);
+        append(tag.second);
+    }
+    append(std::to_string(subject->onlydir()) + std::to_string(subject->recursive())
+        + std::to_string(subject->followmove()));
+    append(logFormat);
+
+    return subjects_.Acquire(spec, [&](CompiledSubject &compiled) {
+        compiled.mask = getEventMaskFromSubject(subject);
+        compiled.flags = getFlagsFromSubject(subject);
+        compiled.ignores.assign(subject->ignore().cbegin(), subject->ignore().cend());
+        compiled.tags = getTagListFromSubject(subject);
+        compiled.logFormat = logFormat;
+    });
+}
+
 /**
  * Create child processes as background threads for spawning an argusnotify
  * watcher. We will create an anonymous pipe used to communicate to this
@@ -368,23 +714,41 @@ void ArgusdImpl::createInotifyWatcher(const std::string watcherName, const std::
     std::shared_ptr<argus::ArgusWatcherSubject> subject, const int pid, const int sid, const int subjectLen,
     const std::string logFormat) {
 
+    auto start = start_inotify_watcher;
+    const std::string backend = getBackendFromSubject(pid, subject);
+    if (backend == "poll") {
+        start = start_poll_watcher;
+    }
+#if ARGUS_BPF
+    if (backend == "bpf") {
+        start = start_bpf_watcher;
+    }
+#endif
     std::packaged_task<int(const char *, const char *, const char *, int, int, unsigned int, const char **,
         unsigned int, const char **, uint32_t, uint32_t, int, const char *, const char *, arguswatch_logfn)>
-        task(start_inotify_watcher);
+        task(start);
     std::shared_future<int> result(task.get_future());
-    std::thread taskThread(std::move(task),
+    // Held until the watcher returns; it reads the ignore list, tags and log
+    // format in place.
+    auto compiled = compileSubject(subject, logFormat);
+    // Named "aw-PID.SID", pinned as an event loop before anything runs on it.
+    std::thread taskThread([threadName = "aw-" + std::to_string(pid) + "." + std::to_string(sid)](auto task, auto... args) {
+        SetThreadName(threadName);
+        SetThreadRole(ThreadRole::kEventLoop);
+        task(args...);
+    }, std::move(task),
         convertStringToCString(watcherName),
         convertStringToCString(nodeName),
         convertStringToCString(podName),
         pid, sid,
         subject->path_size(), const_cast<const char **>(getPathArrayFromSubject(pid, subject)),
-        subject->ignore_size(), const_cast<const char **>(getIgnoreArrayFromSubject(subject)),
-        getEventMaskFromSubject(subject),
-        getFlagsFromSubject(subject),
+        compiled->ignorev.size(), const_cast<const char **>(compiled->ignorev.data()),
+        compiled->mask,
+        compiled->flags,
         subject->maxdepth(),
-        convertStringToCString(getTagListFromSubject(subject)),
-        convertStringToCString(logFormat),
-        logArgusWatchEvent);
+        compiled->tags.c_str(),
+        compiled->logFormat.c_str(),
+        logfn_);
     // Start as daemon process.
     taskThread.detach();
 
@@ -395,6 +759,7 @@ void ArgusdImpl::createInotifyWatcher(const std::string watcherName, const std::
     int cnt = 0;
     std::thread cleanupThread([=](std::shared_future<int> res) mutable {
         res.wait();
+        compiled.reset();
         if (res.valid()) {
             if (++cnt == subjectLen) {
                 doneMap_[pid] = true;
@@ -414,19 +779,197 @@ void ArgusdImpl::createInotifyWatcher(const std::string watcherName, const std::
 void ArgusdImpl::sendKillSignalToWatcher(std::shared_ptr<argus::ArgusdHandle> watcher) const {
     // Kill existing watcher polls.
     std::for_each(watcher->pid().cbegin(), watcher->pid().cend(), [&](const int pid) {
-        send_watcher_kill_signal(pid);
+        if (workers_ != nullptr) {
+            workers_->KillWatcher(pid);
+        } else {
+            send_watcher_kill_signal(pid);
+        }
     });
 }
-} // namespace argusd
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-void logArgusWatchEvent(struct arguswatch_event *awevent) {
+/**
+ * Stops the watchers of one epoch of a PID, leaving its other watchers
+ * running.
+ *
+ * @param pid
+ * @param epoch    Epoch to stop; nothing is stopped if -1.
+ * @param subjects Number of subjects the epoch was started with.
+ */
+void ArgusdImpl::sendKillSignalToSubjects(const int pid, const int epoch, const int subjects) const {
+    if (epoch == -1) {
+        return;
+    }
+    for (int sid = epoch * kSubjectStride; sid < epoch * kSubjectStride + subjects; ++sid) {
+        if (workers_ != nullptr) {
+            workers_->KillSubject(pid, sid);
+        } else {
+            send_subject_kill_signal(pid, sid);
+        }
+        if (kManifestFilter != nullptr) {
+            kManifestFilter->Unbind(pid, sid);
+        }
+    }
+}
+
+/**
+ * Stores a `CreateWatch` request as the spec for new pods of the same owner.
+ * The container names it was requested for are kept too, so a pod whose
+ * other containers are not watched does not get a watcher for them.
+ *
+ * @param request
+ */
+void ArgusdImpl::cacheSpec(const argus::ArgusdConfig &request) {
+    std::set<std::string> containerNames;
+    std::string podNamespace;
+    for (std::string cid : request.cid()) {
+        cleanContainerId(cid, clustergarage::container::Util::findContainerRuntime(cid));
+        ContainerInfo info;
+        if (containers_->FindContainer(cid, info)) {
+            containerNames.insert(info.containerName);
+            podNamespace = info.podNamespace;
+        }
+    }
+    if (podNamespace.empty()) {
+        // `ArgusdConfig` has no namespace; without the runtime's metadata the
+        // spec can't be told apart from other namespaces' pods.
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(specMux_);
+    auto &spec = specs_[getPodOwner(podNamespace, request.podname())];
+    spec.config = request;
+    spec.config.clear_cid();
+    spec.config.clear_pid();
+    spec.containerNames = containerNames;
+}
+
+/**
+ * Returns true if watchers for all of `pids` were started proactively with
+ * the same spec as `request`; they are then kept running as is, instead of
+ * being restarted, and become regular watchers.
+ *
+ * @param request
+ * @param pids
+ * @param response
+ * @return
+ */
+bool ArgusdImpl::confirmProactiveWatcher(const argus::ArgusdConfig &request, const std::vector<int> &pids,
+    argus::ArgusdHandle *response) {
+
+    argus::ArgusdConfig spec(request);
+    spec.clear_cid();
+    spec.clear_pid();
+
+    std::lock_guard<std::mutex> lock(specMux_);
+    for (const auto &pid : pids) {
+        auto it = proactive_.find(pid);
+        if (it == proactive_.end() ||
+            !google::protobuf::util::MessageDifferencer::Equals(it->second, spec)) {
+            return false;
+        }
+    }
+    for (const auto &pid : pids) {
+        proactive_.erase(pid);
+        response->add_pid(pid);
+    }
+    response->set_nodename(request.nodename());
+    response->set_podname(request.podname());
+    LOG(INFO) << "Confirmed `inotify` watcher (" << request.podname() << ":" << request.nodename() << ")";
+    return true;
+}
+
+/**
+ * Starts a watcher for a new container if a spec is cached for its pod's
+ * owner. The watcher is reported by `GetWatchState` like any other, so the
+ * controller destroys it if the spec no longer applies.
+ *
+ * @param info
+ */
+void ArgusdImpl::startProactiveWatcher(const ContainerInfo &info) {
+    argus::ArgusdConfig request;
+    {
+        std::lock_guard<std::mutex> lock(specMux_);
+        auto it = specs_.find(getPodOwner(info.podNamespace, info.podName));
+        if (it == specs_.end() ||
+            (!it->second.containerNames.empty() && !it->second.containerNames.count(info.containerName))) {
+            return;
+        }
+        request = it->second.config;
+        request.set_podname(info.podName);
+        if (findArgusdWatcherByPids(request.nodename(), std::vector<int>{info.pid}) != nullptr) {
+            // The controller got here first.
+            return;
+        }
+        proactive_[info.pid] = request;
+    }
+    request.add_cid(info.runtime + "://" + info.id);
+
+    LOG(INFO) << "Starting `inotify` watcher for new container " << info.containerName << " ("
+        << info.podName << ":" << request.nodename() << ") from cached spec";
+    argus::ArgusdHandle response;
+    if (!CreateWatch(nullptr, &request, &response).ok()) {
+        std::lock_guard<std::mutex> lock(specMux_);
+        proactive_.erase(info.pid);
+    }
+}
+
+/**
+ * Helper function to return the controller owning a pod as
+ * "namespace/owner". `ArgusdConfig` carries no owner reference, so the owner
+ * is taken from the name Kubernetes generated for the pod: StatefulSet pods
+ * end in an ordinal, and ReplicaSet, DaemonSet and Job pods in a random
+ * suffix. Pods of a Deployment also carry the hash of their ReplicaSet's
+ * template, which changes with every rollout, so it is dropped too. Names
+ * that weren't generated are their own owner.
+ *
+ * @param podNamespace
+ * @param podName
+ * @return
+ */
+std::string ArgusdImpl::getPodOwner(const std::string &podNamespace, const std::string &podName) const {
+    // Characters of generated names (`rand.SafeEncodeString`).
+    static const std::string kGeneratedChars = "bcdfghjklmnpqrstvwxz2456789";
+    auto isGenerated = [](const std::string &segment, size_t minLen, size_t maxLen) {
+        return segment.size() >= minLen && segment.size() <= maxLen &&
+            segment.find_first_not_of(kGeneratedChars) == std::string::npos;
+    };
+
+    std::string owner = podName;
+    auto pos = owner.rfind('-');
+    if (pos != std::string::npos) {
+        const std::string suffix = owner.substr(pos + 1);
+        if (!suffix.empty() &&
+            suffix.find_first_not_of("0123456789") == std::string::npos) {
+            owner.erase(pos);
+        } else if (isGenerated(suffix, 5, 5)) {
+            owner.erase(pos);
+            pos = owner.rfind('-');
+            if (pos != std::string::npos &&
+                isGenerated(owner.substr(pos + 1), 6, 10)) {
+                owner.erase(pos);
+            }
+        }
+    }
+    return podNamespace + "/" + owner;
+}
+
+namespace {
+std::atomic<uint64_t> &kManifestSuppressed = Stats::Get().Counter("manifest_suppressed");
+} // namespace
+
+/**
+ * Format a watcher event as a log line. Returns false, after logging a
+ * warning, if the watcher's log format is malformed.
+ *
+ * @param event
+ * @param line
+ * @return
+ */
+bool formatWatchEvent(const WatchEvent &event, std::string &line) {
     /**
      * Default logging format.
      *
-     * @specifier pod      Name of the pod.
+     * @specifier pod      Name of the pod; comma-separated pods if aggregated.
      * @specifier node     Name of the node.
      * @specifier event    `inotify` event that was observed.
      * @specifier path     Name of the directory path.
@@ -434,11 +977,82 @@ void logArgusWatchEvent(struct arguswatch_event *awevent) {
      * @specifier ftype    Evaluates to "file" or "directory".
      * @specifier tags     List of custom tags in key=value comma-separated list.
      * @specifier sep      Placeholder for a "/" character (e.g. between path/file).
+     * @specifier count    Number of events aggregated into this one (1 if not aggregated).
      */
     static const std::string kDefaultFormat = "{event} {ftype} '{path}{sep}{file}' ({pod}:{node}) {tags}";
+    static const std::string kAggregateFormat = kDefaultFormat + " [{count} events]";
 
+    std::string pods;
+    for (const auto &pod : event.podNames) {
+        if (!pods.empty()) {
+            pods += ",";
+        }
+        pods += pod;
+    }
+
+    fmt::memory_buffer out;
+    try {
+        fmt::format_to(out, !event.logFormat.empty() ? event.logFormat : event.count > 1 ? kAggregateFormat : kDefaultFormat,
+            fmt::arg("event", event.event),
+            fmt::arg("ftype", event.isDir ? "directory" : "file"),
+            fmt::arg("path", event.path),
+            fmt::arg("file", event.file),
+            fmt::arg("sep", !event.file.empty() ? "/" : ""),
+            fmt::arg("pod", pods),
+            fmt::arg("node", event.nodeName),
+            fmt::arg("tags", event.tags),
+            fmt::arg("count", event.count));
+        line = fmt::to_string(out);
+    } catch(const std::exception &e) {
+        LOG(WARNING) << "Malformed ArgusWatcher `.spec.logFormat`: \"" << e.what() << "\"";
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Write a watcher event, already formatted as `line`, to the log and the
+ * metrics stream. An empty `line` only goes to the metrics stream.
+ *
+ * @param event
+ * @param line
+ */
+void writeFormattedEvent(const WatchEvent &event, const std::string &line) {
+    if (!line.empty()) {
+        LOG(INFO) << line << (!event.diff.empty() ? "\n" + event.diff : std::string());
+    }
+
+    if (kMetricsSubscribers != nullptr) {
+        kMetricsSubscribers->Publish(event);
+    }
+}
+
+/**
+ * Write a watcher event to the log and the metrics stream.
+ *
+ * @param event
+ */
+void writeWatchEvent(const WatchEvent &event) {
+    std::string line;
+    formatWatchEvent(event, line);
+    writeFormattedEvent(event, line);
+}
+
+/**
+ * Do the work of turning an `inotify` event into a log line that doesn't
+ * depend on the order of events: naming the event, rewriting its path,
+ * checking it against a manifest and formatting it. Returns what is left to
+ * do with it (writing it, or handing it to the aggregator or differ), which
+ * must run in the order events were read; empty if the event is dropped.
+ *
+ * @param awevent
+ * @return
+ */
+std::function<void()> prepareWatchEvent(struct arguswatch_event *awevent) {
     std::string maskStr;
-    if (awevent->event_mask & IN_ACCESS)             maskStr = "ACCESS";
+    if (awevent->event_mask & AW_DEMOTE)             maskStr = "DEMOTE";
+    else if (awevent->event_mask & AW_PROMOTE)       maskStr = "PROMOTE";
+    else if (awevent->event_mask & IN_ACCESS)        maskStr = "ACCESS";
     else if (awevent->event_mask & IN_ATTRIB)        maskStr = "ATTRIB";
     else if (awevent->event_mask & IN_CLOSE_WRITE)   maskStr = "CLOSE_WRITE";
     else if (awevent->event_mask & IN_CLOSE_NOWRITE) maskStr = "CLOSE_NOWRITE";
@@ -451,33 +1065,106 @@ void logArgusWatchEvent(struct arguswatch_event *awevent) {
     else if (awevent->event_mask & IN_MOVED_TO)      maskStr = "MOVED_TO";
     else if (awevent->event_mask & IN_OPEN)          maskStr = "OPEN";
 
-    fmt::memory_buffer out;
-    try {
-        fmt::format_to(out, *awevent->watch->log_format ? std::string(awevent->watch->log_format) : kDefaultFormat,
-            fmt::arg("event", maskStr),
-            fmt::arg("ftype", awevent->is_dir ? "directory" : "file"),
-            fmt::arg("path", std::regex_replace(awevent->path_name, std::regex("/proc/[0-9]+/root"), "")),
-            fmt::arg("file", awevent->file_name),
-            fmt::arg("sep", *awevent->file_name ? "/" : ""),
-            fmt::arg("pod", awevent->watch->pod_name),
-            fmt::arg("node", awevent->watch->node_name),
-            fmt::arg("tags", *awevent->watch->tags ? awevent->watch->tags : ""));
-        LOG(INFO) << fmt::to_string(out);
-    } catch(const std::exception &e) {
-        LOG(WARNING) << "Malformed ArgusWatcher `.spec.logFormat`: \"" << e.what() << "\"";
+    std::string report;
+    if (awevent->event_mask & AW_DEMOTE) {
+        // High-churn directories should be excluded in the spec instead.
+        std::stringstream ss;
+        ss << "Demoted '" << std::regex_replace(awevent->path_name, std::regex("/proc/[0-9]+/root"), "")
+            << "' after " << awevent->count << " creates/deletes in " << CHURN_WINDOW << "s; consider adding it to"
+            << " the `ignore` list of ArgusWatcher " << awevent->watch->name << " (" << awevent->watch->pod_name << ":"
+            << awevent->watch->node_name << ")";
+        report = ss.str();
+    } else if (awevent->event_mask & AW_PROMOTE) {
+        std::stringstream ss;
+        ss << "Promoted '" << std::regex_replace(awevent->path_name, std::regex("/proc/[0-9]+/root"), "")
+            << "' after going quiet; " << awevent->count << " events were counted but not logged while demoted";
+        report = ss.str();
     }
 
-    if (kMetricsWriter != nullptr) {
-        auto metric = std::make_shared<argus::ArgusdMetricsHandle>();
-        metric->set_arguswatcher(awevent->watch->name);
-        std::transform(maskStr.begin(), maskStr.end(), maskStr.begin(), ::tolower);
-        metric->set_event(maskStr);
-        metric->set_nodename(awevent->watch->node_name);
-        // Record event to metrics writer to be put into Prometheus.
-        if (!kMetricsWriter->Write(*metric)) {
-            // Broken stream.
+    auto verdict = ManifestFilter::Verdict::kLog;
+    if (kManifestFilter != nullptr &&
+        (awevent->watch->flags & AW_MANIFEST)) {
+        verdict = kManifestFilter->Check(awevent);
+        if (verdict == ManifestFilter::Verdict::kSuppress) {
+            // An expected write, as listed in the subject's manifest.
+            ++kManifestSuppressed;
+            return nullptr;
         }
     }
+
+    WatchEvent event;
+    event.watcherName = awevent->watch->name;
+    event.nodeName = awevent->watch->node_name;
+    event.podNames.push_back(awevent->watch->pod_name);
+    event.tags = awevent->watch->tags;
+    if (verdict == ManifestFilter::Verdict::kTag) {
+        event.tags += !event.tags.empty() ? ",manifest=expected" : "manifest=expected";
+    }
+    event.logFormat = awevent->watch->log_format;
+    event.event = maskStr;
+    event.mask = awevent->event_mask;
+    event.path = std::regex_replace(awevent->path_name, std::regex("/proc/[0-9]+/root"), "");
+    event.file = awevent->file_name;
+    event.isDir = awevent->is_dir;
+
+    if (kContentDiffer != nullptr &&
+        (awevent->watch->flags & AW_DIFF) &&
+        !awevent->is_dir &&
+        (awevent->event_mask & (IN_CLOSE_WRITE | IN_MOVED_TO))) {
+        // Read and diff the new content off the event loop; each replica's
+        // diff is its own, so these events are not aggregated.
+        std::string fullPath(awevent->path_name);
+        if (awevent->file_name[0] != '\0') {
+            fullPath.append("/").append(awevent->file_name);
+        }
+        return [event = std::move(event), fullPath = std::move(fullPath)]() mutable {
+            kContentDiffer->Submit(std::move(event), std::move(fullPath));
+        };
+    }
+    if (kEventAggregator != nullptr &&
+        !(awevent->event_mask & (AW_DEMOTE | AW_PROMOTE))) {
+        return [event = std::move(event)]() mutable {
+            kEventAggregator->Add(std::move(event));
+        };
+    }
+    std::string line;
+    formatWatchEvent(event, line);
+    const bool demoted = awevent->event_mask & AW_DEMOTE;
+    return [event = std::move(event), line = std::move(line), report = std::move(report), demoted] {
+        if (!report.empty()) {
+            LOG_IF(WARNING, demoted) << report;
+            LOG_IF(INFO, !demoted) << report;
+        }
+        writeFormattedEvent(event, line);
+    };
+}
+} // namespace argusd
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void logArgusWatchEvent(struct arguswatch_event *awevent) {
+    if (awevent->event_mask & AW_READY) {
+        if (kWatcherHandoff != nullptr) {
+            kWatcherHandoff->Ready(awevent->watch->pid, awevent->watch->sid);
+        }
+        return;
+    }
+    if (kWatcherHandoff != nullptr &&
+        !kWatcherHandoff->Admit(awevent)) {
+        // Already reported by the other watcher of a make-before-break handoff.
+        return;
+    }
+
+    if (kFormatStage != nullptr) {
+        // Prepared on the format threads, and written in order.
+        kFormatStage->Submit(awevent);
+        return;
+    }
+    auto emit = argusd::prepareWatchEvent(awevent);
+    if (emit) {
+        emit();
+    }
 }
 #ifdef __cplusplus
 }; // extern "C"
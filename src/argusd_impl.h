@@ -25,14 +25,48 @@
 #ifndef __ARGUSD_IMPL_H__
 #define __ARGUSD_IMPL_H__
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <future>
 #include <map>
+#include <memory>
+#include <set>
+#include <string>
 #include <vector>
 
 #include <argus-proto/c++/argus.grpc.pb.h>
 #include <libcontainer/container_util.h>
 
+#include "argusd_aggregate.h"
+#include "argusd_cri.h"
+#include "argusd_diff.h"
+#include "argusd_format.h"
+#include "argusd_handoff.h"
+#include "argusd_manifest.h"
+#include "argusd_runtime.h"
+#include "argusd_spec.h"
+#include "argusd_stats.h"
+#include "argusd_subscribe.h"
+
+extern "C" {
+#include <lib/argusutil.h>
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+void logArgusWatchEvent(struct arguswatch_event *);
+#ifdef __cplusplus
+}; // extern "C"
+#endif
+
 namespace argusd {
+class WorkerPool;
+
+// Subject tags with this prefix are options for argusd and are not logged.
+const std::string kReservedTagPrefix = "argusd.";
+
 class ArgusdImpl final : public argus::Argusd::Service {
 public:
     explicit ArgusdImpl() = default;
@@ -43,18 +77,32 @@ public:
     grpc::Status GetWatchState(grpc::ServerContext *context, const argus::Empty *request, grpc::ServerWriter<argus::ArgusdHandle> *writer) override;
     grpc::Status RecordMetrics(grpc::ServerContext *context, const argus::Empty *request, grpc::ServerWriter<argus::ArgusdMetricsHandle> *writer) override;
 
+    void SetWorkerPool(std::shared_ptr<WorkerPool> workers);
+    bool WatchContainerStarts(const std::string &stateDirs);
+
 private:
+    friend class WorkerPool;
+
+    grpc::Status createWatch(grpc::ServerContext *context, const argus::ArgusdConfig *request, argus::ArgusdHandle *response);
     std::vector<int> getPidsFromRequest(std::shared_ptr<argus::ArgusdConfig> request) const;
     std::shared_ptr<argus::ArgusdHandle> findArgusdWatcherByPids(std::string nodeName, std::vector<int> pids) const;
     char **getPathArrayFromSubject(int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
-    char **getIgnoreArrayFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
     std::string getTagListFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
     uint32_t getEventMaskFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
     uint32_t getFlagsFromSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
+    std::string getBackendFromSubject(int pid, std::shared_ptr<argus::ArgusWatcherSubject> subject) const;
+    std::shared_ptr<const CompiledSubject> compileSubject(std::shared_ptr<argus::ArgusWatcherSubject> subject,
+        const std::string &logFormat);
     void createInotifyWatcher(std::string watcherName, std::string nodeName, std::string podName,
         std::shared_ptr<argus::ArgusWatcherSubject> subject, int pid, int sid, int slen,
         std::string logFormat);
     void sendKillSignalToWatcher(std::shared_ptr<argus::ArgusdHandle> watcher) const;
+    void sendKillSignalToSubjects(int pid, int epoch, int subjects) const;
+    void cacheSpec(const argus::ArgusdConfig &request);
+    bool confirmProactiveWatcher(const argus::ArgusdConfig &request, const std::vector<int> &pids,
+        argus::ArgusdHandle *response);
+    void startProactiveWatcher(const ContainerInfo &info);
+    std::string getPodOwner(const std::string &podNamespace, const std::string &podName) const;
 
     /**
      * Helper function to remove prepended container protocol from `containerId`
@@ -80,21 +128,50 @@ private:
         return cstr;
     }
 
-    std::vector<std::shared_ptr<argus::ArgusdHandle>> watchers_;
+    std::vector<std::shared_ptr<argus::ArgusdHandle>> watchers_; // Handles are replaced, never changed in place.
+    mutable std::mutex watchersMux_;                              // Guards `watchers_`; taken last.
+    CompiledSubjectCache subjects_;
+    std::shared_ptr<WorkerPool> workers_;
+
+    struct CachedSpec {
+        argus::ArgusdConfig config;          // Last `CreateWatch` request, without container IDs.
+        std::set<std::string> containerNames; // Names of the containers it was requested for.
+    };
+    struct PendingCreate {
+        argus::ArgusdConfig request;                          // Latest request for the pod.
+        std::chrono::steady_clock::time_point first, last;    // When the first, latest request arrived.
+        std::promise<std::pair<grpc::Status, argus::ArgusdHandle>> promise;
+        std::shared_future<std::pair<grpc::Status, argus::ArgusdHandle>> result;
+        bool debounce = true;                                 // False for pods not yet watched.
+        bool proactive = false;                               // Started for a new container, not by the controller.
+        bool running = false;                                 // `createWatch` is applying `request`.
+        std::shared_ptr<PendingCreate> next;                  // The pod's next run, once this one is done.
+    };
+    std::map<std::string, std::shared_ptr<PendingCreate>> pendingCreates_; // "node/pod" -> running or first waiting run.
+    std::atomic<uint64_t> &collapsed_ = Stats::Get().Counter("createwatch_collapsed");
+    std::condition_variable createCv_;
+    std::mutex createMux_;
+
+    std::unique_ptr<ContainerStartWatcher> containers_;
+    std::map<std::string, CachedSpec> specs_; // "namespace/owner" -> spec.
+    std::map<int, argus::ArgusdConfig> proactive_; // PID -> spec of watchers started before `CreateWatch`.
+    std::mutex specMux_;
+    arguswatch_logfn logfn_ = logArgusWatchEvent;
     std::map<int, bool> doneMap_;
     std::condition_variable cv_;
     std::mutex mux_;
 };
-} // namespace argusd
 
-extern grpc::ServerWriter<argus::ArgusdMetricsHandle> *kMetricsWriter;
+void writeWatchEvent(const WatchEvent &event);
+std::function<void()> prepareWatchEvent(struct arguswatch_event *awevent);
+} // namespace argusd
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-void logArgusWatchEvent(struct arguswatch_event *);
-#ifdef __cplusplus
-}; // extern "C"
-#endif
+extern argusd::MetricsSubscribers *kMetricsSubscribers;
+extern argusd::EventAggregator *kEventAggregator;
+extern argusd::WatcherHandoff *kWatcherHandoff;
+extern argusd::ContentDiffer *kContentDiffer;
+extern argusd::ManifestFilter *kManifestFilter;
+extern argusd::FormatStage *kFormatStage;
+extern argusd::ContainerResolver *kContainerResolver;
 
 #endif
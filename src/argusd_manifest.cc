@@ -0,0 +1,388 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <vector>
+
+#include <glog/logging.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include "argusd_manifest.h"
+#include "argusd_sched.h"
+
+namespace argusd {
+namespace {
+const char kManifestMagic[8] = {'A', 'R', 'G', 'U', 'S', 'M', 'F', '\0'};
+const uint32_t kManifestVersion = 1;
+const int kManifestNftwFds = 20; // Max fd `nftw` should open while building a manifest.
+
+/**
+ * Bytewise order of manifest paths; a path sorts before any longer path it
+ * is a prefix of.
+ */
+inline int comparePath(const char *a, const size_t alen, const char *b, const size_t blen) {
+    int cmp = memcmp(a, b, std::min(alen, blen));
+    if (cmp != 0) {
+        return cmp;
+    }
+    return alen < blen ? -1 : alen > blen ? 1 : 0;
+}
+
+/**
+ * SHA-256 of the open file `fd`, read with a per-thread buffer.
+ *
+ * @param fd
+ * @param digest
+ * @return
+ */
+bool hashFd(const int fd, uint8_t digest[SHA256_DIGEST_LENGTH]) {
+    static thread_local char buf[1 << 16];
+    // EVP builds against both BoringSSL and OpenSSL 3 without deprecations.
+    std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(EVP_MD_CTX_new(), EVP_MD_CTX_free);
+    bool ok = ctx != nullptr && EVP_DigestInit_ex(ctx.get(), EVP_sha256(), nullptr) == 1;
+    ssize_t len;
+    while (ok &&
+        (len = read(fd, buf, sizeof(buf))) != 0) {
+        ok = len > 0 && EVP_DigestUpdate(ctx.get(), buf, len) == 1;
+    }
+    return ok && EVP_DigestFinal_ex(ctx.get(), digest, nullptr) == 1;
+}
+
+/**
+ * SHA-256 of the file at `filename`.
+ *
+ * @param filename
+ * @param digest
+ * @return
+ */
+bool hashFile(const char *filename, uint8_t digest[SHA256_DIGEST_LENGTH]) {
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return false;
+    }
+    const bool ok = hashFd(fd, digest);
+    close(fd);
+    return ok;
+}
+
+struct BuildEntry {
+    std::string path;
+    uint64_t size;
+    uint8_t sha256[SHA256_DIGEST_LENGTH];
+};
+// `nftw` callbacks take no argument; the manifest being built.
+std::vector<BuildEntry> *kBuildEntries = nullptr;
+size_t kBuildRootLen = 0;
+
+int addBuildEntry(const char *fpath, const struct stat *sb, const int tflag, struct FTW *ftwbuf [[maybe_unused]]) {
+    if (tflag != FTW_F ||
+        !S_ISREG(sb->st_mode)) {
+        return FTW_CONTINUE;
+    }
+    BuildEntry entry;
+    entry.path = fpath + kBuildRootLen;
+    entry.size = sb->st_size;
+    if (!hashFile(fpath, entry.sha256)) {
+        PLOG(WARNING) << "Could not hash " << fpath;
+        return FTW_CONTINUE;
+    }
+    kBuildEntries->push_back(std::move(entry));
+    return FTW_CONTINUE;
+}
+} // namespace
+
+/**
+ * Map and validate the manifest open at `fd`; the caller keeps `fd`.
+ *
+ * @param fd
+ * @param filename For messages.
+ * @return Null if it can't be read or is malformed.
+ */
+std::shared_ptr<Manifest> Manifest::Open(const int fd, const std::string &filename) {
+    std::shared_ptr<Manifest> manifest(new Manifest());
+    if (fstat(fd, &manifest->st) == -1 ||
+        static_cast<size_t>(manifest->st.st_size) < sizeof(ManifestHeader)) {
+        LOG(WARNING) << "Malformed manifest " << filename;
+        return nullptr;
+    }
+    manifest->size_ = manifest->st.st_size;
+    void *data = mmap(nullptr, manifest->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        PLOG(WARNING) << "Could not map manifest " << filename;
+        return nullptr;
+    }
+    manifest->data_ = static_cast<const char *>(data);
+
+    auto header = reinterpret_cast<const ManifestHeader *>(manifest->data_);
+    if (memcmp(header->magic, kManifestMagic, sizeof(kManifestMagic)) != 0 ||
+        header->version != kManifestVersion ||
+        header->count > (manifest->size_ - sizeof(ManifestHeader)) / sizeof(ManifestEntry)) {
+        LOG(WARNING) << "Malformed manifest " << filename;
+        return nullptr;
+    }
+    manifest->entries_ = reinterpret_cast<const ManifestEntry *>(manifest->data_ + sizeof(ManifestHeader));
+    manifest->count_ = header->count;
+
+    // Check bounds and order once so lookups need not.
+    for (uint32_t i = 0; i < manifest->count_; ++i) {
+        const auto &entry = manifest->entries_[i];
+        if (entry.pathOffset > manifest->size_ ||
+            entry.pathLen > manifest->size_ - entry.pathOffset ||
+            (i > 0 && comparePath(manifest->data_ + manifest->entries_[i - 1].pathOffset, manifest->entries_[i - 1].pathLen,
+                manifest->data_ + entry.pathOffset, entry.pathLen) >= 0)) {
+            LOG(WARNING) << "Malformed manifest " << filename << " (entry " << i << ")";
+            return nullptr;
+        }
+    }
+    return manifest;
+}
+
+Manifest::~Manifest() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char *>(data_), size_);
+    }
+}
+
+/**
+ * Binary search for a container-relative path.
+ *
+ * @param path
+ * @param len
+ * @return Null if the manifest doesn't list `path`.
+ */
+const Manifest::ManifestEntry *Manifest::Find(const char *path, const size_t len) const {
+    uint32_t lo = 0, hi = count_;
+    while (lo < hi) {
+        const uint32_t mid = lo + (hi - lo) / 2;
+        const auto &entry = entries_[mid];
+        int cmp = comparePath(data_ + entry.pathOffset, entry.pathLen, path, len);
+        if (cmp == 0) {
+            return &entry;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return nullptr;
+}
+
+/**
+ * Write a manifest of every regular file under `root`, with paths relative to
+ * `root` (so `root` is the container's `/`).
+ *
+ * @param root
+ * @param filename
+ * @return
+ */
+bool WriteManifest(const std::string &root, const std::string &filename) {
+    std::vector<BuildEntry> entries;
+    kBuildEntries = &entries;
+    kBuildRootLen = root.size();
+    while (kBuildRootLen > 0 && root[kBuildRootLen - 1] == '/') {
+        --kBuildRootLen;
+    }
+    int rc = nftw(root.c_str(), addBuildEntry, kManifestNftwFds, FTW_PHYS | FTW_ACTIONRETVAL);
+    kBuildEntries = nullptr;
+    if (rc == -1) {
+        PLOG(WARNING) << "Could not walk " << root;
+        return false;
+    }
+    std::sort(entries.begin(), entries.end(), [](const BuildEntry &a, const BuildEntry &b) {
+        return comparePath(a.path.data(), a.path.size(), b.path.data(), b.path.size()) < 0;
+    });
+
+    Manifest::ManifestHeader header = {};
+    memcpy(header.magic, kManifestMagic, sizeof(kManifestMagic));
+    header.version = kManifestVersion;
+    header.count = entries.size();
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    uint64_t pathOffset = sizeof(header) + entries.size() * sizeof(Manifest::ManifestEntry);
+    for (const auto &entry : entries) {
+        Manifest::ManifestEntry record = {};
+        record.pathOffset = pathOffset;
+        record.pathLen = entry.path.size();
+        record.size = entry.size;
+        memcpy(record.sha256, entry.sha256, sizeof(record.sha256));
+        out.write(reinterpret_cast<const char *>(&record), sizeof(record));
+        pathOffset += entry.path.size();
+    }
+    for (const auto &entry : entries) {
+        out.write(entry.path.data(), entry.path.size());
+    }
+    out.close();
+    if (!out) {
+        LOG(WARNING) << "Could not write manifest " << filename;
+        return false;
+    }
+    LOG(INFO) << "Wrote manifest of " << entries.size() << " files under " << root << " to " << filename;
+    return true;
+}
+
+/**
+ * Use the manifest at `filename` for events of subject `sid` of `pid`. The
+ * file is mapped once and shared, and mapped again if it has changed.
+ *
+ * @param pid
+ * @param sid
+ * @param filename
+ * @param tagOnly  Tag matching events instead of dropping them.
+ * @return False if the manifest can't be loaded.
+ */
+bool ManifestFilter::Bind(const int pid, const int sid, const std::string &filename, const bool tagOnly) {
+    // Compare and map the same open file. The manifest is the operator's own
+    // file, often a ConfigMap key (a link swapped on update), so links are
+    // followed here.
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        PLOG(WARNING) << "Could not open manifest " << filename;
+        return false;
+    }
+    struct stat st;
+    bool current = false;
+    std::shared_ptr<Manifest> manifest;
+    {
+        std::lock_guard<std::mutex> lock(mux_);
+        auto it = manifests_.find(filename);
+        if (it != manifests_.end()) {
+            manifest = it->second;
+            current = fstat(fd, &st) == 0 &&
+                st.st_dev == manifest->st.st_dev &&
+                st.st_ino == manifest->st.st_ino &&
+                st.st_mtim.tv_sec == manifest->st.st_mtim.tv_sec &&
+                st.st_mtim.tv_nsec == manifest->st.st_mtim.tv_nsec &&
+                st.st_size == manifest->st.st_size;
+        }
+    }
+    if (!current) {
+        manifest = Manifest::Open(fd, filename);
+    }
+    close(fd);
+    if (manifest == nullptr) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mux_);
+    manifests_[filename] = manifest;
+    bindings_[std::make_pair(pid, sid)] = Binding{manifest, tagOnly};
+    return true;
+}
+
+/**
+ * @param pid
+ * @param sid
+ */
+void ManifestFilter::Unbind(const int pid, const int sid) {
+    std::lock_guard<std::mutex> lock(mux_);
+    bindings_.erase(std::make_pair(pid, sid));
+}
+
+/**
+ * Drop the manifests of every subject of `pid`.
+ *
+ * @param pid
+ */
+void ManifestFilter::Unbind(const int pid) {
+    std::lock_guard<std::mutex> lock(mux_);
+    bindings_.erase(bindings_.lower_bound(std::make_pair(pid, INT_MIN)), bindings_.upper_bound(std::make_pair(pid, INT_MAX)));
+}
+
+/**
+ * Decide what to do with an event of a subject with a manifest. An event on a
+ * file that the manifest lists, with the listed size and SHA-256, is
+ * expected. The lookup itself doesn't allocate; hashing runs at background
+ * priority.
+ *
+ * @param awevent
+ * @return
+ */
+ManifestFilter::Verdict ManifestFilter::Check(const struct arguswatch_event *awevent) {
+    if (awevent->is_dir ||
+        (awevent->event_mask & (IN_DELETE | IN_DELETE_SELF | IN_MOVED_FROM | IN_MOVE_SELF))) {
+        return Verdict::kLog;
+    }
+
+    std::shared_ptr<Manifest> manifest;
+    bool tagOnly;
+    {
+        std::lock_guard<std::mutex> lock(mux_);
+        auto it = bindings_.find(std::make_pair(awevent->watch->pid, awevent->watch->sid));
+        if (it == bindings_.end()) {
+            return Verdict::kLog;
+        }
+        manifest = it->second.manifest;
+        tagOnly = it->second.tagOnly;
+    }
+
+    char fullPath[PATH_MAX], root[32];
+    int len = awevent->file_name[0] != '\0' ?
+        snprintf(fullPath, sizeof(fullPath), "%s/%s", awevent->path_name, awevent->file_name) :
+        snprintf(fullPath, sizeof(fullPath), "%s", awevent->path_name);
+    if (len < 0 ||
+        static_cast<size_t>(len) >= sizeof(fullPath)) {
+        return Verdict::kLog;
+    }
+    // Manifest paths are relative to the container's root.
+    int rootLen = snprintf(root, sizeof(root), "/proc/%d/root", awevent->watch->pid);
+    const char *path = strncmp(fullPath, root, rootLen) == 0 ? fullPath + rootLen : fullPath;
+
+    auto entry = manifest->Find(path, fullPath + len - path);
+    if (entry == nullptr) {
+        return Verdict::kLog;
+    }
+    // Check and hash the file itself, never what a link in the container
+    // points to; a link is never an expected change.
+    int fd = open(fullPath, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK | O_NOFOLLOW);
+    if (fd == -1) {
+        return Verdict::kLog;
+    }
+    struct stat st;
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    bool expected = fstat(fd, &st) == 0 &&
+        S_ISREG(st.st_mode) &&
+        static_cast<uint64_t>(st.st_size) == entry->size;
+    if (expected) {
+        BackgroundScope background;
+        expected = hashFd(fd, digest) &&
+            memcmp(digest, entry->sha256, sizeof(digest)) == 0;
+    }
+    close(fd);
+    if (!expected) {
+        return Verdict::kLog;
+    }
+    return tagOnly ? Verdict::kTag : Verdict::kSuppress;
+}
+} // namespace argusd
@@ -0,0 +1,114 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUSD_MANIFEST_H__
+#define __ARGUSD_MANIFEST_H__
+
+#include <sys/stat.h>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+extern "C" {
+#include <lib/argusutil.h>
+}
+
+namespace argusd {
+/**
+ * Read-only, memory-mapped manifest of expected files. The file is a
+ * little-endian `ManifestHeader`, `count` `ManifestEntry`s sorted by path
+ * (bytewise, shorter first on a common prefix), then the path strings, which
+ * are container-relative and not null-terminated.
+ */
+class Manifest final {
+public:
+    struct ManifestHeader {
+        char magic[8];      // "ARGUSMF\0".
+        uint32_t version;   // 1.
+        uint32_t count;
+    };
+
+    struct ManifestEntry {
+        uint64_t pathOffset; // From the start of the file.
+        uint32_t pathLen;
+        uint32_t reserved;
+        uint64_t size;
+        uint8_t sha256[32];
+    };
+
+    static std::shared_ptr<Manifest> Open(int fd, const std::string &filename);
+    ~Manifest();
+
+    const ManifestEntry *Find(const char *path, size_t len) const;
+
+    struct stat st;     // Of the manifest file when it was mapped.
+
+private:
+    Manifest() = default;
+
+    const char *data_ = nullptr;
+    size_t size_ = 0;
+    const ManifestEntry *entries_ = nullptr;
+    uint32_t count_ = 0;
+};
+
+bool WriteManifest(const std::string &root, const std::string &filename);
+
+/**
+ * Matches events of subjects tagged `argusd.manifest` against their manifest
+ * so expected writes can be suppressed or tagged before they are formatted.
+ */
+class ManifestFilter final {
+public:
+    enum class Verdict {
+        kLog,       // Not in the manifest, or the file doesn't match it.
+        kTag,       // Matches; log it tagged as expected.
+        kSuppress,  // Matches; drop it.
+    };
+
+    ManifestFilter() = default;
+    ~ManifestFilter() = default;
+
+    bool Bind(int pid, int sid, const std::string &filename, bool tagOnly);
+    void Unbind(int pid, int sid);
+    void Unbind(int pid);
+    Verdict Check(const struct arguswatch_event *awevent);
+
+private:
+    struct Binding {
+        std::shared_ptr<Manifest> manifest;
+        bool tagOnly;
+    };
+
+    std::map<std::pair<int, int>, Binding> bindings_;   // (PID, subject ID) -> manifest.
+    std::map<std::string, std::shared_ptr<Manifest>> manifests_; // File name -> mapped manifest.
+    std::mutex mux_;
+};
+} // namespace argusd
+
+#endif
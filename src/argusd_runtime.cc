@@ -0,0 +1,232 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <chrono>
+#include <fstream>
+#include <regex>
+#include <sstream>
+#include <thread>
+
+#include <glog/logging.h>
+#include <libcontainer/container_util.h>
+
+#include "argusd_runtime.h"
+#include "argusd_sched.h"
+
+namespace argusd {
+namespace {
+const int kContainerWaitMillis = 100;   // Interval to check for a new container's config, PID.
+const int kContainerWaitTries = 100;    // Checks before a new container is given up on.
+
+/**
+ * Returns the value of a string field named `key` anywhere in a JSON
+ * document; runtimes store Kubernetes metadata as flat string maps (OCI
+ * `annotations`, Docker `Labels`).
+ *
+ * @param json
+ * @param key
+ * @return
+ */
+std::string findJsonString(const std::string &json, const std::string &key) {
+    std::smatch match;
+    if (std::regex_search(json, match, std::regex("\"" + std::regex_replace(key, std::regex("\\."), "\\.")
+        + "\"\\s*:\\s*\"([^\"]*)\""))) {
+        return match[1];
+    }
+    return "";
+}
+
+std::string readFile(const std::string &filename) {
+    std::ifstream fh(filename);
+    std::stringstream buffer;
+    buffer << fh.rdbuf();
+    return buffer.str();
+}
+} // namespace
+
+/**
+ * `stateDirs` is a comma-separated list of runtime=directory pairs, where
+ * runtime is the container ID prefix understood by libcontainer.
+ *
+ * @param stateDirs
+ */
+ContainerStartWatcher::ContainerStartWatcher(const std::string &stateDirs) {
+    std::stringstream ss(stateDirs);
+    std::string pair;
+    while (std::getline(ss, pair, ',')) {
+        auto pos = pair.find('=');
+        if (pos == std::string::npos) {
+            LOG(WARNING) << "Malformed runtime state directory \"" << pair << "\"; expected runtime=directory";
+            continue;
+        }
+        stateDirs_[pair.substr(pos + 1)] = pair.substr(0, pos);
+    }
+}
+
+/**
+ * Starts watching the state directories that exist on this node; `fn` is
+ * called from a background thread for each new application container once
+ * its PID is known.
+ *
+ * @param fn
+ * @return
+ */
+bool ContainerStartWatcher::Start(std::function<void(const ContainerInfo &)> fn) {
+    fn_ = std::move(fn);
+    fd_ = inotify_init1(IN_CLOEXEC);
+    if (fd_ == -1) {
+        PLOG(WARNING) << "Could not watch container runtime state";
+        return false;
+    }
+    for (const auto &it : stateDirs_) {
+        int wd = inotify_add_watch(fd_, it.first.c_str(), IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+        if (wd == -1) {
+            // Runtime not used on this node.
+            continue;
+        }
+        wds_[wd] = it.first;
+        LOG(INFO) << "Watching " << it.second << " containers in " << it.first;
+    }
+    if (wds_.empty()) {
+        LOG(WARNING) << "No container runtime state directories found; watchers start on `CreateWatch` only";
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    std::thread(&ContainerStartWatcher::watchStateDirs, this).detach();
+    return true;
+}
+
+/**
+ * Looks up a container by ID in the state directories.
+ *
+ * @param containerId
+ * @param info
+ * @return
+ */
+bool ContainerStartWatcher::FindContainer(const std::string &containerId, ContainerInfo &info) const {
+    for (const auto &it : stateDirs_) {
+        if (readContainerInfo(it.second, it.first, containerId, info)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ContainerStartWatcher::watchStateDirs() {
+    SetThreadName("argusd-runtime");
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    for (;;) {
+        ssize_t len = read(fd_, buf, sizeof(buf));
+        if (len == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            PLOG(ERROR) << "Could not read container runtime state events";
+            return;
+        }
+        for (char *ptr = buf; ptr < buf + len;) {
+            auto event = reinterpret_cast<const struct inotify_event *>(ptr);
+            ptr += sizeof(struct inotify_event) + event->len;
+            auto it = wds_.find(event->wd);
+            if (it == wds_.end() ||
+                !(event->mask & IN_ISDIR) ||
+                !event->len) {
+                continue;
+            }
+            // The runtime writes the config, then starts the process; wait
+            // for both without holding up other containers.
+            std::thread(&ContainerStartWatcher::waitForContainer, this, stateDirs_.at(it->second), it->second,
+                std::string(event->name)).detach();
+        }
+    }
+}
+
+void ContainerStartWatcher::waitForContainer(const std::string &runtime, const std::string &stateDir,
+    const std::string &containerId) const {
+
+    ContainerInfo info;
+    for (int i = 0; i < kContainerWaitTries; ++i) {
+        if (readContainerInfo(runtime, stateDir, containerId, info)) {
+            if (info.containerName.empty() ||
+                info.containerName == "POD") {
+                // Pod sandbox (pause) container.
+                return;
+            }
+            info.pid = clustergarage::container::Util::getPidForContainer(containerId, runtime);
+            if (info.pid) {
+                fn_(info);
+                return;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(kContainerWaitMillis));
+    }
+}
+
+/**
+ * Reads the Kubernetes pod and container names of a container from its OCI
+ * bundle `config.json` (containerd, cri-o) or Docker's `config.v2.json`.
+ *
+ * @param runtime
+ * @param stateDir
+ * @param containerId
+ * @param info
+ * @return
+ */
+bool ContainerStartWatcher::readContainerInfo(const std::string &runtime, const std::string &stateDir,
+    const std::string &containerId, ContainerInfo &info) const {
+
+    std::string config;
+    for (const auto &path : {
+        stateDir + "/" + containerId + "/config.json",
+        stateDir + "/" + containerId + "/userdata/config.json",
+        "/var/lib/docker/containers/" + containerId + "/config.v2.json"}) {
+        if (access(path.c_str(), R_OK) == 0) {
+            config = readFile(path);
+            break;
+        }
+    }
+    if (config.empty()) {
+        return false;
+    }
+
+    info.id = containerId;
+    info.runtime = runtime;
+    info.podName = findJsonString(config, "io.kubernetes.pod.name");
+    if (info.podName.empty()) {
+        info.podName = findJsonString(config, "io.kubernetes.cri.sandbox-name");
+    }
+    info.podNamespace = findJsonString(config, "io.kubernetes.pod.namespace");
+    if (info.podNamespace.empty()) {
+        info.podNamespace = findJsonString(config, "io.kubernetes.cri.sandbox-namespace");
+    }
+    info.containerName = findJsonString(config, "io.kubernetes.container.name");
+    if (info.containerName.empty()) {
+        info.containerName = findJsonString(config, "io.kubernetes.cri.container-name");
+    }
+    return !info.podName.empty();
+}
+} // namespace argusd
@@ -0,0 +1,69 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUSD_RUNTIME_H__
+#define __ARGUSD_RUNTIME_H__
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace argusd {
+/**
+ * Kubernetes identity of a container, read from the runtime's state.
+ */
+struct ContainerInfo {
+    std::string id, runtime;
+    std::string podName, podNamespace, containerName;
+    int pid = 0;
+};
+
+/**
+ * Watches container runtime state directories for new containers. Each
+ * directory holds one sub-directory per container, named by container ID,
+ * which the runtime creates before the container is started.
+ */
+class ContainerStartWatcher final {
+public:
+    explicit ContainerStartWatcher(const std::string &stateDirs);
+    ~ContainerStartWatcher() = default;
+
+    bool Start(std::function<void(const ContainerInfo &)> fn);
+    bool FindContainer(const std::string &containerId, ContainerInfo &info) const;
+
+private:
+    void watchStateDirs();
+    void waitForContainer(const std::string &runtime, const std::string &stateDir, const std::string &containerId) const;
+    bool readContainerInfo(const std::string &runtime, const std::string &stateDir, const std::string &containerId,
+        ContainerInfo &info) const;
+
+    std::map<std::string, std::string> stateDirs_; // State directory -> container runtime.
+    std::map<int, std::string> wds_;               // Watch descriptor -> state directory.
+    std::function<void(const ContainerInfo &)> fn_;
+    int fd_ = -1;
+};
+} // namespace argusd
+
+#endif
@@ -0,0 +1,291 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "argusd_sched.h"
+
+namespace argusd {
+namespace {
+const char *const kCgroupRoot = "/sys/fs/cgroup";
+
+// `ioprio_set(2)` values; glibc has no wrapper.
+const int kIoprioWhoProcess = 1;
+const int kIoprioClassShift = 13;
+const int kIoprioClassIdle = 3;
+
+// CPUs each thread role is pinned to; argusd's own CPUs if not pinned.
+cpu_set_t kRoleCpus[3];
+bool kAnyPinned = false;
+bool kTraversalPinned = false;
+int kBackgroundPolicy = -1; // Scheduling policy for background work; -1 to leave as is.
+// What the calling thread ran with before its outermost background work.
+thread_local int kSavedIoprio = -1;
+thread_local bool kSavedAffinity = false;
+thread_local cpu_set_t kSavedCpus;
+thread_local int kSavedPolicy = -1;
+thread_local struct sched_param kSavedParam;
+
+/**
+ * Returns the cgroup v2 path of argusd, relative to `kCgroupRoot`.
+ *
+ * @return
+ */
+std::string getCgroupPath() {
+    std::ifstream fh("/proc/self/cgroup");
+    std::string line;
+    while (std::getline(fh, line)) {
+        // The unified hierarchy is listed as "0::/path".
+        if (line.compare(0, 3, "0::") == 0) {
+            return line.substr(3);
+        }
+    }
+    return "";
+}
+
+std::string readCgroupFile(const std::string &cgroup, const std::string &name) {
+    std::ifstream fh(std::string(kCgroupRoot) + cgroup + "/" + name);
+    std::string value;
+    std::getline(fh, value);
+    return value;
+}
+
+/**
+ * Parses a CPU list such as "0-3,8,10-11" into `cpus`.
+ *
+ * @param list
+ * @param cpus
+ * @return
+ */
+bool parseCpuList(const std::string &list, cpu_set_t *cpus) {
+    CPU_ZERO(cpus);
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        int first, last;
+        char dash;
+        std::stringstream rs(range);
+        if (!(rs >> first)) {
+            return false;
+        }
+        last = first;
+        if (rs >> dash && (dash != '-' || !(rs >> last))) {
+            return false;
+        }
+        for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; ++cpu) {
+            CPU_SET(cpu, cpus);
+        }
+    }
+    return CPU_COUNT(cpus) > 0;
+}
+
+/**
+ * Resolves a role's CPU option: empty to not pin, "cpuset" for the CPUs of
+ * argusd's own cgroup, or a CPU list.
+ *
+ * @param option
+ * @param role
+ */
+bool configureRole(const std::string &option, const ThreadRole role) {
+    const auto i = static_cast<int>(role);
+    sched_getaffinity(0, sizeof(cpu_set_t), &kRoleCpus[i]);
+    if (option.empty()) {
+        return false;
+    }
+    std::string list(option);
+    if (option == "cpuset") {
+        list = readCgroupFile(getCgroupPath(), "cpuset.cpus.effective");
+    }
+    cpu_set_t cpus;
+    if (!parseCpuList(list, &cpus)) {
+        LOG(WARNING) << "Ignoring malformed CPU list \"" << option << "\"";
+        return false;
+    }
+    kRoleCpus[i] = cpus;
+    return true;
+}
+
+/**
+ * Background hook: switch to the traversal CPUs and, if configured, the idle
+ * I/O class and `kBackgroundPolicy` while walking, so a large resync does not
+ * compete with the node's pods for CPU or metadata I/O. Watcher, formatter
+ * and reaper threads all do background work, so whatever the thread ran
+ * with before is restored afterwards. Only called around the outermost
+ * background work of a thread.
+ *
+ * @param background
+ */
+void setBackgroundRole(const bool background) {
+    const pid_t tid = syscall(SYS_gettid);
+    if (background) {
+        if (kTraversalPinned) {
+            kSavedAffinity = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &kSavedCpus) == 0;
+            SetThreadRole(ThreadRole::kTraversal);
+        }
+        if (kBackgroundPolicy == -1) {
+            return;
+        }
+        kSavedIoprio = syscall(SYS_ioprio_get, kIoprioWhoProcess, tid);
+        kSavedPolicy = sched_getscheduler(tid);
+        if (kSavedPolicy != -1 &&
+            sched_getparam(tid, &kSavedParam) == -1) {
+            kSavedPolicy = -1;
+        }
+        if (syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, kIoprioClassIdle << kIoprioClassShift) == -1) {
+            PLOG(WARNING) << "Could not set idle I/O priority";
+        }
+        struct sched_param param = {};
+        if (sched_setscheduler(tid, kBackgroundPolicy, &param) == -1) {
+            PLOG(WARNING) << "Could not set background scheduling policy";
+        }
+        return;
+    }
+
+    if (kSavedAffinity) {
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &kSavedCpus) != 0) {
+            LOG(WARNING) << "Could not restore CPU affinity";
+        }
+        kSavedAffinity = false;
+    }
+    if (kBackgroundPolicy == -1) {
+        return;
+    }
+    if (kSavedIoprio != -1 &&
+        syscall(SYS_ioprio_set, kIoprioWhoProcess, tid, kSavedIoprio) == -1) {
+        PLOG(WARNING) << "Could not restore I/O priority";
+    }
+    kSavedIoprio = -1;
+    // Leaving `SCHED_IDLE` needs `CAP_SYS_NICE` or a `RLIMIT_NICE` that
+    // allows the thread's nice value.
+    if (kSavedPolicy != -1 &&
+        sched_setscheduler(tid, kSavedPolicy, &kSavedParam) == -1) {
+        PLOG(WARNING) << "Could not restore scheduling policy";
+    }
+    kSavedPolicy = -1;
+}
+} // namespace
+
+/**
+ * Set the CPUs of each thread role; see `configureRole` for the format. The
+ * traversal role is entered and left by watcher threads around tree walks.
+ *
+ * @param eventCpus
+ * @param formatCpus
+ * @param traversalCpus
+ */
+void ConfigureThreadRoles(const std::string &eventCpus, const std::string &formatCpus, const std::string &traversalCpus) {
+    kAnyPinned |= configureRole(eventCpus, ThreadRole::kEventLoop);
+    kAnyPinned |= configureRole(formatCpus, ThreadRole::kFormatter);
+    kTraversalPinned = configureRole(traversalCpus, ThreadRole::kTraversal);
+    kAnyPinned |= kTraversalPinned;
+    if (kTraversalPinned) {
+        set_background_hook(setBackgroundRole);
+    }
+}
+
+/**
+ * Run background work (tree walks, cache sweeps, root path searches and
+ * hashing) in the idle I/O class and under `policy`, "idle" (`SCHED_IDLE`)
+ * or "batch" (`SCHED_BATCH`); empty to run it like event processing.
+ *
+ * @param policy
+ */
+void ConfigureBackgroundPriority(const std::string &policy) {
+    if (policy.empty()) {
+        return;
+    }
+    if (policy == "idle") {
+        kBackgroundPolicy = SCHED_IDLE;
+    } else if (policy == "batch") {
+        kBackgroundPolicy = SCHED_BATCH;
+    } else {
+        LOG(WARNING) << "Ignoring unknown background scheduling policy \"" << policy << "\"";
+        return;
+    }
+    set_background_hook(setBackgroundRole);
+}
+
+/**
+ * Pin `thread` to the CPUs of `role`. Does nothing unless some role is
+ * pinned; roles that are not pinned use all of argusd's CPUs.
+ *
+ * @param role
+ * @param thread
+ */
+void SetThreadRole(const ThreadRole role, const pthread_t thread) {
+    const auto i = static_cast<int>(role);
+    if (kAnyPinned &&
+        pthread_setaffinity_np(thread, sizeof(cpu_set_t), &kRoleCpus[i]) != 0) {
+        LOG(WARNING) << "Could not set CPU affinity";
+    }
+}
+
+/**
+ * Name `thread`, as shown by `top -H` and in `/proc`; truncated to the 15
+ * characters the kernel keeps.
+ *
+ * @param name
+ * @param thread
+ */
+void SetThreadName(const std::string &name, const pthread_t thread) {
+    pthread_setname_np(thread, name.substr(0, 15).c_str());
+}
+
+/**
+ * Returns the number of CPUs argusd can use: the CPUs it may run on, capped
+ * by the cgroup v2 `cpu.max` quota of its cgroup and each ancestor.
+ *
+ * @return
+ */
+unsigned int GetCpuBudget() {
+    static const unsigned int kBudget = [] {
+        cpu_set_t cpus;
+        double budget = sched_getaffinity(0, sizeof(cpus), &cpus) == 0 ? CPU_COUNT(&cpus) : sysconf(_SC_NPROCESSORS_ONLN);
+        for (std::string cgroup = getCgroupPath(); !cgroup.empty(); cgroup = cgroup.substr(0, cgroup.rfind('/'))) {
+            std::stringstream ss(readCgroupFile(cgroup, "cpu.max"));
+            std::string quota;
+            double period;
+            if (ss >> quota >> period && quota != "max" && period > 0) {
+                budget = std::min(budget, std::stod(quota) / period);
+            }
+            if (cgroup == "/") {
+                break;
+            }
+        }
+        unsigned int n = static_cast<unsigned int>(std::ceil(budget));
+        LOG(INFO) << "CPU budget: " << n;
+        return n ? n : 1;
+    }();
+    return kBudget;
+}
+} // namespace argusd
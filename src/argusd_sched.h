@@ -0,0 +1,82 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUSD_SCHED_H__
+#define __ARGUSD_SCHED_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+
+extern "C" {
+#include <lib/argussched.h>
+}
+
+namespace argusd {
+/**
+ * Kinds of argusd threads that can be placed on their own CPUs.
+ */
+enum class ThreadRole {
+    kEventLoop,  // `inotify` watcher threads reading and dispatching events.
+    kFormatter,  // Threads formatting and writing events.
+    kTraversal,  // Watcher threads while walking trees or sweeping caches.
+};
+
+void ConfigureThreadRoles(const std::string &eventCpus, const std::string &formatCpus, const std::string &traversalCpus);
+void ConfigureBackgroundPriority(const std::string &policy);
+void SetThreadRole(ThreadRole role, pthread_t thread = pthread_self());
+void SetThreadName(const std::string &name, pthread_t thread = pthread_self());
+unsigned int GetCpuBudget();
+
+/**
+ * Marks the calling thread as doing background work for its lifetime, as the
+ * lib does around tree walks; use for CPU- or I/O-heavy work off the event
+ * path, such as hashing.
+ */
+class BackgroundScope final {
+public:
+    BackgroundScope() {
+        begin_background_work();
+    }
+    ~BackgroundScope() {
+        end_background_work();
+    }
+    BackgroundScope(const BackgroundScope &) = delete;
+    BackgroundScope &operator=(const BackgroundScope &) = delete;
+};
+
+/**
+ * Helper function to size a thread pool from the CPUs argusd may actually
+ * use, leaving room for the event loops.
+ *
+ * @param perCpu
+ * @return
+ */
+inline unsigned int GetThreadPoolSize(const double perCpu = 1.0) {
+    unsigned int n = static_cast<unsigned int>(GetCpuBudget() * perCpu);
+    return n ? n : 1;
+}
+} // namespace argusd
+
+#endif
@@ -22,7 +22,11 @@
  * SOFTWARE.
  */
 
+#include <sys/inotify.h>
+#include <algorithm>
 #include <fstream>
+#include <iostream>
+#include <iterator>
 #include <sstream>
 #include <string>
 #include <vector>
@@ -36,14 +40,111 @@
 
 #include "argusd_auth.h"
 #include "argusd_impl.h"
+#include "argusd_sched.h"
+#include "argusd_stats.h"
+#include "argusd_worker.h"
 #include "health_impl.h"
 
+extern "C" {
+#include <lib/argusbpf.h>
+#include <lib/argusbusypoll.h>
+#include <lib/argusestimate.h>
+#include <lib/arguspoll.h>
+#include <lib/argusreap.h>
+}
+
 #define PORT 50051
 
 DEFINE_bool(tls, false, "run server with TLS enabled");
 DEFINE_string(tlscafile, "", "file containing trusted certificates for verifying the client");
 DEFINE_string(tlscertfile, "", "file containing the server certificate for authenticating with the client");
 DEFINE_string(tlskeyfile, "", "file containing the server private key for authenticating with the client");
+DEFINE_bool(argusignore, false, "prune recursive watches using .argusignore files found in the watched tree");
+DEFINE_bool(sharetraversal, false, "build recursive watches of containers from directory listings of their image shared across replicas");
+DEFINE_int32(aggregatewindow, 0, "milliseconds to hold events so identical events from replicas are logged once (0 to disable)");
+DEFINE_int32(workers, 0, "run watchers in this many isolated worker processes instead of argusd threads (-1 to size from the CPU budget)");
+DEFINE_string(eventcpus, "", "CPU list (or \"cpuset\" for argusd's cgroup cpuset) to pin watcher event loops to");
+DEFINE_string(formatcpus, "", "CPU list (or \"cpuset\") to pin event formatting threads to");
+DEFINE_string(backgroundsched, "", "run tree walks and cache sweeps in the idle I/O class with this CPU policy: idle or batch");
+DEFINE_string(traversalcpus, "", "CPU list (or \"cpuset\") to move watcher threads to while walking trees");
+DEFINE_bool(proactive, false, "start watchers for new containers from cached specs before the controller requests them");
+DEFINE_string(runtimestatedirs, "containerd=/run/containerd/io.containerd.runtime.v2.task/k8s.io,"
+    "cri-o=/run/containers/storage/overlay-containers,docker=/run/docker/runtime-runc/moby",
+    "comma-separated runtime=directory list of container runtime state directories watched with -proactive");
+DEFINE_int32(diffcachesize, 16384, "KiB of file contents kept to diff writes of subjects tagged argusd.diff (0 to disable)");
+DEFINE_int32(diffmaxfilesize, 64, "largest file in KiB whose writes are diffed");
+DEFINE_string(buildmanifest, "", "write a manifest of the files under this directory to -manifestout and exit");
+DEFINE_string(manifestout, "", "file to write the manifest built with -buildmanifest to");
+DEFINE_string(estimate, "", "print what recursively watching these comma-separated directories would cost on this node and exit");
+DEFINE_string(estimateignore, "", "comma-separated directory names -estimate skips, as a subject's ignore list");
+DEFINE_int32(estimatedepth, 0, "deepest directory level -estimate walks (0 for no limit)");
+DEFINE_int32(estimatebudget, 20000, "directories -estimate walks before projecting the rest of a tree from random probes");
+DEFINE_int32(estimatesample, 1000, "milliseconds -estimate samples events for on the first directories of a tree (0 to skip)");
+DEFINE_int32(createdebounce, 200, "milliseconds to coalesce repeated CreateWatch updates for the same pod (0 to disable)");
+DEFINE_int32(handofftimeout, 10000, "milliseconds a replaced watcher keeps running while its replacement walks the tree (0 to stop it first)");
+DEFINE_int32(busypollcpu, -1, "read all watchers' events on one thread pinned to this CPU that spins instead of blocking (-1 to disable)");
+DEFINE_int32(busypollmaxspin, 100000, "longest the busy-poll thread spins without events before it parks, in microseconds");
+DEFINE_string(eventbackend, "inotify", "how watchers read file events: inotify, bpf for BPF programs on LSM hooks filtered in the kernel by cgroup and path (needs a build with ARGUS_BPF), or poll");
+DEFINE_int32(pollbudget, 1000, "file system operations per second all polling watchers on the node may make together (0 for no limit)");
+DEFINE_int32(formatthreads, 0, "prepare and format events on this many threads, keeping each subject's events in order (0 to format on the thread that read them)");
+DEFINE_string(criendpoint, "", "CRI runtime socket to look up container PIDs with, e.g. unix:///run/containerd/containerd.sock (containers it can't find are probed through cgroups)");
+DEFINE_int32(critimeout, 1000, "milliseconds to wait for the CRI runtime to answer a batch of container lookups");
+DEFINE_int32(statsinterval, 60, "seconds between logging internal counters such as the teardown backlog (0 to disable)");
+DEFINE_string(statsfile, "", "file to also write internal counters to every -statsinterval, in Prometheus text format for node_exporter's textfile collector (e.g. /var/lib/node_exporter/argusd.prom)");
+DEFINE_int32(workerfd, -1, "internal: command socket of a watcher worker process");
+DEFINE_int32(workerringfd, -1, "internal: shared event ring of a watcher worker process");
+DEFINE_int32(workerevtfd, -1, "internal: event ring eventfd of a watcher worker process");
+
+namespace {
+std::vector<std::string> splitList(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+/**
+ * Print what a recursive watch of the `-estimate` directories would cost on
+ * this node without starting one: the number of `inotify` watches and the
+ * kernel memory they pin, the time to walk the tree and add them, and the
+ * event rate seen on a sample of its directories.
+ *
+ * @return Exit code.
+ */
+int printEstimate() {
+    auto paths = splitList(FLAGS_estimate);
+    auto ignores = splitList(FLAGS_estimateignore);
+    std::vector<const char *> pathv, ignorev;
+    std::transform(paths.cbegin(), paths.cend(), std::back_inserter(pathv), [](const std::string &s) { return s.c_str(); });
+    std::transform(ignores.cbegin(), ignores.cend(), std::back_inserter(ignorev), [](const std::string &s) { return s.c_str(); });
+
+    struct argusestimate estimate;
+    if (estimate_watch(pathv.size(), pathv.data(), ignorev.size(), ignorev.data(), IN_ALL_EVENTS,
+        AW_RECURSIVE | AW_ONLYDIR | (FLAGS_argusignore ? AW_IGNOREFILE : 0), FLAGS_estimatedepth,
+        FLAGS_estimatebudget, FLAGS_estimatesample, &estimate) == -1) {
+        LOG(ERROR) << "Could not estimate a watch of " << FLAGS_estimate;
+        return 1;
+    }
+    // Scale the sampled rate up to every watch the tree would add.
+    double eventRate = 0;
+    if (estimate.sampled_watches > 0 &&
+        estimate.sample_msec > 0) {
+        eventRate = estimate.sampled_events * 1000.0 / estimate.sample_msec *
+            estimate.watches / estimate.sampled_watches;
+    }
+    std::cout << "watches: " << estimate.watches << (estimate.exact ? "" : " (projected)") << std::endl
+        << "visited: " << estimate.visited << std::endl
+        << "kernelbytes: " << estimate.kernel_bytes << std::endl
+        << "traversalmicros: " << estimate.traversal_usec << std::endl
+        << "eventrate: " << eventRate << std::endl;
+    return 0;
+}
+} // namespace
 
 int main(int argc, char **argv) {
     google::ParseCommandLineFlags(&argc, &argv, true);
@@ -52,6 +153,36 @@ int main(int argc, char **argv) {
     FLAGS_stderrthreshold = google::INFO;
     FLAGS_colorlogtostderr = true;
 
+    argusd::ConfigureThreadRoles(FLAGS_eventcpus, FLAGS_formatcpus, FLAGS_traversalcpus);
+    argusd::ConfigureBackgroundPriority(FLAGS_backgroundsched);
+
+    if (!FLAGS_buildmanifest.empty()) {
+        // Build a manifest for subjects tagged `argusd.manifest`.
+        int rc = argusd::WriteManifest(FLAGS_buildmanifest, FLAGS_manifestout) ? 0 : 1;
+        google::ShutdownGoogleLogging();
+        google::ShutDownCommandLineFlags();
+        return rc;
+    }
+
+    if (!FLAGS_estimate.empty()) {
+        int rc = printEstimate();
+        google::ShutdownGoogleLogging();
+        google::ShutDownCommandLineFlags();
+        return rc;
+    }
+
+    if (FLAGS_workerfd != -1) {
+        // Re-executed by `argusd::WorkerPool` as a watcher worker process.
+        argusd::ArgusdImpl workerSvc;
+        // Workers share the node's polling budget.
+        const int workers = FLAGS_workers > 0 ? FLAGS_workers : static_cast<int>(argusd::GetThreadPoolSize());
+        set_poll_budget(FLAGS_pollbudget > 0 ? std::max(1, FLAGS_pollbudget / workers) : 0);
+        int rc = argusd::WorkerPool::RunWorker(FLAGS_workerfd, FLAGS_workerringfd, FLAGS_workerevtfd, workerSvc);
+        google::ShutdownGoogleLogging();
+        google::ShutDownCommandLineFlags();
+        return rc;
+    }
+
     auto readfile = [](const std::string &filename) -> std::string {
         std::ifstream fh(filename);
         std::stringstream buffer;
@@ -92,8 +223,102 @@ int main(int argc, char **argv) {
     std::string serverAddress(ss.str());
     grpc::ServerBuilder builder;
     builder.AddListeningPort(serverAddress, credentials);
+    // Size the request pollers from the CPUs argusd may use, not the node's.
+    builder.SetSyncServerOption(grpc::ServerBuilder::SyncServerOption::MAX_POLLERS,
+        std::max(2u, argusd::GetThreadPoolSize()));
 
     argusd::ArgusdImpl argusdSvc;
+    if (FLAGS_workers != 0) {
+        auto workers = std::make_shared<argusd::WorkerPool>(FLAGS_workers > 0 ? FLAGS_workers : argusd::GetThreadPoolSize(),
+            logArgusWatchEvent);
+        if (!workers->Start()) {
+            LOG(WARNING) << "Could not start watcher worker processes.";
+            return 1;
+        }
+        argusdSvc.SetWorkerPool(workers);
+    }
+    if (FLAGS_busypollcpu > -1) {
+        if (FLAGS_workers != 0) {
+            LOG(WARNING) << "-busypollcpu is ignored when watchers run in worker processes.";
+        } else if (start_busy_poller(FLAGS_busypollcpu, FLAGS_busypollmaxspin) == -1) {
+            LOG(WARNING) << "Could not start busy-poll thread; watchers wait on their own `epoll` sets.";
+        }
+    }
+    set_poll_budget(FLAGS_pollbudget);
+    if (FLAGS_eventbackend == "bpf") {
+#if ARGUS_BPF
+        if (FLAGS_workers != 0) {
+            LOG(WARNING) << "-eventbackend=bpf is ignored when watchers run in worker processes.";
+        } else if (start_bpf_backend() == -1) {
+            LOG(WARNING) << "Could not load BPF programs; watchers use `inotify`.";
+        } else {
+            argusd::Stats::Get().AddGauge("bpf_dropped", [] {
+                return bpf_dropped_events();
+            });
+        }
+#else
+        LOG(WARNING) << "-eventbackend=bpf needs a build with ARGUS_BPF; watchers use `inotify`.";
+#endif
+    }
+    std::unique_ptr<argusd::EventAggregator> aggregator;
+    if (FLAGS_aggregatewindow > 0) {
+        aggregator = std::make_unique<argusd::EventAggregator>(std::chrono::milliseconds(FLAGS_aggregatewindow),
+            argusd::writeWatchEvent);
+        kEventAggregator = aggregator.get();
+    }
+    std::unique_ptr<argusd::ContentDiffer> differ;
+    if (FLAGS_diffcachesize > 0) {
+        differ = std::make_unique<argusd::ContentDiffer>(std::min(2u, argusd::GetThreadPoolSize()),
+            static_cast<size_t>(FLAGS_diffcachesize) << 10, static_cast<size_t>(FLAGS_diffmaxfilesize) << 10,
+            argusd::writeWatchEvent);
+        kContentDiffer = differ.get();
+    }
+    std::unique_ptr<argusd::ContainerResolver> resolver;
+    if (!FLAGS_criendpoint.empty()) {
+        resolver = std::make_unique<argusd::ContainerResolver>(FLAGS_criendpoint,
+            std::chrono::milliseconds(FLAGS_critimeout));
+        resolver->Connect();
+        kContainerResolver = resolver.get();
+    }
+    argusd::MetricsSubscribers subscribers;
+    kMetricsSubscribers = &subscribers;
+    argusd::ManifestFilter manifests;
+    kManifestFilter = &manifests;
+    // Replacement watchers start next to the ones they replace; see
+    // `argusd::WatcherHandoff`.
+    argusd::WatcherHandoff handoff(std::chrono::seconds(1));
+    kWatcherHandoff = &handoff;
+    // Emits into everything above, so it is stopped before them.
+    std::unique_ptr<argusd::FormatStage> formatter;
+    if (FLAGS_formatthreads > 0) {
+        formatter = std::make_unique<argusd::FormatStage>(FLAGS_formatthreads, argusd::prepareWatchEvent);
+        kFormatStage = formatter.get();
+        argusd::Stats::Get().AddGauge("format_pending", [] {
+            return kFormatStage->Pending();
+        });
+    }
+    if (FLAGS_proactive) {
+        argusdSvc.WatchContainerStarts(FLAGS_runtimestatedirs);
+    }
+    // Watchers torn down whose `inotify` fds and caches are still being
+    // released in the background.
+    auto &stats = argusd::Stats::Get();
+    stats.AddGauge("reaper_pending", [] {
+        struct argusreap_stats reap;
+        get_reap_stats(&reap);
+        return static_cast<uint64_t>(reap.pending);
+    });
+    stats.AddGauge("reaper_pending_watches", [] {
+        struct argusreap_stats reap;
+        get_reap_stats(&reap);
+        return static_cast<uint64_t>(reap.pendingwatches);
+    });
+    stats.AddGauge("reaper_reaped", [] {
+        struct argusreap_stats reap;
+        get_reap_stats(&reap);
+        return static_cast<uint64_t>(reap.reaped);
+    });
+    stats.Start(std::chrono::seconds(FLAGS_statsinterval), FLAGS_statsfile);
     builder.RegisterService(&argusdSvc);
     argusdhealth::HealthImpl healthSvc;
     builder.RegisterService(&healthSvc);
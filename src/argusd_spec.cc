@@ -0,0 +1,82 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <openssl/sha.h>
+
+#include "argusd_spec.h"
+
+namespace argusd {
+/**
+ * Returns the subject compiled from `spec`, a canonical encoding of every
+ * field that goes into it; `compile` is only called if no watcher holds one
+ * for the same spec.
+ *
+ * @param spec
+ * @param compile
+ * @return
+ */
+std::shared_ptr<const CompiledSubject> CompiledSubjectCache::Acquire(const std::string &spec,
+    const std::function<void(CompiledSubject &)> &compile) {
+
+    uint8_t hash[SHA256_DIGEST_LENGTH];
+    SHA256(reinterpret_cast<const uint8_t *>(spec.data()), spec.size(), hash);
+    std::string digest(reinterpret_cast<const char *>(hash), sizeof(hash));
+
+    std::lock_guard<std::mutex> lock(mux_);
+    auto it = subjects_.find(digest);
+    if (it != subjects_.end()) {
+        if (auto subject = it->second.lock()) {
+            ++hits_;
+            return subject;
+        }
+    }
+    ++misses_;
+    auto compiled = new CompiledSubject();
+    compile(*compiled);
+    for (const auto &ignore : compiled->ignores) {
+        compiled->ignorev.push_back(ignore.c_str());
+    }
+    std::shared_ptr<const CompiledSubject> subject(compiled, [this, digest](const CompiledSubject *subject) {
+        release(digest);
+        delete subject;
+    });
+    subjects_[digest] = subject;
+    return subject;
+}
+
+/**
+ * Drops the entry for `digest` once its subject is no longer used, unless it
+ * was compiled again in the meantime.
+ *
+ * @param digest
+ */
+void CompiledSubjectCache::release(const std::string &digest) {
+    std::lock_guard<std::mutex> lock(mux_);
+    auto it = subjects_.find(digest);
+    if (it != subjects_.end() &&
+        it->second.expired()) {
+        subjects_.erase(it);
+    }
+}
+} // namespace argusd
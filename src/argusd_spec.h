@@ -0,0 +1,76 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUSD_SPEC_H__
+#define __ARGUSD_SPEC_H__
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "argusd_stats.h"
+
+namespace argusd {
+/**
+ * What a watcher needs from its subject that doesn't depend on the pod it
+ * runs for, in the C form argusnotify reads. Watchers hold these pointers
+ * until they return, so a compiled subject must outlive them.
+ */
+struct CompiledSubject {
+    uint32_t mask = 0, flags = 0;
+    std::vector<std::string> ignores;
+    std::vector<const char *> ignorev; // Points into `ignores`.
+    std::string tags, logFormat;
+};
+
+/**
+ * Compiled subjects keyed by a SHA-256 of their spec, shared by every watcher
+ * started from an identical subject; a DaemonSet-wide spec is compiled once
+ * per node rather than once per pod. Entries are released with the last
+ * watcher that uses them.
+ */
+class CompiledSubjectCache final {
+public:
+    explicit CompiledSubjectCache() = default;
+    ~CompiledSubjectCache() = default;
+
+    std::shared_ptr<const CompiledSubject> Acquire(const std::string &spec,
+        const std::function<void(CompiledSubject &)> &compile);
+
+private:
+    void release(const std::string &digest);
+
+    std::unordered_map<std::string, std::weak_ptr<const CompiledSubject>> subjects_; // Digest -> subject.
+    std::mutex mux_;
+    std::atomic<uint64_t> &hits_ = Stats::Get().Counter("subject_cache_hits");
+    std::atomic<uint64_t> &misses_ = Stats::Get().Counter("subject_cache_misses");
+};
+} // namespace argusd
+
+#endif
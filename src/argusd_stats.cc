@@ -0,0 +1,165 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <glog/logging.h>
+
+#include "argusd_sched.h"
+#include "argusd_stats.h"
+
+namespace argusd {
+Stats &Stats::Get() {
+    static Stats stats;
+    return stats;
+}
+
+Stats::~Stats() {
+    {
+        std::lock_guard<std::mutex> lock(mux_);
+        done_ = true;
+    }
+    cv_.notify_one();
+    if (logger_.joinable()) {
+        logger_.join();
+    }
+}
+
+/**
+ * Register a value read each time stats are logged.
+ *
+ * @param name
+ * @param read
+ */
+void Stats::AddGauge(const std::string &name, std::function<uint64_t()> read) {
+    std::lock_guard<std::mutex> lock(mux_);
+    gauges_[name] = std::move(read);
+}
+
+/**
+ * Find or create a monotonic counter. The returned reference stays valid for
+ * the life of the process, so callers can keep it and increment it without
+ * going through `Stats` again.
+ *
+ * @param name
+ * @return
+ */
+std::atomic<uint64_t> &Stats::Counter(const std::string &name) {
+    std::lock_guard<std::mutex> lock(mux_);
+    auto &counter = counters_[name];
+    if (counter == nullptr) {
+        counter = std::make_unique<std::atomic<uint64_t>>(0);
+    }
+    return *counter;
+}
+
+/**
+ * Start logging every stat once per `interval`.
+ *
+ * @param interval
+ * @param file     If not empty, also (re)written with `FormatPrometheus` each
+ *                 time.
+ */
+void Stats::Start(const std::chrono::seconds interval, const std::string &file) {
+    std::lock_guard<std::mutex> lock(mux_);
+    if (logger_.joinable() ||
+        interval.count() <= 0) {
+        return;
+    }
+    file_ = file;
+    logger_ = std::thread(&Stats::logLoop, this, interval);
+    SetThreadName("argusd-stats", logger_.native_handle());
+}
+
+/**
+ * @return Every counter and gauge as space-separated `name=value` pairs.
+ */
+std::string Stats::Format() {
+    std::lock_guard<std::mutex> lock(mux_);
+    std::stringstream ss;
+    for (const auto &counter : counters_) {
+        ss << counter.first << "=" << counter.second->load(std::memory_order_relaxed) << " ";
+    }
+    for (const auto &gauge : gauges_) {
+        ss << gauge.first << "=" << gauge.second() << " ";
+    }
+    std::string stats(ss.str());
+    if (!stats.empty()) {
+        stats.pop_back();
+    }
+    return stats;
+}
+
+/**
+ * @return Every counter and gauge in the Prometheus text format, prefixed
+ *         with `argusd_`.
+ */
+std::string Stats::FormatPrometheus() {
+    std::lock_guard<std::mutex> lock(mux_);
+    std::stringstream ss;
+    for (const auto &counter : counters_) {
+        ss << "# TYPE argusd_" << counter.first << " counter\n"
+            << "argusd_" << counter.first << " " << counter.second->load(std::memory_order_relaxed) << "\n";
+    }
+    for (const auto &gauge : gauges_) {
+        ss << "# TYPE argusd_" << gauge.first << " gauge\n"
+            << "argusd_" << gauge.first << " " << gauge.second() << "\n";
+    }
+    return ss.str();
+}
+
+/**
+ * Replace `file_` with the current stats. They are written to a temporary
+ * file first and renamed over it, so a scraper never reads a partial file.
+ */
+void Stats::writeFile() {
+    const std::string tmp = file_ + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::trunc);
+        out << FormatPrometheus();
+        if (!out.flush()) {
+            LOG(WARNING) << "Could not write stats to " << tmp;
+            return;
+        }
+    }
+    if (rename(tmp.c_str(), file_.c_str()) == -1) {
+        PLOG(WARNING) << "Could not replace " << file_;
+    }
+}
+
+void Stats::logLoop(const std::chrono::seconds interval) {
+    std::unique_lock<std::mutex> lock(mux_);
+    while (!cv_.wait_for(lock, interval, [this] { return done_; })) {
+        lock.unlock();
+        LOG(INFO) << "Stats: " << Format();
+        if (!file_.empty()) {
+            writeFile();
+        }
+        lock.lock();
+    }
+}
+} // namespace argusd
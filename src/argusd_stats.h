@@ -0,0 +1,72 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUSD_STATS_H__
+#define __ARGUSD_STATS_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace argusd {
+/**
+ * Process-wide counters and gauges, logged together every interval so
+ * backlogs inside the daemon show up without attaching a debugger, and
+ * optionally written to a file for a metrics scraper.
+ */
+class Stats final {
+public:
+    static Stats &Get();
+    ~Stats();
+
+    void AddGauge(const std::string &name, std::function<uint64_t()> read);
+    std::atomic<uint64_t> &Counter(const std::string &name);
+    void Start(std::chrono::seconds interval, const std::string &file);
+    std::string Format();
+    std::string FormatPrometheus();
+
+private:
+    Stats() = default;
+    void logLoop(std::chrono::seconds interval);
+    void writeFile();
+
+    std::map<std::string, std::function<uint64_t()>> gauges_;
+    std::map<std::string, std::unique_ptr<std::atomic<uint64_t>>> counters_;
+    std::condition_variable cv_;
+    std::mutex mux_;
+    std::thread logger_;
+    std::string file_;
+    bool done_ = false;
+};
+} // namespace argusd
+
+#endif
@@ -0,0 +1,244 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#include <sys/inotify.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <sstream>
+
+#include "argusd_subscribe.h"
+
+namespace argusd {
+namespace {
+const size_t kMaxQueued = 4096; // Messages queued per stream before new ones are dropped.
+
+/**
+ * Returns the comma-separated items of a metadata value, without empties.
+ *
+ * @param value
+ * @return
+ */
+std::vector<std::string> splitList(const grpc::string_ref &value) {
+    std::vector<std::string> items;
+    std::stringstream ss(std::string(value.data(), value.size()));
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+} // namespace
+
+uint32_t EventMaskFromName(const std::string &name) {
+    const char *evt = name.c_str();
+    if (strcmp(evt, "all") == 0)               return IN_ALL_EVENTS;
+    else if (strcmp(evt, "access") == 0)       return IN_ACCESS;
+    else if (strcmp(evt, "attrib") == 0)       return IN_ATTRIB;
+    else if (strcmp(evt, "closewrite") == 0)   return IN_CLOSE_WRITE;
+    else if (strcmp(evt, "closenowrite") == 0) return IN_CLOSE_NOWRITE;
+    else if (strcmp(evt, "close") == 0)        return IN_CLOSE;
+    else if (strcmp(evt, "create") == 0)       return IN_CREATE;
+    else if (strcmp(evt, "delete") == 0)       return IN_DELETE;
+    else if (strcmp(evt, "deleteself") == 0)   return IN_DELETE_SELF;
+    else if (strcmp(evt, "modify") == 0)       return IN_MODIFY;
+    else if (strcmp(evt, "moveself") == 0)     return IN_MOVE_SELF;
+    else if (strcmp(evt, "movedfrom") == 0)    return IN_MOVED_FROM;
+    else if (strcmp(evt, "movedto") == 0)      return IN_MOVED_TO;
+    else if (strcmp(evt, "move") == 0)         return IN_MOVE;
+    else if (strcmp(evt, "open") == 0)         return IN_OPEN;
+    return 0;
+}
+
+/**
+ * Compile the filter a client asked for when opening its stream. Unknown
+ * event names are ignored; a sample rate outside (0, 1] sends everything.
+ *
+ * @param metadata
+ * @return
+ */
+MetricsFilter MetricsFilter::FromMetadata(const std::multimap<grpc::string_ref, grpc::string_ref> &metadata) {
+    MetricsFilter filter;
+    for (const auto &it : metadata) {
+        if (it.first == "argus-watchers") {
+            for (const auto &watcher : splitList(it.second)) {
+                filter.watchers_.insert(watcher);
+            }
+        } else if (it.first == "argus-events") {
+            for (const auto &event : splitList(it.second)) {
+                filter.mask_ |= EventMaskFromName(event);
+            }
+        } else if (it.first == "argus-paths") {
+            for (const auto &prefix : splitList(it.second)) {
+                filter.prefixes_.push_back(prefix);
+            }
+        } else if (it.first == "argus-samplerate") {
+            double rate = atof(std::string(it.second.data(), it.second.size()).c_str());
+            if (rate > 0 && rate < 1) {
+                filter.stride_ = static_cast<uint64_t>(std::llround(1 / rate));
+            }
+        }
+    }
+    return filter;
+}
+
+/**
+ * Returns true if `event` should be sent on the stream. Cheapest checks
+ * first; sampling counts only events that passed the others.
+ *
+ * @param event
+ * @return
+ */
+bool MetricsFilter::Match(const WatchEvent &event) {
+    if (mask_ != 0 &&
+        !(event.mask & mask_)) {
+        return false;
+    }
+    if (!watchers_.empty() &&
+        !watchers_.count(event.watcherName)) {
+        return false;
+    }
+    if (!prefixes_.empty()) {
+        std::string path = event.file.empty() ? event.path : event.path + "/" + event.file;
+        bool found = false;
+        for (const auto &prefix : prefixes_) {
+            if (path.compare(0, prefix.size(), prefix) == 0) {
+                found = true;
+                break;
+            }
+        }
+        if (!found) {
+            return false;
+        }
+    }
+    return seen_++ % stride_ == 0;
+}
+
+std::string MetricsFilter::ToString() const {
+    std::stringstream ss;
+    ss << "watchers=" << (watchers_.empty() ? "*" : std::to_string(watchers_.size()))
+        << " mask=0x" << std::hex << mask_ << std::dec
+        << " paths=" << (prefixes_.empty() ? "*" : std::to_string(prefixes_.size()))
+        << " sample=1/" << stride_;
+    return ss.str();
+}
+
+/**
+ * @param writer
+ * @param filter
+ * @return ID to pass to `Wait` and `Unsubscribe`.
+ */
+int MetricsSubscribers::Subscribe(grpc::ServerWriter<argus::ArgusdMetricsHandle> *writer, MetricsFilter filter) {
+    std::lock_guard<std::mutex> lock(mux_);
+    int id = nextId_++;
+    subscribers_.emplace(id, Subscriber{writer, std::move(filter)});
+    return id;
+}
+
+/**
+ * Write the messages queued for the stream, on the stream's own thread, until
+ * the client goes away, either by cancelling the call or by a write to its
+ * stream failing.
+ *
+ * @param id
+ * @param context
+ */
+void MetricsSubscribers::Wait(const int id, grpc::ServerContext *context) {
+    std::unique_lock<std::mutex> lock(mux_);
+    while (!context->IsCancelled()) {
+        auto it = subscribers_.find(id);
+        if (it == subscribers_.end()) {
+            return;
+        }
+        if (it->second.queue.empty()) {
+            cv_.wait_for(lock, std::chrono::seconds(1));
+            continue;
+        }
+        std::deque<argus::ArgusdMetricsHandle> batch;
+        batch.swap(it->second.queue);
+        auto writer = it->second.writer;
+        lock.unlock();
+        bool ok = true;
+        for (const auto &metric : batch) {
+            // Record event to metrics writer to be put into Prometheus.
+            if (!(ok = writer->Write(metric))) {
+                break;
+            }
+        }
+        lock.lock();
+        if (!ok) {
+            // Broken stream.
+            return;
+        }
+    }
+}
+
+void MetricsSubscribers::Unsubscribe(const int id) {
+    std::lock_guard<std::mutex> lock(mux_);
+    subscribers_.erase(id);
+}
+
+/**
+ * Queue `event` for every stream whose filter matches it. Streams are written
+ * by their own `RecordMetrics` calls, so a slow client never holds up the
+ * event path; a stream that falls `kMaxQueued` messages behind misses new
+ * ones until it catches up.
+ *
+ * @param event
+ */
+void MetricsSubscribers::Publish(const WatchEvent &event) {
+    std::lock_guard<std::mutex> lock(mux_);
+    std::unique_ptr<argus::ArgusdMetricsHandle> metric;
+    bool queued = false;
+    for (auto &it : subscribers_) {
+        auto &sub = it.second;
+        if (!sub.filter.Match(event)) {
+            continue;
+        }
+        if (sub.queue.size() >= kMaxQueued) {
+            ++dropped_;
+            continue;
+        }
+        if (metric == nullptr) {
+            metric = std::make_unique<argus::ArgusdMetricsHandle>();
+            metric->set_arguswatcher(event.watcherName);
+            std::string maskStr(event.event);
+            std::transform(maskStr.begin(), maskStr.end(), maskStr.begin(), ::tolower);
+            metric->set_event(maskStr);
+            metric->set_nodename(event.nodeName);
+        }
+        sub.queue.push_back(*metric);
+        queued = true;
+    }
+    if (queued) {
+        cv_.notify_all();
+    }
+}
+} // namespace argusd
@@ -0,0 +1,111 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+
+#ifndef __ARGUSD_SUBSCRIBE_H__
+#define __ARGUSD_SUBSCRIBE_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <grpc++/server_context.h>
+#include <argus-proto/c++/argus.grpc.pb.h>
+
+#include "argusd_aggregate.h"
+#include "argusd_stats.h"
+
+namespace argusd {
+/**
+ * Returns the `inotify` mask for an event name as used in ArgusWatcher
+ * subjects ("modify", "closewrite", "all", ...), or 0 if unknown.
+ *
+ * @param name
+ * @return
+ */
+uint32_t EventMaskFromName(const std::string &name);
+
+/**
+ * Which events a `RecordMetrics` stream wants, compiled once from the
+ * metadata the client opened it with:
+ *
+ *   argus-watchers:   comma-separated ArgusWatcher names
+ *   argus-events:     comma-separated event names, as in subjects
+ *   argus-paths:      comma-separated container path prefixes
+ *   argus-samplerate: fraction of matching events to send, in (0, 1]
+ *
+ * A missing key matches everything.
+ */
+class MetricsFilter final {
+public:
+    static MetricsFilter FromMetadata(const std::multimap<grpc::string_ref, grpc::string_ref> &metadata);
+
+    bool Match(const WatchEvent &event);
+    std::string ToString() const;
+
+private:
+    std::set<std::string> watchers_;
+    std::vector<std::string> prefixes_;
+    uint32_t mask_ = 0;
+    uint64_t stride_ = 1; // Send every `stride_`th matching event.
+    uint64_t seen_ = 0;
+};
+
+/**
+ * The open `RecordMetrics` streams. Each event is matched against every
+ * stream's filter first; the metrics message is only built if one wants it,
+ * and is then built once for all of them.
+ */
+class MetricsSubscribers final {
+public:
+    MetricsSubscribers() = default;
+    ~MetricsSubscribers() = default;
+
+    int Subscribe(grpc::ServerWriter<argus::ArgusdMetricsHandle> *writer, MetricsFilter filter);
+    void Wait(int id, grpc::ServerContext *context);
+    void Unsubscribe(int id);
+    void Publish(const WatchEvent &event);
+
+private:
+    struct Subscriber {
+        grpc::ServerWriter<argus::ArgusdMetricsHandle> *writer;
+        MetricsFilter filter;
+        std::deque<argus::ArgusdMetricsHandle> queue; // Written by the stream's own `Wait`.
+    };
+
+    std::map<int, Subscriber> subscribers_;
+    int nextId_ = 0;
+    std::atomic<uint64_t> &dropped_ = Stats::Get().Counter("metrics_dropped");
+    std::condition_variable cv_;
+    std::mutex mux_;
+};
+} // namespace argusd
+
+#endif
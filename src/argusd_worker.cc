@@ -0,0 +1,560 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <thread>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "argusd_handoff.h"
+#include "argusd_impl.h"
+#include "argusd_sched.h"
+#include "argusd_worker.h"
+
+extern "C" {
+#include <lib/argusnotify.h>
+}
+
+namespace argusd {
+namespace {
+const size_t kRingSize = 1 << 20;         // Bytes of event records per worker.
+const size_t kMaxMessageSize = 1 << 16;   // Largest command sent over the worker socket.
+const int kRingFullRetries = 50;          // Attempts to find ring space before an event is dropped.
+
+enum WorkerOp : uint32_t {
+    kOpStart = 1,   // argusd -> worker: start one subject of a watcher.
+    kOpKill,        // argusd -> worker: stop all watchers for a PID.
+    kOpDone,        // worker -> argusd: all watchers for a PID stopped.
+    kOpKillSubject, // argusd -> worker: stop the watcher of one subject of a PID.
+};
+
+struct WorkerMessage {
+    uint32_t op;
+    int32_t pid, sid, subjectLen;
+    // Followed by a serialized `argus::ArgusdConfig` holding one subject
+    // (`kOpStart` only).
+};
+
+/**
+ * Event record written to the ring. Records are 8-byte aligned; a record
+ * with `len == 0` marks that the rest of the ring is unused and the reader
+ * wraps around to offset 0.
+ */
+struct RingRecord {
+    uint32_t len;
+    int32_t pid, sid;
+    uint32_t mask, count;
+    uint32_t flags;            // `arguswatch` flags, for options read by the log function.
+    uint32_t pathLen, fileLen; // Including terminating null byte.
+    uint32_t isDir;
+    // Followed by path name then file name.
+};
+
+inline size_t align8(const size_t n) {
+    return (n + 7) & ~static_cast<size_t>(7);
+}
+
+// Ring and `eventfd` this worker process publishes events to.
+WorkerPool::Ring *kWorkerRing = nullptr;
+int kWorkerEvtFd = -1;
+std::mutex kWorkerRingMux;
+} // namespace
+
+struct WorkerPool::Ring {
+    std::atomic<uint64_t> head;    // Written by the worker.
+    std::atomic<uint64_t> tail;    // Written by argusd.
+    std::atomic<uint64_t> dropped; // Events dropped by the worker because the ring was full.
+    char data[kRingSize];
+};
+
+namespace {
+/**
+ * Log function installed in worker processes. Copies the event into the
+ * shared ring and wakes the argusd consumer; `watch` fields other than the
+ * PID and subject ID are restored from argusd's own copy of the watcher.
+ *
+ * @param awevent
+ */
+void writeWorkerEvent(struct arguswatch_event *awevent) {
+    const uint32_t pathLen = strlen(awevent->path_name) + 1;
+    const uint32_t fileLen = strlen(awevent->file_name) + 1;
+    const size_t need = align8(sizeof(RingRecord) + pathLen + fileLen);
+    if (need > kRingSize / 2) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(kWorkerRingMux);
+    auto ring = kWorkerRing;
+    uint64_t head = ring->head.load(std::memory_order_relaxed);
+    size_t off, contig;
+    for (int i = 0;; ++i) {
+        const uint64_t tail = ring->tail.load(std::memory_order_acquire);
+        off = head % kRingSize;
+        contig = kRingSize - off;
+        if (kRingSize - (head - tail) >= need + (contig < need ? contig : 0)) {
+            break;
+        }
+        if (i == kRingFullRetries) {
+            ring->dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    if (contig < need) {
+        // Not enough room before the end; mark the wrap and start over.
+        reinterpret_cast<RingRecord *>(ring->data + off)->len = 0;
+        head += contig;
+        off = 0;
+    }
+
+    auto record = reinterpret_cast<RingRecord *>(ring->data + off);
+    record->len = need;
+    record->pid = awevent->watch->pid;
+    record->sid = awevent->watch->sid;
+    record->mask = awevent->event_mask;
+    record->count = awevent->count;
+    record->flags = awevent->watch->flags;
+    record->pathLen = pathLen;
+    record->fileLen = fileLen;
+    record->isDir = awevent->is_dir;
+    memcpy(ring->data + off + sizeof(RingRecord), awevent->path_name, pathLen);
+    memcpy(ring->data + off + sizeof(RingRecord) + pathLen, awevent->file_name, fileLen);
+    ring->head.store(head + need, std::memory_order_release);
+
+    uint64_t value = 1;
+    if (write(kWorkerEvtFd, &value, sizeof(value)) == -1) {
+        PLOG(WARNING) << "Could not signal event ring";
+    }
+}
+} // namespace
+
+/**
+ * Creates a pool of `workers` processes; nothing is started until `Start`.
+ * Events read back from the workers are passed to `logfn`.
+ *
+ * @param workers
+ * @param logfn
+ */
+WorkerPool::WorkerPool(const int workers, arguswatch_logfn logfn) : logfn_(logfn) {
+    for (int i = 0; i < workers; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+}
+
+/**
+ * Creates the shared event ring of each worker, spawns the worker processes
+ * and starts the threads that consume their events and restart them if they
+ * exit. Must be called before any other threads are started, since workers
+ * are forked from this process.
+ *
+ * @return
+ */
+bool WorkerPool::Start() {
+    for (auto &worker : workers_) {
+        worker->ringfd = memfd_create("argusd-ring", MFD_CLOEXEC);
+        if (worker->ringfd == -1 ||
+            ftruncate(worker->ringfd, sizeof(Ring)) == -1) {
+            PLOG(ERROR) << "Could not create worker event ring";
+            return false;
+        }
+        void *ring = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED, worker->ringfd, 0);
+        if (ring == MAP_FAILED) {
+            PLOG(ERROR) << "Could not map worker event ring";
+            return false;
+        }
+        // Pages of a new memfd are zero-filled, so head, tail are already 0.
+        worker->ring = static_cast<Ring *>(ring);
+        worker->evtfd = eventfd(0, EFD_CLOEXEC);
+        if (worker->evtfd == -1) {
+            PLOG(ERROR) << "Could not create worker event fd";
+            return false;
+        }
+        if (!spawnWorker(*worker)) {
+            return false;
+        }
+    }
+
+    for (auto &worker : workers_) {
+        std::thread(&WorkerPool::superviseWorker, this, std::ref(*worker)).detach();
+        std::thread(&WorkerPool::consumeRing, this, std::ref(*worker)).detach();
+    }
+    LOG(INFO) << "Started " << workers_.size() << " watcher worker processes";
+    return true;
+}
+
+/**
+ * Sends one subject of a watcher to the worker that owns `pid`. The command
+ * is kept so it can be replayed if the worker has to be restarted.
+ *
+ * @param watcherName
+ * @param nodeName
+ * @param podName
+ * @param subject
+ * @param pid
+ * @param sid
+ * @param subjectLen
+ * @param logFormat
+ * @param tags
+ */
+void WorkerPool::StartWatcher(const std::string &watcherName, const std::string &nodeName, const std::string &podName,
+    const argus::ArgusWatcherSubject &subject, const int pid, const int sid, const int subjectLen,
+    const std::string &logFormat, const std::string &tags) {
+
+    auto shadow = std::make_shared<Shadow>();
+    shadow->name = watcherName;
+    shadow->nodeName = nodeName;
+    shadow->podName = podName;
+    shadow->tags = tags;
+    shadow->logFormat = logFormat;
+    memset(&shadow->watch, 0, sizeof(shadow->watch));
+    shadow->watch.name = shadow->name.c_str();
+    shadow->watch.node_name = shadow->nodeName.c_str();
+    shadow->watch.pod_name = shadow->podName.c_str();
+    shadow->watch.tags = shadow->tags.c_str();
+    shadow->watch.log_format = shadow->logFormat.c_str();
+    shadow->watch.pid = pid;
+    shadow->watch.sid = sid;
+    shadow->watch.slot = -1;
+    {
+        std::lock_guard<std::mutex> lock(shadowMux_);
+        shadows_[std::make_pair(pid, sid)] = shadow;
+    }
+
+    argus::ArgusdConfig config;
+    config.set_name(watcherName);
+    config.set_nodename(nodeName);
+    config.set_podname(podName);
+    config.set_logformat(logFormat);
+    *config.add_subject() = subject;
+
+    WorkerMessage header = {kOpStart, pid, sid, subjectLen};
+    std::string msg(reinterpret_cast<const char *>(&header), sizeof(header));
+    msg += config.SerializeAsString();
+
+    auto &worker = workerForPid(pid);
+    std::lock_guard<std::mutex> lock(worker.mux);
+    if (sid % kSubjectStride == 0) {
+        // A new epoch replaces the PID's watchers.
+        worker.started[pid].clear();
+    }
+    worker.started[pid].push_back(msg);
+    sendCommand(worker, msg);
+}
+
+/**
+ * Asks the worker that owns `pid` to stop all of its watchers; the done
+ * handler is called once they have.
+ *
+ * @param pid
+ */
+void WorkerPool::KillWatcher(const int pid) {
+    auto &worker = workerForPid(pid);
+    {
+        std::lock_guard<std::mutex> lock(worker.mux);
+        worker.started.erase(pid);
+        WorkerMessage header = {kOpKill, pid, 0, 0};
+        sendCommand(worker, std::string(reinterpret_cast<const char *>(&header), sizeof(header)));
+    }
+    // Events still queued in the ring for this PID are discarded.
+    std::lock_guard<std::mutex> lock(shadowMux_);
+    for (auto it = shadows_.begin(); it != shadows_.end();) {
+        it = it->first.first == pid ? shadows_.erase(it) : std::next(it);
+    }
+}
+
+/**
+ * Asks the worker that owns `pid` to stop the watcher of subject `sid` only;
+ * used to retire the old epoch after a make-before-break handoff.
+ *
+ * @param pid
+ * @param sid
+ */
+void WorkerPool::KillSubject(const int pid, const int sid) {
+    auto &worker = workerForPid(pid);
+    {
+        std::lock_guard<std::mutex> lock(worker.mux);
+        WorkerMessage header = {kOpKillSubject, pid, sid, 0};
+        sendCommand(worker, std::string(reinterpret_cast<const char *>(&header), sizeof(header)));
+    }
+    std::lock_guard<std::mutex> lock(shadowMux_);
+    shadows_.erase(std::make_pair(pid, sid));
+}
+
+/**
+ * Fork and exec a worker process: argusd is re-run with its original
+ * arguments plus the fds of the command socket, event ring and `eventfd`.
+ * The worker is killed if argusd exits.
+ *
+ * @param worker
+ * @return
+ */
+bool WorkerPool::spawnWorker(Worker &worker) {
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv) == -1) {
+        PLOG(ERROR) << "Could not create worker command socket";
+        return false;
+    }
+
+    std::vector<std::string> args(google::GetArgvs());
+    args.push_back("-workerfd=" + std::to_string(sv[1]));
+    args.push_back("-workerringfd=" + std::to_string(worker.ringfd));
+    args.push_back("-workerevtfd=" + std::to_string(worker.evtfd));
+    std::vector<char *> argv;
+    for (auto &arg : args) {
+        argv.push_back(&arg[0]);
+    }
+    argv.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        PLOG(ERROR) << "Could not fork worker process";
+        close(sv[0]);
+        close(sv[1]);
+        return false;
+    }
+    if (pid == 0) {
+        // Only async-signal-safe calls until `execv`.
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        for (int fd : {sv[1], worker.ringfd, worker.evtfd}) {
+            fcntl(fd, F_SETFD, 0);
+        }
+        execv("/proc/self/exe", argv.data());
+        _exit(127);
+    }
+    close(sv[1]);
+    worker.pid = pid;
+    worker.cmdfd = sv[0];
+    return true;
+}
+
+/**
+ * Waits for messages from a worker. When the worker exits (its end of the
+ * command socket is closed), it is restarted and every watcher that was
+ * running on it is started again.
+ *
+ * @param worker
+ */
+void WorkerPool::superviseWorker(Worker &worker) {
+    SetThreadName("argusd-sup");
+    char buf[kMaxMessageSize];
+    for (;;) {
+        ssize_t len = recv(worker.cmdfd, buf, sizeof(buf), 0);
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len >= static_cast<ssize_t>(sizeof(WorkerMessage))) {
+            auto msg = reinterpret_cast<const WorkerMessage *>(buf);
+            if (msg->op == kOpDone && doneFn_) {
+                doneFn_(msg->pid);
+            }
+            continue;
+        }
+        if (len > 0) {
+            continue;
+        }
+
+        int status = 0;
+        waitpid(worker.pid, &status, 0);
+        LOG(ERROR) << "Watcher worker process " << worker.pid << " exited (status " << status << "); restarting";
+
+        std::lock_guard<std::mutex> lock(worker.mux);
+        close(worker.cmdfd);
+        worker.cmdfd = -1;
+        while (!spawnWorker(worker)) {
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        }
+        for (const auto &it : worker.started) {
+            for (const auto &msg : it.second) {
+                sendCommand(worker, msg);
+            }
+        }
+    }
+}
+
+/**
+ * Reads event records published by a worker and passes them to the log
+ * function with the argusd copy of the watcher they belong to.
+ *
+ * @param worker
+ */
+void WorkerPool::consumeRing(Worker &worker) {
+    SetThreadName("argusd-ring");
+    SetThreadRole(ThreadRole::kFormatter);
+    auto ring = worker.ring;
+    uint64_t dropped = 0;
+    for (;;) {
+        uint64_t value;
+        if (read(worker.evtfd, &value, sizeof(value)) == -1) {
+            if (errno != EINTR) {
+                PLOG(ERROR) << "Could not read worker event fd";
+                return;
+            }
+            continue;
+        }
+
+        uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+        while (tail != ring->head.load(std::memory_order_acquire)) {
+            const size_t off = tail % kRingSize;
+            auto record = reinterpret_cast<const RingRecord *>(ring->data + off);
+            if (record->len == 0) {
+                tail += kRingSize - off;
+                continue;
+            }
+
+            std::shared_ptr<Shadow> shadow;
+            {
+                std::lock_guard<std::mutex> lock(shadowMux_);
+                auto it = shadows_.find(std::make_pair(record->pid, record->sid));
+                if (it != shadows_.end()) {
+                    shadow = it->second;
+                }
+            }
+            if (shadow != nullptr) {
+                struct arguswatch_event awevent = {};
+                shadow->watch.flags = record->flags;
+                awevent.watch = &shadow->watch;
+                awevent.path_name = ring->data + off + sizeof(RingRecord);
+                awevent.file_name = awevent.path_name + record->pathLen;
+                awevent.event_mask = record->mask;
+                awevent.count = record->count;
+                awevent.is_dir = record->isDir;
+                logfn_(&awevent);
+            }
+            tail += record->len;
+            ring->tail.store(tail, std::memory_order_release);
+        }
+
+        if (ring->dropped.load(std::memory_order_relaxed) != dropped) {
+            dropped = ring->dropped.load(std::memory_order_relaxed);
+            LOG(WARNING) << "Watcher worker process " << worker.pid << " dropped " << dropped
+                << " events total because its event ring was full";
+        }
+    }
+}
+
+/**
+ * Sends a command to a worker; `worker.mux` must be held. A command that
+ * cannot be sent because the worker died is replayed after it restarts.
+ *
+ * @param worker
+ * @param msg
+ * @return
+ */
+bool WorkerPool::sendCommand(Worker &worker, const std::string &msg) {
+    if (worker.cmdfd == -1 ||
+        send(worker.cmdfd, msg.data(), msg.size(), MSG_NOSIGNAL) == -1) {
+        PLOG(WARNING) << "Could not send command to watcher worker process " << worker.pid;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Main loop of a worker process. Watchers are started as threads of this
+ * process, exactly as argusd does without workers, but events are written to
+ * the shared ring instead of being logged.
+ *
+ * @param cmdfd
+ * @param ringfd
+ * @param evtfd
+ * @param impl
+ * @return
+ */
+int WorkerPool::RunWorker(const int cmdfd, const int ringfd, const int evtfd, ArgusdImpl &impl) {
+    prctl(PR_SET_NAME, "argusd-worker");
+    if (getppid() == 1) {
+        // argusd exited before `PR_SET_PDEATHSIG` took effect.
+        return 1;
+    }
+
+    void *ring = mmap(nullptr, sizeof(Ring), PROT_READ | PROT_WRITE, MAP_SHARED, ringfd, 0);
+    if (ring == MAP_FAILED) {
+        PLOG(ERROR) << "Could not map worker event ring";
+        return 1;
+    }
+    kWorkerRing = static_cast<Ring *>(ring);
+    kWorkerEvtFd = evtfd;
+    impl.logfn_ = writeWorkerEvent;
+
+    char buf[kMaxMessageSize];
+    for (;;) {
+        ssize_t len = recv(cmdfd, buf, sizeof(buf), 0);
+        if (len == -1 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            // argusd closed its end of the command socket.
+            break;
+        }
+        if (len < static_cast<ssize_t>(sizeof(WorkerMessage))) {
+            continue;
+        }
+
+        auto msg = reinterpret_cast<const WorkerMessage *>(buf);
+        if (msg->op == kOpStart) {
+            argus::ArgusdConfig config;
+            if (!config.ParseFromArray(buf + sizeof(WorkerMessage), len - sizeof(WorkerMessage)) ||
+                config.subject_size() != 1) {
+                LOG(WARNING) << "Malformed watcher worker command";
+                continue;
+            }
+            if (msg->sid % kSubjectStride == 0) {
+                impl.doneMap_[msg->pid] = false;
+            }
+            impl.createInotifyWatcher(config.name(), config.nodename(), config.podname(),
+                std::make_shared<argus::ArgusWatcherSubject>(config.subject(0)), msg->pid, msg->sid,
+                msg->subjectLen, config.logformat());
+        } else if (msg->op == kOpKill) {
+            const int pid = msg->pid;
+            send_watcher_kill_signal(pid);
+            {
+                // Wait for all inotify threads of this PID to be finished.
+                std::unique_lock<std::mutex> lock(impl.mux_);
+                impl.cv_.wait_until(lock, std::chrono::system_clock::now() + std::chrono::seconds(2), [&] {
+                    auto it = impl.doneMap_.find(pid);
+                    return it == impl.doneMap_.end() || it->second;
+                });
+            }
+            WorkerMessage done = {kOpDone, pid, 0, 0};
+            send(cmdfd, &done, sizeof(done), MSG_NOSIGNAL);
+        } else if (msg->op == kOpKillSubject) {
+            send_subject_kill_signal(msg->pid, msg->sid);
+        }
+    }
+    return 0;
+}
+} // namespace argusd
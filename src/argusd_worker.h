@@ -0,0 +1,117 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __ARGUSD_WORKER_H__
+#define __ARGUSD_WORKER_H__
+
+#include <sys/types.h>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <argus-proto/c++/argus.grpc.pb.h>
+
+extern "C" {
+#include <lib/argusutil.h>
+}
+
+namespace argusd {
+class ArgusdImpl;
+
+/**
+ * Runs argusnotify watchers in a fixed set of worker processes instead of
+ * threads of argusd, sharded by container PID. Commands go to each worker
+ * over a `SOCK_SEQPACKET` socket; events come back through a shared-memory
+ * ring per worker and are handed to the regular log function by argusd.
+ */
+class WorkerPool final {
+public:
+    explicit WorkerPool(int workers, arguswatch_logfn logfn);
+    ~WorkerPool() = default;
+
+    bool Start();
+    void StartWatcher(const std::string &watcherName, const std::string &nodeName, const std::string &podName,
+        const argus::ArgusWatcherSubject &subject, int pid, int sid, int subjectLen, const std::string &logFormat,
+        const std::string &tags);
+    void KillWatcher(int pid);
+    void KillSubject(int pid, int sid);
+
+    /**
+     * Set the function called when a worker reports that all watchers for a
+     * PID have stopped after `KillWatcher`.
+     *
+     * @param fn
+     */
+    inline void SetDoneHandler(std::function<void(int)> fn) {
+        doneFn_ = std::move(fn);
+    }
+
+    static int RunWorker(int cmdfd, int ringfd, int evtfd, ArgusdImpl &impl);
+
+    struct Ring;
+
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int cmdfd = -1;                   // Command socket to the worker.
+        int ringfd = -1, evtfd = -1;      // Shared ring memory, "ring published" `eventfd`.
+        Ring *ring = nullptr;
+        // Commands for watchers running on this worker, replayed on restart.
+        std::map<int, std::vector<std::string>> started;
+        std::mutex mux;
+    };
+
+    struct Shadow {
+        std::string name, nodeName, podName, tags, logFormat;
+        struct arguswatch watch;
+    };
+
+    bool spawnWorker(Worker &worker);
+    void superviseWorker(Worker &worker);
+    void consumeRing(Worker &worker);
+    bool sendCommand(Worker &worker, const std::string &msg);
+
+    /**
+     * Workers are chosen by PID so all subjects of a container share one.
+     *
+     * @param pid
+     * @return
+     */
+    inline Worker &workerForPid(const int pid) {
+        return *workers_[pid % workers_.size()];
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::map<std::pair<int, int>, std::shared_ptr<Shadow>> shadows_;
+    std::mutex shadowMux_;
+    std::function<void(int)> doneFn_;
+    arguswatch_logfn logfn_;
+};
+} // namespace argusd
+
+#endif
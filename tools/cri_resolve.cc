@@ -0,0 +1,65 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * Resolves container IDs to PIDs with `argusd::ContainerResolver`, the same
+ * path `argusd -criendpoint` takes for `CreateWatch`, and prints one
+ * "container pid" line per ID (0 if not found):
+ *
+ *   cri_resolve -endpoint=unix:///tmp/cri.sock containerd://abc containerd://def
+ */
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "argusd_cri.h"
+
+DEFINE_string(endpoint, "unix:///tmp/fake-cri.sock", "CRI runtime socket to look up containers through");
+DEFINE_int32(timeout, 1000, "milliseconds to wait for the runtime to answer a batch of container lookups");
+
+int main(int argc, char **argv) {
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_logtostderr = true;
+
+    argusd::ContainerResolver resolver(FLAGS_endpoint, std::chrono::milliseconds(FLAGS_timeout));
+    if (!resolver.Connect()) {
+        LOG(ERROR) << "Could not reach CRI runtime at " << FLAGS_endpoint;
+        return 1;
+    }
+    std::vector<std::string> cids(argv + 1, argv + argc);
+    auto pids = resolver.Resolve(cids);
+    for (size_t i = 0; i < cids.size(); ++i) {
+        std::cout << cids[i] << " " << pids[i] << std::endl;
+    }
+
+    google::ShutdownGoogleLogging();
+    google::ShutDownCommandLineFlags();
+    return 0;
+}
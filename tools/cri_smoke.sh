@@ -0,0 +1,43 @@
+#!/bin/sh
+#
+# Smoke test for container lookups through a CRI runtime socket: starts
+# fake_cri_server and resolves containers with cri_resolve, the path argusd
+# takes with -criendpoint. Build with -DARGUSD_FAKE_CRI=ON, then run
+#
+#   tools/cri_smoke.sh BUILD_DIR
+#
+# Checked: a running container resolves to its PID; a PID that isn't running,
+# one out of range for an int and an unknown container resolve to 0.
+
+set -eu
+
+bin=${1:-build}
+sock=$(mktemp -u /tmp/fake-cri.XXXXXX)
+
+"$bin/fake_cri_server" -socket="unix://$sock" \
+    -containers=live=self,exited=999999999,huge=99999999999999999999 2>/dev/null &
+server=$!
+trap 'kill $server 2>/dev/null; rm -f "$sock"' EXIT
+
+i=0
+while [ ! -S "$sock" ]; do
+    i=$((i + 1))
+    if [ $i -gt 50 ]; then
+        echo "fake_cri_server did not start" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+out=$("$bin/cri_resolve" -endpoint="unix://$sock" \
+    containerd://live containerd://exited containerd://huge containerd://unknown 2>/dev/null)
+expected="containerd://live $server
+containerd://exited 0
+containerd://huge 0
+containerd://unknown 0"
+
+if [ "$out" != "$expected" ]; then
+    printf 'unexpected lookups:\n%s\nexpected:\n%s\n' "$out" "$expected" >&2
+    exit 1
+fi
+echo "cri smoke test passed"
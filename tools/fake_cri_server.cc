@@ -0,0 +1,139 @@
+/**
+ * MIT License
+ *
+ * Copyright (c) 2018 ClusterGarage
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/**
+ * A stand-in for a node's CRI runtime, answering `Version` and
+ * `ContainerStatus` for a fixed set of containers so `-criendpoint` can be
+ * exercised without containerd or cri-o:
+ *
+ *   fake_cri_server -socket=unix:///tmp/cri.sock -containers=abc=self,def=1234
+ *   argusd -criendpoint=unix:///tmp/cri.sock
+ */
+
+#include <unistd.h>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <grpc/grpc.h>
+#include <grpc++/server.h>
+#include <grpc++/server_builder.h>
+#include <grpc++/security/server_credentials.h>
+#include <runtime/v1/api.grpc.pb.h>
+
+DEFINE_string(socket, "unix:///tmp/fake-cri.sock", "address to serve the CRI runtime service on");
+DEFINE_string(containers, "", "comma-separated container=pid pairs to report as running (\"self\" for this server's PID)");
+DEFINE_int32(latency, 0, "milliseconds to wait before answering each call, to mimic a loaded runtime");
+
+namespace {
+class FakeRuntimeService final : public runtime::v1::RuntimeService::Service {
+public:
+    explicit FakeRuntimeService(const std::string &containers) {
+        std::stringstream ss(containers);
+        std::string pair;
+        while (std::getline(ss, pair, ',')) {
+            auto pos = pair.find('=');
+            if (pos == std::string::npos) {
+                LOG(WARNING) << "Malformed container \"" << pair << "\"; expected container=pid";
+                continue;
+            }
+            // Reported as given, so out-of-range PIDs can be served too.
+            std::string pid = pair.substr(pos + 1);
+            if (pid == "self") {
+                pid = std::to_string(getpid());
+            }
+            if (pid.empty() ||
+                pid.find_first_not_of("0123456789") != std::string::npos) {
+                LOG(WARNING) << "Malformed PID \"" << pid << "\" of container " << pair.substr(0, pos);
+                continue;
+            }
+            pids_[pair.substr(0, pos)] = pid;
+        }
+    }
+
+    grpc::Status Version(grpc::ServerContext *context, const runtime::v1::VersionRequest *request,
+        runtime::v1::VersionResponse *response) override {
+
+        delay();
+        response->set_version("0.1.0");
+        response->set_runtime_name("fake-cri");
+        response->set_runtime_version("0.1.0");
+        response->set_runtime_api_version("v1");
+        return grpc::Status::OK;
+    }
+
+    grpc::Status ContainerStatus(grpc::ServerContext *context, const runtime::v1::ContainerStatusRequest *request,
+        runtime::v1::ContainerStatusResponse *response) override {
+
+        delay();
+        auto it = pids_.find(request->container_id());
+        if (it == pids_.end()) {
+            return grpc::Status(grpc::StatusCode::NOT_FOUND, "container \"" + request->container_id() + "\" not found");
+        }
+        response->mutable_status()->set_id(it->first);
+        response->mutable_status()->set_state(runtime::v1::CONTAINER_RUNNING);
+        if (request->verbose()) {
+            // Same shape as containerd's verbose info.
+            (*response->mutable_info())["info"] = "{\"sandboxID\":\"\",\"pid\":" + it->second + "}";
+        }
+        return grpc::Status::OK;
+    }
+
+private:
+    void delay() const {
+        if (FLAGS_latency > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(FLAGS_latency));
+        }
+    }
+
+    std::map<std::string, std::string> pids_; // Container ID -> PID, as reported.
+};
+} // namespace
+
+int main(int argc, char **argv) {
+    google::ParseCommandLineFlags(&argc, &argv, true);
+    google::InitGoogleLogging(argv[0]);
+    FLAGS_logtostderr = true;
+
+    FakeRuntimeService service(FLAGS_containers);
+    grpc::ServerBuilder builder;
+    builder.AddListeningPort(FLAGS_socket, grpc::InsecureServerCredentials());
+    builder.RegisterService(&service);
+    std::unique_ptr<grpc::Server> server(builder.BuildAndStart());
+    if (server == nullptr) {
+        LOG(ERROR) << "Could not listen on " << FLAGS_socket;
+        return 1;
+    }
+    LOG(INFO) << "Fake CRI runtime listening on " << FLAGS_socket;
+    server->Wait();
+
+    google::ShutdownGoogleLogging();
+    google::ShutDownCommandLineFlags();
+    return 0;
+}